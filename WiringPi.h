@@ -73,6 +73,43 @@ void delay(uint64_t ms);
  */
 void delayMicroseconds(uint64_t us);
 
+// Shift the least significant bit first
+#define LSBFIRST 0
+
+// Shift the most significant bit first
+#define MSBFIRST 1
+
+/**
+ * Shift a byte out one bit at a time.
+ *
+ * arg dPin  - The WiringPi pin driving the data line.
+ * arg cPin  - The WiringPi pin driving the clock line.
+ * arg order - Either LSBFIRST or MSBFIRST.
+ * arg val   - The byte to shift out.
+ */
+void shiftOut(uint8_t dPin, uint8_t cPin, uint8_t order, uint8_t val);
+
+/**
+ * Shift a byte in one bit at a time.
+ *
+ * arg dPin  - The WiringPi pin reading the data line.
+ * arg cPin  - The WiringPi pin driving the clock line.
+ * arg order - Either LSBFIRST or MSBFIRST.
+ *
+ * returns - The byte shifted in.
+ */
+uint8_t shiftIn(uint8_t dPin, uint8_t cPin, uint8_t order);
+
+/**
+ * Read the voltage on a wiring pi pin using the internal ADC of the board.
+ *
+ * arg pin - The WiringPi pin to read, see `gpio_analog_read` for the pins
+ *           which have an ADC channel.
+ *
+ * returns - The 12bit conversion result or -1 if the pin has no ADC channel.
+ */
+int analogRead(int pin);
+
 #define wiringPiSetupGpio() \
   assert(!"wiringPiSetupGpio is not supported")
 
@@ -88,9 +125,6 @@ void delayMicroseconds(uint64_t us);
 #define pwmWrite(pin, value) \
   assert(!"pwmWrite is not supported")
 
-#define analogRead(pin) \
-  assert(!"analogRead is not supported")
-
 #define analogWrite(pin, value) \
   assert(!"analogWrite is not supported")
 
@@ -0,0 +1,82 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Setup access to an I2C device on the hardware I2C bus.
+ *
+ * arg devId - the 7bit I2C address of the device.
+ *
+ * returns - a handle for the device or -1 on failure.
+ *
+ * pins    - sda : gp2
+ *           scl : gp3
+ */
+int wiringPiI2CSetup(int devId);
+
+/**
+ * Read a byte from an I2C device without selecting a register.
+ *
+ * arg fd - the handle returned by `wiringPiI2CSetup`.
+ *
+ * returns - the byte read or -1 on failure.
+ */
+int wiringPiI2CRead(int fd);
+
+/**
+ * Write a byte to an I2C device without selecting a register.
+ *
+ * arg fd   - the handle returned by `wiringPiI2CSetup`.
+ * arg data - the byte to write.
+ *
+ * returns - 0 on success or -1 on failure.
+ */
+int wiringPiI2CWrite(int fd, int data);
+
+/**
+ * Read an 8bit register of an I2C device.
+ *
+ * arg fd  - the handle returned by `wiringPiI2CSetup`.
+ * arg reg - the register to read.
+ *
+ * returns - the register value or -1 on failure.
+ */
+int wiringPiI2CReadReg8(int fd, int reg);
+
+/**
+ * Read a 16bit register of an I2C device, low byte first.
+ *
+ * arg fd  - the handle returned by `wiringPiI2CSetup`.
+ * arg reg - the register to read.
+ *
+ * returns - the register value or -1 on failure.
+ */
+int wiringPiI2CReadReg16(int fd, int reg);
+
+/**
+ * Write an 8bit register of an I2C device.
+ *
+ * arg fd   - the handle returned by `wiringPiI2CSetup`.
+ * arg reg  - the register to write.
+ * arg data - the value to write.
+ *
+ * returns - 0 on success or -1 on failure.
+ */
+int wiringPiI2CWriteReg8(int fd, int reg, int data);
+
+/**
+ * Write a 16bit register of an I2C device, low byte first.
+ *
+ * arg fd   - the handle returned by `wiringPiI2CSetup`.
+ * arg reg  - the register to write.
+ * arg data - the value to write.
+ *
+ * returns - 0 on success or -1 on failure.
+ */
+int wiringPiI2CWriteReg16(int fd, int reg, int data);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
@@ -1,16 +1,52 @@
 #pragma once
 
-#include <assert.h>
-
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define wiringPiSPISetup(channel, speed) \
-  assert(!"wiringPiSPISetup not supported")
+/**
+ * Setup a hardware SPI channel.
+ *
+ * arg channel - 0 to use CE0 (GP8) or 1 to use CE1 (GP7) as chip select.
+ * arg speed   - the SPI clock frequency in Hz.
+ *
+ * returns - a handle for the channel or -1 on failure.
+ */
+int wiringPiSPISetup(int channel, int speed);
+
+/**
+ * Setup a hardware SPI channel with a specific SPI mode.
+ *
+ * arg channel - 0 to use CE0 (GP8) or 1 to use CE1 (GP7) as chip select.
+ * arg speed   - the SPI clock frequency in Hz.
+ * arg mode    - the SPI clock polarity and phase mode, 0 to 3.
+ *
+ * returns - a handle for the channel or -1 on failure.
+ */
+int wiringPiSPISetupMode(int channel, int speed, int mode);
+
+/**
+ * Return the handle of a hardware SPI channel.
+ *
+ * arg channel - the SPI channel, 0 or 1.
+ *
+ * returns - the handle given by `wiringPiSPISetup` or -1 if not setup.
+ */
+int wiringPiSPIGetFd(int channel);
 
-#define wiringPiSPIDataRW(channel, data, len) \
-  assert(!"wiringPiSPIDataRW not supported")
+/**
+ * Perform a full duplex transfer on a hardware SPI channel.
+ *
+ * arg channel - the SPI channel, 0 or 1.
+ * arg data    - the data to send, overwritten with the data received.
+ * arg len     - the number of bytes to transfer.
+ *
+ * returns - the number of bytes transfered or -1 on failure.
+ *
+ * note: the buffer is sent as a single transaction with chip select driven
+ *       by the board.
+ */
+int wiringPiSPIDataRW(int channel, unsigned char *data, int len);
 
 #ifdef __cplusplus
 }  // extern "C"
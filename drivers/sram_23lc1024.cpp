@@ -0,0 +1,176 @@
+#include <cstdint>
+#include <cstring>
+
+#include "gpio.h"
+#include "sram_23lc1024.h"
+
+enum {
+  CMD_READ        = 0x03,
+  CMD_WRITE       = 0x02,
+  CMD_RDMR        = 0x05,
+  CMD_WRMR        = 0x01,
+  MODE_BYTE       = 0x00,
+  MODE_PAGE       = 0x80,
+  MODE_SEQUENTIAL = 0x40,  // default
+};
+
+// accesses of at least this many bytes bypass the cache
+#define BURST_MIN (sram_page_size * 4)
+
+// send a command and 24bit address leaving chip select asserted
+static void sram_command(const sram_t *sram, uint8_t cmd, uint32_t addr) {
+  const uint8_t out[4] = {
+    cmd,
+    uint8_t(addr >> 16),
+    uint8_t(addr >>  8),
+    uint8_t(addr >>  0),
+  };
+  spi_hw_transfer(out, nullptr, sizeof(out), sram->cs, /*hold_cs=*/true);
+}
+
+// sequential mode read burst
+static void burst_read(const sram_t *sram, uint32_t addr, uint8_t *dst, uint32_t size) {
+  sram_command(sram, CMD_READ, addr);
+  spi_hw_transfer(nullptr, dst, size, sram->cs);
+}
+
+// sequential mode write burst
+static void burst_write(const sram_t *sram, uint32_t addr, const uint8_t *src, uint32_t size) {
+  sram_command(sram, CMD_WRITE, addr);
+  spi_hw_transfer(src, nullptr, size, sram->cs);
+}
+
+static sram_page_t &page_slot(sram_t *sram, uint32_t page_addr) {
+  return sram->page[(page_addr / sram_page_size) % sram_cache_pages];
+}
+
+static void page_write_back(sram_t *sram, sram_page_t &page) {
+  if (page.valid && page.dirty) {
+    burst_write(sram, page.addr, page.data, sram_page_size);
+    page.dirty = false;
+  }
+}
+
+// find the cache page for an address, evicting and optionally filling it
+static sram_page_t &page_get(sram_t *sram, uint32_t addr, bool fill) {
+  const uint32_t page_addr = addr - (addr % sram_page_size);
+  sram_page_t &page = page_slot(sram, page_addr);
+  if (page.valid && page.addr == page_addr) {
+    return page;
+  }
+  page_write_back(sram, page);
+  page.addr  = page_addr;
+  page.valid = true;
+  page.dirty = false;
+  if (fill) {
+    burst_read(sram, page_addr, page.data, sram_page_size);
+  }
+  return page;
+}
+
+// the cached page holding `page_addr`, if any
+static sram_page_t *page_find(sram_t *sram, uint32_t page_addr) {
+  sram_page_t &page = page_slot(sram, page_addr);
+  return (page.valid && page.addr == page_addr) ? &page : nullptr;
+}
+
+extern "C" {
+
+void sram_init(sram_t *sram, int cs) {
+  memset(sram, 0, sizeof(sram_t));
+  sram->cs = cs;
+
+  gpio_output(cs);
+  gpio_write(cs, 1);
+
+  const uint8_t out[2] = { CMD_WRMR, MODE_SEQUENTIAL };
+  spi_hw_transfer(out, nullptr, sizeof(out), cs);
+}
+
+void sram_read_block(sram_t *sram, uint32_t addr, void *dst, uint32_t size) {
+  uint8_t *out = (uint8_t*)dst;
+
+  if (size >= BURST_MIN) {
+    burst_read(sram, addr, out, size);
+    // cached dirty pages hold newer data than the chip
+    const uint32_t first = addr - (addr % sram_page_size);
+    for (uint32_t p = first; p < addr + size; p += sram_page_size) {
+      const sram_page_t *page = page_find(sram, p);
+      if (!page || !page->dirty) {
+        continue;
+      }
+      const uint32_t lo = p > addr ? p : addr;
+      const uint32_t hi = (p + sram_page_size) < (addr + size) ? (p + sram_page_size) : (addr + size);
+      memcpy(out + (lo - addr), page->data + (lo - p), hi - lo);
+    }
+    return;
+  }
+
+  while (size) {
+    const uint32_t offs = addr % sram_page_size;
+    const uint32_t len  = (sram_page_size - offs) < size ? (sram_page_size - offs) : size;
+    const sram_page_t &page = page_get(sram, addr, /*fill=*/true);
+    memcpy(out, page.data + offs, len);
+    out  += len;
+    addr += len;
+    size -= len;
+  }
+}
+
+void sram_write_block(sram_t *sram, uint32_t addr, const void *src, uint32_t size) {
+  const uint8_t *in = (const uint8_t*)src;
+
+  if (size >= BURST_MIN) {
+    burst_write(sram, addr, in, size);
+    // keep any cached copies in step, their other dirty bytes still need
+    // writing back later
+    const uint32_t first = addr - (addr % sram_page_size);
+    for (uint32_t p = first; p < addr + size; p += sram_page_size) {
+      sram_page_t *page = page_find(sram, p);
+      if (!page) {
+        continue;
+      }
+      const uint32_t lo = p > addr ? p : addr;
+      const uint32_t hi = (p + sram_page_size) < (addr + size) ? (p + sram_page_size) : (addr + size);
+      memcpy(page->data + (lo - p), in + (lo - addr), hi - lo);
+    }
+    return;
+  }
+
+  while (size) {
+    const uint32_t offs = addr % sram_page_size;
+    const uint32_t len  = (sram_page_size - offs) < size ? (sram_page_size - offs) : size;
+    // a write covering the whole page need not read it first
+    sram_page_t &page = page_get(sram, addr, /*fill=*/len != sram_page_size);
+    memcpy(page.data + offs, in, len);
+    page.dirty = true;
+    in   += len;
+    addr += len;
+    size -= len;
+  }
+}
+
+uint8_t sram_read(sram_t *sram, uint32_t addr) {
+  uint8_t data = 0;
+  sram_read_block(sram, addr, &data, 1);
+  return data;
+}
+
+void sram_write(sram_t *sram, uint32_t addr, uint8_t data) {
+  sram_write_block(sram, addr, &data, 1);
+}
+
+void sram_flush(sram_t *sram) {
+  for (int i = 0; i < sram_cache_pages; ++i) {
+    page_write_back(sram, sram->page[i]);
+  }
+}
+
+void sram_invalidate(sram_t *sram) {
+  for (int i = 0; i < sram_cache_pages; ++i) {
+    sram->page[i].valid = false;
+    sram->page[i].dirty = false;
+  }
+}
+
+}  // extern "C"
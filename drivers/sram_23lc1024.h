@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+  sram_size        = 0x20000,  // bytes of storage in a 23LC1024
+  sram_page_size   = 32,       // bytes per cache page
+  sram_cache_pages = 64,       // pages held in the host side cache
+};
+
+/**
+ * A page of SRAM held in the host side cache.
+ */
+typedef struct sram_page_t {
+  uint32_t addr;   // address of the first byte of the page
+  bool     valid;  // page holds data read from or destined for the chip
+  bool     dirty;  // page has been written since it was last sent
+  uint8_t  data[sram_page_size];
+} sram_page_t;
+
+/**
+ * 23LC1024 SPI SRAM state.
+ *
+ * The cache is direct mapped and write back, small accesses are served from
+ * the cache and dirty pages are only sent to the chip when evicted or when
+ * `sram_flush` is called.  Large accesses bypass the cache and are sent as a
+ * single sequential mode burst.
+ */
+typedef struct sram_t {
+  int         cs;  // chip select pin
+  sram_page_t page[sram_cache_pages];
+} sram_t;
+
+/**
+ * Initalize a 23LC1024 attached to the hardware SPI interface.
+ *
+ * arg sram - the SRAM state to initalize.
+ * arg cs   - the GPIO pin connected to the SRAM chip select.
+ *
+ * note: the chip is switched to sequential mode so bursts may cross pages.
+ */
+void sram_init(sram_t *sram, int cs);
+
+/**
+ * Read a block of data from the SRAM.
+ *
+ * arg sram - the SRAM to read from.
+ * arg addr - the address to start reading from.
+ * arg dst  - destination buffer for the data read.
+ * arg size - the number of bytes to read.
+ */
+void sram_read_block(sram_t *sram, uint32_t addr, void *dst, uint32_t size);
+
+/**
+ * Write a block of data to the SRAM.
+ *
+ * arg sram - the SRAM to write to.
+ * arg addr - the address to start writing to.
+ * arg src  - the data to write.
+ * arg size - the number of bytes to write.
+ *
+ * note: small writes may be held in the cache until `sram_flush` is called.
+ */
+void sram_write_block(sram_t *sram, uint32_t addr, const void *src, uint32_t size);
+
+/**
+ * Read a single byte from the SRAM.
+ *
+ * arg sram - the SRAM to read from.
+ * arg addr - the address of the byte to read.
+ *
+ * returns - the byte read.
+ */
+uint8_t sram_read(sram_t *sram, uint32_t addr);
+
+/**
+ * Write a single byte to the SRAM.
+ *
+ * arg sram - the SRAM to write to.
+ * arg addr - the address of the byte to write.
+ * arg data - the byte to write.
+ */
+void sram_write(sram_t *sram, uint32_t addr, uint8_t data);
+
+/**
+ * Send all dirty cache pages to the SRAM.
+ *
+ * arg sram - the SRAM to flush.
+ */
+void sram_flush(sram_t *sram);
+
+/**
+ * Discard the cache contents without writing them back.
+ *
+ * arg sram - the SRAM whose cache will be discarded.
+ */
+void sram_invalidate(sram_t *sram);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
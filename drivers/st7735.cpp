@@ -0,0 +1,378 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "gpio.h"
+#include "st7735.h"
+
+enum {
+  ST7735_COLS = 132,
+  ST7735_ROWS = 162,
+};
+
+enum {
+  ST7735_NOP     = 0x00,
+  ST7735_SWRESET = 0x01,
+  ST7735_RDDID   = 0x04,
+  ST7735_RDDST   = 0x09,
+  ST7735_SLPIN   = 0x10,
+  ST7735_SLPOUT  = 0x11,
+  ST7735_PTLON   = 0x12,
+  ST7735_NORON   = 0x13,
+  ST7735_INVOFF  = 0x20,
+  ST7735_INVON   = 0x21,
+  ST7735_DISPOFF = 0x28,
+  ST7735_DISPON  = 0x29,
+  ST7735_CASET   = 0x2A,
+  ST7735_RASET   = 0x2B,
+  ST7735_RAMWR   = 0x2C,
+  ST7735_RAMRD   = 0x2E,
+  ST7735_PTLAR   = 0x30,
+  ST7735_MADCTL  = 0x36,
+  ST7735_COLMOD  = 0x3A,
+  ST7735_FRMCTR1 = 0xB1,
+  ST7735_FRMCTR2 = 0xB2,
+  ST7735_FRMCTR3 = 0xB3,
+  ST7735_INVCTR  = 0xB4,
+  ST7735_DISSET5 = 0xB6,
+  ST7735_PWCTR1  = 0xC0,
+  ST7735_PWCTR2  = 0xC1,
+  ST7735_PWCTR3  = 0xC2,
+  ST7735_PWCTR4  = 0xC3,
+  ST7735_PWCTR5  = 0xC4,
+  ST7735_VMCTR1  = 0xC5,
+  ST7735_RDID1   = 0xDA,
+  ST7735_RDID2   = 0xDB,
+  ST7735_RDID3   = 0xDC,
+  ST7735_RDID4   = 0xDD,
+  ST7735_GMCTRP1 = 0xE0,
+  ST7735_GMCTRN1 = 0xE1,
+  ST7735_PWCTR6  = 0xFC,
+};
+
+// send a command followed by its parameters
+static void st7735_send(st7735_t *lcd, uint8_t cmd, const uint8_t *data, uint32_t size) {
+  st7735_cmd(lcd, cmd);
+  if (size) {
+    st7735_data(lcd, data, size);
+  }
+}
+
+// clip a rectangle to the display, returns false if nothing remains
+static bool clip(const st7735_t *lcd, int &x0, int &y0, int &x1, int &y1) {
+  if (x0 < 0)            x0 = 0;
+  if (y0 < 0)            y0 = 0;
+  if (x1 >= lcd->width)  x1 = lcd->width  - 1;
+  if (y1 >= lcd->height) y1 = lcd->height - 1;
+  return x0 <= x1 && y0 <= y1;
+}
+
+static int area(const st7735_rect_t &r) {
+  return (r.x1 - r.x0 + 1) * (r.y1 - r.y0 + 1);
+}
+
+static st7735_rect_t merge(const st7735_rect_t &a, const st7735_rect_t &b) {
+  st7735_rect_t r;
+  r.x0 = a.x0 < b.x0 ? a.x0 : b.x0;
+  r.y0 = a.y0 < b.y0 ? a.y0 : b.y0;
+  r.x1 = a.x1 > b.x1 ? a.x1 : b.x1;
+  r.y1 = a.y1 > b.y1 ? a.y1 : b.y1;
+  return r;
+}
+
+// check if two rectangles overlap or share an edge
+static bool touches(const st7735_rect_t &a, const st7735_rect_t &b) {
+  return a.x0 <= b.x1 + 1 && b.x0 <= a.x1 + 1 &&
+         a.y0 <= b.y1 + 1 && b.y0 <= a.y1 + 1;
+}
+
+static void remove_dirty(st7735_t *lcd, int i) {
+  lcd->dirty[i] = lcd->dirty[--lcd->num_dirty];
+}
+
+// count the runs of identical pixels an RLE transfer of a region would need,
+// returning 1 for a region of a single colour regardless of its size
+static int count_runs(const st7735_t *lcd, const st7735_rect_t &r) {
+  const uint16_t first = lcd->fb[r.y0 * lcd->width + r.x0];
+  bool flat   = true;
+  int  runs   = 0;
+  int  length = 0;
+  uint16_t colour = 0;
+  for (int y = r.y0; y <= r.y1; ++y) {
+    const uint16_t *row = lcd->fb + y * lcd->width;
+    for (int x = r.x0; x <= r.x1; ++x) {
+      flat = flat && (row[x] == first);
+      if (length && row[x] == colour && length < 256) {
+        ++length;
+        continue;
+      }
+      colour = row[x];
+      length = 1;
+      ++runs;
+    }
+  }
+  return flat ? 1 : runs;
+}
+
+// set the display address window and start a RAM write
+static void st7735_window(st7735_t *lcd, const st7735_rect_t &r) {
+  const int x0 = r.x0 + lcd->xoffs;
+  const int x1 = r.x1 + lcd->xoffs;
+  const int y0 = r.y0 + lcd->yoffs;
+  const int y1 = r.y1 + lcd->yoffs;
+
+  const uint8_t caset[] = {
+    uint8_t(x0 >> 8), uint8_t(x0 & 0xff),  // XSTART
+    uint8_t(x1 >> 8), uint8_t(x1 & 0xff),  // XEND
+  };
+  st7735_send(lcd, ST7735_CASET, caset, sizeof(caset));
+
+  const uint8_t raset[] = {
+    uint8_t(y0 >> 8), uint8_t(y0 & 0xff),  // YSTART
+    uint8_t(y1 >> 8), uint8_t(y1 & 0xff),  // YEND
+  };
+  st7735_send(lcd, ST7735_RASET, raset, sizeof(raset));
+
+  st7735_cmd(lcd, ST7735_RAMWR);
+}
+
+extern "C" {
+
+void st7735_cmd(st7735_t *lcd, uint8_t cmd) {
+  gpio_write(lcd->dc, 0);
+  spi_hw_transfer(&cmd, nullptr, 1, lcd->cs);
+}
+
+void st7735_data(st7735_t *lcd, const uint8_t *data, uint32_t size) {
+  gpio_write(lcd->dc, 1);
+  spi_hw_transfer(data, nullptr, size, lcd->cs);
+}
+
+bool st7735_init(st7735_t *lcd, int cs, int dc, int bl, int width, int height) {
+
+  memset(lcd, 0, sizeof(st7735_t));
+  lcd->cs     = cs;
+  lcd->dc     = dc;
+  lcd->bl     = bl;
+  lcd->width  = width;
+  lcd->height = height;
+  lcd->xoffs  = (ST7735_COLS - width)  / 2;
+  lcd->yoffs  = (ST7735_ROWS - height) / 2;
+
+  lcd->fb      = (uint16_t*)calloc(width * height, sizeof(uint16_t));
+  lcd->scratch = (uint8_t*) malloc(width * height * 2);
+  if (!lcd->fb || !lcd->scratch) {
+    st7735_free(lcd);
+    return false;
+  }
+
+  if (bl >= 0) {
+    gpio_output(bl);
+    gpio_write(bl, 1);
+  }
+
+  gpio_output(cs);
+  gpio_write(cs, 1);
+  gpio_output(dc);
+
+  st7735_cmd(lcd, ST7735_SWRESET);  // Software reset
+  gpio_delay(150);                  // gpio_delay 150 ms
+
+  st7735_cmd(lcd, ST7735_SLPOUT);   // Out of sleep mode
+  gpio_delay(500);                  // gpio_delay 500 ms
+
+  // Frame rate ctrl - normal mode
+  // Rate = fosc / (1x2 + 40) * (LINE + 2C + 2D)
+  static const uint8_t frmctr1[] = { 0x01, 0x2C, 0x2D };
+  st7735_send(lcd, ST7735_FRMCTR1, frmctr1, sizeof(frmctr1));
+
+  // Frame rate ctrl - idle mode
+  // Rate = fosc / (1x2 + 40) * (LINE + 2C + 2D)
+  static const uint8_t frmctr2[] = { 0x01, 0x2C, 0x2D };
+  st7735_send(lcd, ST7735_FRMCTR2, frmctr2, sizeof(frmctr2));
+
+  // Frame rate ctrl - partial mode
+  // Dot inversion mode, Line inversion mode
+  static const uint8_t frmctr3[] = { 0x01, 0x2C, 0x2D, 0x01, 0x2C, 0x2D };
+  st7735_send(lcd, ST7735_FRMCTR3, frmctr3, sizeof(frmctr3));
+
+  // Display inversion ctrl - No inversion
+  static const uint8_t invctr[] = { 0x07 };
+  st7735_send(lcd, ST7735_INVCTR, invctr, sizeof(invctr));
+
+  // Power control - 4.6V, auto mode
+  static const uint8_t pwctr1[] = { 0xA2, 0x02, 0x84 };
+  st7735_send(lcd, ST7735_PWCTR1, pwctr1, sizeof(pwctr1));
+
+  // Power control - Opamp current small, Boost frequency
+  static const uint8_t pwctr2[] = { 0x0A, 0x00 };
+  st7735_send(lcd, ST7735_PWCTR2, pwctr2, sizeof(pwctr2));
+
+  // Power control - BCLK / 2, Opamp current small & Medium low
+  static const uint8_t pwctr4[] = { 0x8A, 0x2A };
+  st7735_send(lcd, ST7735_PWCTR4, pwctr4, sizeof(pwctr4));
+
+  // Power control
+  static const uint8_t pwctr5[] = { 0x8A, 0xEE };
+  st7735_send(lcd, ST7735_PWCTR5, pwctr5, sizeof(pwctr5));
+
+  // Power control
+  static const uint8_t vmctr1[] = { 0x0E };
+  st7735_send(lcd, ST7735_VMCTR1, vmctr1, sizeof(vmctr1));
+
+  st7735_cmd(lcd, ST7735_INVON);    // Invert display
+
+  // Memory access control(directions)
+  // row addr / col addr, bottom to top refresh
+  static const uint8_t madctl[] = { 0xC8 };
+  st7735_send(lcd, ST7735_MADCTL, madctl, sizeof(madctl));
+
+  // set color mode - 16 - bit color
+  static const uint8_t colmod[] = { 0x05 };
+  st7735_send(lcd, ST7735_COLMOD, colmod, sizeof(colmod));
+
+  // Set Gamma
+  static const uint8_t gmctrp1[] = {
+    0x02, 0x1c, 0x07, 0x12, 0x37, 0x32, 0x29, 0x2d,
+    0x29, 0x25, 0x2B, 0x39, 0x00, 0x01, 0x03, 0x10,
+  };
+  st7735_send(lcd, ST7735_GMCTRP1, gmctrp1, sizeof(gmctrp1));
+
+  // Set Gamma
+  static const uint8_t gmctrn1[] = {
+    0x03, 0x1d, 0x07, 0x06, 0x2E, 0x2C, 0x29, 0x2D,
+    0x2E, 0x2E, 0x37, 0x3F, 0x00, 0x00, 0x02, 0x10,
+  };
+  st7735_send(lcd, ST7735_GMCTRN1, gmctrn1, sizeof(gmctrn1));
+
+  st7735_cmd(lcd, ST7735_NORON);    // Normal display on
+  gpio_delay(10);                   // 10 ms
+
+  st7735_cmd(lcd, ST7735_DISPON);   // Display on
+  gpio_delay(100);                  // 100 ms
+
+  // display ram contents are unknown so send everything on the first flush
+  st7735_mark_dirty(lcd, 0, 0, width - 1, height - 1);
+  return true;
+}
+
+void st7735_free(st7735_t *lcd) {
+  free(lcd->fb);
+  free(lcd->scratch);
+  lcd->fb        = nullptr;
+  lcd->scratch   = nullptr;
+  lcd->num_dirty = 0;
+}
+
+void st7735_mark_dirty(st7735_t *lcd, int x0, int y0, int x1, int y1) {
+  if (!clip(lcd, x0, y0, x1, y1)) {
+    return;
+  }
+  st7735_rect_t r = { int16_t(x0), int16_t(y0), int16_t(x1), int16_t(y1) };
+
+  // absorb any rectangles this one overlaps or borders, repeating since the
+  // grown rectangle may now reach others
+  for (int i = 0; i < lcd->num_dirty;) {
+    if (touches(r, lcd->dirty[i])) {
+      r = merge(r, lcd->dirty[i]);
+      remove_dirty(lcd, i);
+      i = 0;
+      continue;
+    }
+    ++i;
+  }
+
+  // when out of slots merge with the rectangle that grows the least
+  if (lcd->num_dirty == st7735_max_dirty) {
+    int best = 0;
+    int best_cost = 0;
+    for (int i = 0; i < lcd->num_dirty; ++i) {
+      const st7735_rect_t &d = lcd->dirty[i];
+      const int cost = area(merge(r, d)) - area(d) - area(r);
+      if (i == 0 || cost < best_cost) {
+        best      = i;
+        best_cost = cost;
+      }
+    }
+    r = merge(r, lcd->dirty[best]);
+    remove_dirty(lcd, best);
+  }
+
+  lcd->dirty[lcd->num_dirty++] = r;
+}
+
+void st7735_pixel(st7735_t *lcd, int x, int y, uint16_t colour) {
+  if (x < 0 || y < 0 || x >= lcd->width || y >= lcd->height) {
+    return;
+  }
+  uint16_t &dst = lcd->fb[y * lcd->width + x];
+  if (dst != colour) {
+    dst = colour;
+    st7735_mark_dirty(lcd, x, y, x, y);
+  }
+}
+
+void st7735_fill_rect(st7735_t *lcd, int x0, int y0, int x1, int y1, uint16_t colour) {
+  if (!clip(lcd, x0, y0, x1, y1)) {
+    return;
+  }
+  for (int y = y0; y <= y1; ++y) {
+    uint16_t *row = lcd->fb + y * lcd->width;
+    for (int x = x0; x <= x1; ++x) {
+      row[x] = colour;
+    }
+  }
+  st7735_mark_dirty(lcd, x0, y0, x1, y1);
+}
+
+void st7735_blit(st7735_t *lcd, int x, int y, int w, int h, const uint16_t *src) {
+  int x0 = x, y0 = y, x1 = x + w - 1, y1 = y + h - 1;
+  if (!clip(lcd, x0, y0, x1, y1)) {
+    return;
+  }
+  for (int j = y0; j <= y1; ++j) {
+    const uint16_t *in  = src + (j - y) * w + (x0 - x);
+    uint16_t       *out = lcd->fb + j * lcd->width + x0;
+    memcpy(out, in, (x1 - x0 + 1) * sizeof(uint16_t));
+  }
+  st7735_mark_dirty(lcd, x0, y0, x1, y1);
+}
+
+void st7735_flush(st7735_t *lcd) {
+  for (int i = 0; i < lcd->num_dirty; ++i) {
+    const st7735_rect_t &r = lcd->dirty[i];
+
+    const int x0 = r.x0 + lcd->xoffs;
+    const int x1 = r.x1 + lcd->xoffs;
+    const int y0 = r.y0 + lcd->yoffs;
+    const int y1 = r.y1 + lcd->yoffs;
+    const uint16_t *src = lcd->fb + r.y0 * lcd->width + r.x0;
+
+    // let the board generate flat or highly repetitive regions itself
+    const int runs = count_runs(lcd, r);
+    if (runs == 1) {
+      spi_lcd_fill(lcd->cs, lcd->dc, x0, y0, x1, y1, *src);
+      continue;
+    }
+    if (runs * 3 < area(r) * 2) {
+      spi_lcd_blit_rle(lcd->cs, lcd->dc, x0, y0, x1, y1, src, lcd->width);
+      continue;
+    }
+
+    // pack the region big endian as the display expects
+    uint8_t *out = lcd->scratch;
+    for (int y = r.y0; y <= r.y1; ++y) {
+      const uint16_t *row = lcd->fb + y * lcd->width;
+      for (int x = r.x0; x <= r.x1; ++x) {
+        *out++ = uint8_t(row[x] >> 8);
+        *out++ = uint8_t(row[x]);
+      }
+    }
+
+    st7735_window(lcd, r);
+    st7735_data(lcd, lcd->scratch, uint32_t(out - lcd->scratch));
+  }
+  lcd->num_dirty = 0;
+}
+
+}  // extern "C"
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+  st7735_width     = 80,   // visible columns of the 0.96" 160x80 panel
+  st7735_height    = 160,  // visible rows of the 0.96" 160x80 panel
+  st7735_max_dirty = 8,    // dirty rectangles tracked before merging
+};
+
+/**
+ * An inclusive rectangle of pixels.
+ */
+typedef struct st7735_rect_t {
+  int16_t x0, y0;
+  int16_t x1, y1;
+} st7735_rect_t;
+
+/**
+ * ST7735 display state.
+ *
+ * The framebuffer holds RGB565 pixels in row major order and is only sent to
+ * the display by `st7735_flush`.  Any region written since the last flush is
+ * tracked as a dirty rectangle so only changed pixels are transfered.
+ */
+typedef struct st7735_t {
+  int            cs;         // chip select pin
+  int            dc;         // data/command pin
+  int            bl;         // backlight pin (optional)
+  int            width;      // visible width in pixels
+  int            height;     // visible height in pixels
+  int            xoffs;      // column offset of the visible area in display ram
+  int            yoffs;      // row offset of the visible area in display ram
+  uint16_t      *fb;         // RGB565 framebuffer
+  uint8_t       *scratch;    // staging buffer for pixel transfers
+  int            num_dirty;
+  st7735_rect_t  dirty[st7735_max_dirty];
+} st7735_t;
+
+/**
+ * Initalize an ST7735 display attached to the hardware SPI interface.
+ *
+ * arg lcd    - the display state to initalize.
+ * arg cs     - the GPIO pin connected to the display chip select.
+ * arg dc     - the GPIO pin connected to the display data/command select.
+ * arg bl     - the GPIO pin connected to the backlight (optional).
+ * arg width  - the visible width of the display in pixels.
+ * arg height - the visible height of the display in pixels.
+ *
+ * returns - true if the framebuffer was allocated and the display setup.
+ *
+ * note: the whole framebuffer is marked dirty so the first flush will clear
+ *       the display.
+ */
+bool st7735_init(st7735_t *lcd, int cs, int dc, int bl=-1,
+                 int width=st7735_width, int height=st7735_height);
+
+/**
+ * Release the framebuffer of an ST7735 display.
+ *
+ * arg lcd - the display to release.
+ */
+void st7735_free(st7735_t *lcd);
+
+/**
+ * Send a command byte to the display.
+ *
+ * arg lcd - the display to send the command to.
+ * arg cmd - the command byte.
+ */
+void st7735_cmd(st7735_t *lcd, uint8_t cmd);
+
+/**
+ * Send command parameter or pixel data to the display.
+ *
+ * arg lcd  - the display to send data to.
+ * arg data - the data to send.
+ * arg size - the number of bytes to send.
+ */
+void st7735_data(st7735_t *lcd, const uint8_t *data, uint32_t size);
+
+/**
+ * Set a single pixel in the framebuffer.
+ *
+ * arg lcd    - the display to draw to.
+ * arg x, y   - the pixel position.
+ * arg colour - the RGB565 colour to set.
+ */
+void st7735_pixel(st7735_t *lcd, int x, int y, uint16_t colour);
+
+/**
+ * Fill a rectangle of the framebuffer with a single colour.
+ *
+ * arg lcd    - the display to draw to.
+ * arg x0, y0 - the top left corner of the rectangle (inclusive).
+ * arg x1, y1 - the bottom right corner of the rectangle (inclusive).
+ * arg colour - the RGB565 colour to fill with.
+ */
+void st7735_fill_rect(st7735_t *lcd, int x0, int y0, int x1, int y1, uint16_t colour);
+
+/**
+ * Copy a block of RGB565 pixels into the framebuffer.
+ *
+ * arg lcd  - the display to draw to.
+ * arg x, y - the top left position to copy to.
+ * arg w, h - the size of the source image.
+ * arg src  - the source pixels in row major order.
+ */
+void st7735_blit(st7735_t *lcd, int x, int y, int w, int h, const uint16_t *src);
+
+/**
+ * Mark a region of the framebuffer as changed.
+ *
+ * arg lcd    - the display the region belongs to.
+ * arg x0, y0 - the top left corner of the region (inclusive).
+ * arg x1, y1 - the bottom right corner of the region (inclusive).
+ *
+ * note: this only needs to be called after writing to `lcd->fb` directly.
+ */
+void st7735_mark_dirty(st7735_t *lcd, int x0, int y0, int x1, int y1);
+
+/**
+ * Send all dirty regions of the framebuffer to the display.
+ *
+ * arg lcd - the display to update.
+ *
+ * note: each dirty rectangle is sent as one address window followed by a
+ *       single bulk RAMWR transfer.  regions of a single colour are filled
+ *       by the board and regions that compress well are sent RLE encoded.
+ */
+void st7735_flush(st7735_t *lcd);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
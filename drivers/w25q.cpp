@@ -0,0 +1,194 @@
+#include <cstdint>
+#include <cstring>
+
+#include "gpio.h"
+#include "w25q.h"
+
+enum {
+  CMD_WRITE_ENABLE  = 0x06,
+  CMD_READ_STATUS1  = 0x05,
+  CMD_READ_DATA     = 0x03,
+  CMD_PAGE_PROGRAM  = 0x02,
+  CMD_SECTOR_ERASE  = 0x20,
+  CMD_BLOCK_ERASE   = 0xD8,
+  CMD_CHIP_ERASE    = 0xC7,
+  CMD_RELEASE_PD    = 0xAB,
+  CMD_JEDEC_ID      = 0x9F,
+  STATUS_BUSY       = 0x01,
+};
+
+// worst case busy times from the W25Q128JV datasheet, in microseconds
+#define PAGE_PROGRAM_US  3000
+#define SECTOR_ERASE_US  400000
+#define BLOCK_ERASE_US   2000000
+#define CHIP_ERASE_US    200000000
+
+// status waits left outstanding before the oldest result is collected
+#define PIPELINE_DEPTH 4
+
+// send a command and 24bit address, optionally leaving chip select asserted
+static void w25q_command(const w25q_t *flash, uint8_t cmd, uint32_t addr, bool hold_cs) {
+  const uint8_t out[4] = {
+    cmd,
+    uint8_t(addr >> 16),
+    uint8_t(addr >>  8),
+    uint8_t(addr >>  0),
+  };
+  spi_hw_transfer(out, nullptr, sizeof(out), flash->cs, hold_cs);
+}
+
+static void w25q_write_enable(const w25q_t *flash) {
+  const uint8_t cmd = CMD_WRITE_ENABLE;
+  spi_hw_transfer(&cmd, nullptr, 1, flash->cs);
+}
+
+// collect the oldest queued wait result
+static void w25q_collect(w25q_t *flash) {
+  if (flash->queued) {
+    --flash->queued;
+    if (spi_wait_status_result() < 0) {
+      flash->failed = true;
+    }
+  }
+}
+
+// queue a wait for the last program ahead of anything sent next
+static void w25q_queue_ready(w25q_t *flash) {
+  if (!flash->busy) {
+    return;
+  }
+  if (flash->queued >= PIPELINE_DEPTH) {
+    w25q_collect(flash);
+  }
+  if (spi_wait_status_queue(CMD_READ_STATUS1, STATUS_BUSY, 0, PAGE_PROGRAM_US, flash->cs)) {
+    ++flash->queued;
+  }
+  else {
+    flash->failed = true;
+  }
+  flash->busy = false;
+}
+
+// erase with a single command and wait for it to finish
+static bool w25q_erase_op(w25q_t *flash, uint8_t cmd, uint32_t addr, uint32_t timeout_us) {
+  w25q_write_enable(flash);
+  if (cmd == CMD_CHIP_ERASE) {
+    spi_hw_transfer(&cmd, nullptr, 1, flash->cs);
+  }
+  else {
+    w25q_command(flash, cmd, addr, /*hold_cs=*/false);
+  }
+  return spi_wait_status(CMD_READ_STATUS1, STATUS_BUSY, 0, timeout_us, flash->cs) >= 0;
+}
+
+extern "C" {
+
+bool w25q_init(w25q_t *flash, int cs) {
+  memset(flash, 0, sizeof(w25q_t));
+  flash->cs = cs;
+
+  gpio_output(cs);
+  gpio_write(cs, 1);
+
+  // wake the chip in case it was powered down
+  const uint8_t wake = CMD_RELEASE_PD;
+  spi_hw_transfer(&wake, nullptr, 1, cs);
+
+  uint8_t id[4] = { CMD_JEDEC_ID, 0xff, 0xff, 0xff };
+  spi_hw_transfer(id, id, sizeof(id), cs);
+  memcpy(flash->jedec, id + 1, 3);
+
+  // the capacity code is log2 of the size in bytes
+  const uint8_t capacity = flash->jedec[2];
+  if (capacity < 0x10 || capacity > 0x20) {
+    return false;
+  }
+  flash->size = 1u << (capacity > 0x18 ? 0x18 : capacity);
+  return true;
+}
+
+bool w25q_read(w25q_t *flash, uint32_t addr, void *dst, uint32_t size) {
+  // the replies to queued waits must be collected before any read
+  const bool ok = w25q_sync(flash);
+  w25q_command(flash, CMD_READ_DATA, addr, /*hold_cs=*/true);
+  spi_hw_transfer(nullptr, (uint8_t*)dst, size, flash->cs);
+  return ok;
+}
+
+bool w25q_erase(w25q_t *flash, uint32_t addr, uint32_t size) {
+  if (!w25q_sync(flash)) {
+    return false;
+  }
+  uint32_t pos = addr - (addr % w25q_sector_size);
+  const uint32_t end = addr + size;
+  while (pos < end) {
+    const bool block = (pos % w25q_block_size) == 0 && (end - pos) >= w25q_block_size;
+    const bool ok = block ? w25q_erase_op(flash, CMD_BLOCK_ERASE,  pos, BLOCK_ERASE_US)
+                          : w25q_erase_op(flash, CMD_SECTOR_ERASE, pos, SECTOR_ERASE_US);
+    if (!ok) {
+      return false;
+    }
+    pos += block ? w25q_block_size : w25q_sector_size;
+  }
+  return true;
+}
+
+bool w25q_erase_chip(w25q_t *flash) {
+  if (!w25q_sync(flash)) {
+    return false;
+  }
+  return w25q_erase_op(flash, CMD_CHIP_ERASE, 0, CHIP_ERASE_US);
+}
+
+bool w25q_program(w25q_t *flash, uint32_t addr, const void *src, uint32_t size) {
+  const uint8_t *data = (const uint8_t*)src;
+  while (size) {
+    // a page program wraps within its page so split at page boundaries
+    const uint32_t room = w25q_page_size - (addr % w25q_page_size);
+    const uint32_t len  = size < room ? size : room;
+
+    // the board waits for the previous page before starting this one
+    w25q_queue_ready(flash);
+    w25q_write_enable(flash);
+
+    uint8_t out[4 + w25q_page_size] = {
+      CMD_PAGE_PROGRAM,
+      uint8_t(addr >> 16),
+      uint8_t(addr >>  8),
+      uint8_t(addr >>  0),
+    };
+    memcpy(out + 4, data, len);
+    spi_hw_transfer(out, nullptr, 4 + len, flash->cs);
+    flash->busy = true;
+
+    addr += len;
+    data += len;
+    size -= len;
+  }
+  return !flash->failed;
+}
+
+bool w25q_sync(w25q_t *flash) {
+  w25q_queue_ready(flash);
+  while (flash->queued) {
+    w25q_collect(flash);
+  }
+  const bool ok = !flash->failed;
+  flash->failed = false;
+  return ok;
+}
+
+bool w25q_crc32(w25q_t *flash, uint32_t addr, uint32_t size, uint32_t *crc) {
+  if (!w25q_sync(flash)) {
+    return false;
+  }
+  const uint8_t header[4] = {
+    CMD_READ_DATA,
+    uint8_t(addr >> 16),
+    uint8_t(addr >>  8),
+    uint8_t(addr >>  0),
+  };
+  return spi_crc32(header, sizeof(header), size, crc, flash->cs);
+}
+
+}  // extern "C"
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+  w25q_page_size   = 256,    // bytes programmed by a single page program
+  w25q_sector_size = 4096,   // smallest erasable unit
+  w25q_block_size  = 65536,  // largest erasable unit short of the whole chip
+};
+
+/**
+ * W25Q series SPI NOR flash state.
+ *
+ * Page programs are pipelined: the wait for one page to finish is queued on
+ * the board ahead of the next page, so the next page is already streaming
+ * over the serial link while the current one programs.  Their results are
+ * collected a few pages later, or by `w25q_sync`.
+ */
+typedef struct w25q_t {
+  int      cs;        // chip select pin
+  uint8_t  jedec[3];  // manufacturer, memory type and capacity codes
+  uint32_t size;      // bytes of storage
+  bool     busy;      // a program has been sent without a wait after it
+  int      queued;    // status waits whose results have not been collected
+  bool     failed;    // a queued wait timed out
+} w25q_t;
+
+/**
+ * Initalize a W25Q flash attached to the hardware SPI interface.
+ *
+ * arg flash - the flash state to initalize.
+ * arg cs    - the GPIO pin connected to the flash chip select.
+ *
+ * returns - true if a flash answered with a plausible JEDEC id.
+ *
+ * note: the chip is woken from power down and its size is taken from the
+ *       capacity code of its JEDEC id, at most 16MB as 3 byte addresses
+ *       are used.
+ */
+bool w25q_init(w25q_t *flash, int cs);
+
+/**
+ * Read a block of data from the flash.
+ *
+ * arg flash - the flash to read from.
+ * arg addr  - the address to start reading from.
+ * arg dst   - destination buffer for the data read.
+ * arg size  - the number of bytes to read.
+ *
+ * returns - true if outstanding programs completed and the data was read.
+ */
+bool w25q_read(w25q_t *flash, uint32_t addr, void *dst, uint32_t size);
+
+/**
+ * Erase the sectors covering a range of the flash.
+ *
+ * arg flash - the flash to erase.
+ * arg addr  - the start of the range.
+ * arg size  - the number of bytes in the range.
+ *
+ * returns - true if every erase completed.
+ *
+ * note: whole sectors are erased so data either side of an unaligned range
+ *       is lost.  aligned 64KB blocks are erased with a single block erase.
+ */
+bool w25q_erase(w25q_t *flash, uint32_t addr, uint32_t size);
+
+/**
+ * Erase the whole flash.
+ *
+ * arg flash - the flash to erase.
+ *
+ * returns - true if the erase completed, which can take several minutes.
+ */
+bool w25q_erase_chip(w25q_t *flash);
+
+/**
+ * Program erased flash with a block of data.
+ *
+ * arg flash - the flash to program.
+ * arg addr  - the address to start programming at.
+ * arg src   - the data to program.
+ * arg size  - the number of bytes to program.
+ *
+ * returns - false if an earlier page program was found to have timed out.
+ *
+ * note: the data is split into page programs which are pipelined, call
+ *       `w25q_sync` to wait for the last of them.
+ */
+bool w25q_program(w25q_t *flash, uint32_t addr, const void *src, uint32_t size);
+
+/**
+ * Wait for all pipelined page programs to complete.
+ *
+ * arg flash - the flash to wait for.
+ *
+ * returns - true if every program since the last sync completed.
+ */
+bool w25q_sync(w25q_t *flash);
+
+/**
+ * Compute the CRC32 of a range of the flash on the board.
+ *
+ * arg flash - the flash to check.
+ * arg addr  - the start of the range.
+ * arg size  - the number of bytes in the range.
+ * arg crc   - receives the CRC32, comparable with `gpio_crc32`.
+ *
+ * returns - true if the CRC was computed.
+ */
+bool w25q_crc32(w25q_t *flash, uint32_t addr, uint32_t size, uint32_t *crc);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
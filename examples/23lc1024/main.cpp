@@ -2,6 +2,7 @@
 #include <chrono>
 #include <stdio.h>
 #include "gpio.h"
+#include "sram_23lc1024.h"
 
 //        23lc1024
 //
@@ -13,69 +14,14 @@
 //         '-----'  
 //
 
-#define hardware_spi 0
-
 enum {
   pin_cs = 2,
 };
 
 enum {
-  CMD_READ        = 0x03,
-  CMD_WRITE       = 0x02,
-  CMD_RDMR        = 0x05,
-  CMD_WRMR        = 0x01,
-  MODE_BYTE       = 0x00,
-  MODE_PAGE       = 0x80,
-  MODE_SEQUENTIAL = 0x40,  // default
-  MAX_ADDR        = 0x20000
+  BLOCK_SIZE = 1024,
 };
 
-
-static uint8_t spi_send(uint8_t data) {
-  if (hardware_spi) {
-    return spi_hw_send(data);
-  }
-  else {
-    return spi_sw_send(data);
-  }
-}
-
-uint8_t sram_read(uint32_t addr) {
-  gpio_write(pin_cs, gpio_low);
-  spi_send(CMD_READ);
-  spi_send((addr >> 16) & 0xff);
-  spi_send((addr >>  8) & 0xff);
-  spi_send((addr >>  0) & 0xff);
-  const uint8_t data = spi_send(0xff);
-  gpio_write(pin_cs, gpio_high);
-  return data;
-}
-
-void sram_write(uint32_t addr, uint8_t data) {
-  gpio_write(pin_cs, gpio_low);
-  spi_send(CMD_WRITE);
-  spi_send((addr >> 16) & 0xff);
-  spi_send((addr >>  8) & 0xff);
-  spi_send((addr >>  0) & 0xff);
-  spi_send(data);
-  gpio_write(pin_cs, gpio_high);
-}
-
-uint8_t sram_read_mode(void) {
-  gpio_write(pin_cs, gpio_low);
-  spi_send(CMD_RDMR);
-  const uint8_t data = spi_send(0xff);
-  gpio_write(pin_cs, gpio_high);
-  return data;
-}
-
-void sram_write_mode(uint8_t data) {
-  gpio_write(pin_cs, gpio_low);
-  spi_send(CMD_WRMR);
-  spi_send(data);
-  gpio_write(pin_cs, gpio_high);
-}
-
 static uint8_t random(uint32_t &x) {
   x ^= x << 13;
   x ^= x >> 17;
@@ -95,34 +41,42 @@ int main(int argc, char** args) {
   gpio_board_version(version, sizeof(version));
   printf("version: %s\n", version);
 
-  // setup software spi if needed
-  if (!hardware_spi) {
-    spi_sw_init();
-  }
-
-  // pull CS high
-  gpio_output(pin_cs);
-  gpio_write(pin_cs, gpio_high);
-
-  // read the current mode register
-  uint8_t mode = sram_read_mode();
+  static sram_t sram;
+  sram_init(&sram, pin_cs);
 
   uint32_t rng1 = 12345;
   uint32_t rng2 = 12345;
 
-  for (int j = 0; j < MAX_ADDR; j += 1024) {
+  uint8_t block[BLOCK_SIZE];
+
+  // large blocks are sent as single sequential mode bursts
+  for (int j = 0; j < sram_size; j += BLOCK_SIZE) {
 
-    for (int i = 0; i < 1024; ++i) {
-      sram_write(j + i, random(rng1));
-      printf("w %d %02x\n", j+i, (i & 0xff));
+    for (int i = 0; i < BLOCK_SIZE; ++i) {
+      block[i] = random(rng1);
     }
+    sram_write_block(&sram, j, block, BLOCK_SIZE);
+    printf("w %d..%d\n", j, j + BLOCK_SIZE - 1);
 
-    for (int i = 0; i < 1024; ++i) {
-      uint8_t got = sram_read(j + i);
+    sram_read_block(&sram, j, block, BLOCK_SIZE);
+    for (int i = 0; i < BLOCK_SIZE; ++i) {
+      uint8_t got = block[i];
       uint8_t expect = random(rng2);
-      printf("r %d %02x (%02x) %c\n", j+i, got, expect, got == expect ? ' ' : '!');
+      if (got != expect) {
+        printf("r %d %02x (%02x) !\n", j+i, got, expect);
+      }
     }
+  }
 
+  // single byte accesses are served from the page cache
+  for (int i = 0; i < 256; ++i) {
+    sram_write(&sram, i * 3, uint8_t(i));
+  }
+  sram_flush(&sram);
+  sram_invalidate(&sram);
+  for (int i = 0; i < 256; ++i) {
+    uint8_t got = sram_read(&sram, i * 3);
+    printf("r %d %02x (%02x) %c\n", i * 3, got, i, got == i ? ' ' : '!');
   }
 
   return 0;
@@ -8,6 +8,9 @@ enum {
 
 #define USE_HW_SPI 1
 
+// stream ADC samples from a timer on the board rather than polling
+#define USE_ADC_STREAM 1
+
 static uint8_t spi_send(uint8_t data) {
 #if USE_HW_SPI
   return spi_hw_send(data);
@@ -18,19 +21,24 @@ static uint8_t spi_send(uint8_t data) {
 
 static void mcp4802_write(int channel, bool gain_2x, bool shutdown, uint16_t value) {
 
-  gpio_write(PIN_CE_MCP4802, 0);
-
   const uint8_t word0 =
     (channel  == 0     ? 0x00 : 0x80) |
     (gain_2x  == false ? 0x00 : 0x20) |
     (shutdown == true  ? 0x00 : 0x10) |
     (value >> 8) &              0x0f;
-  spi_send(word0);
 
   const uint8_t word1 = value & 0xff;
-  spi_send(word1);
 
+#if USE_HW_SPI
+  // one transaction with chip select driven by the board
+  const uint8_t words[2] = { word0, word1 };
+  spi_hw_transfer(words, nullptr, sizeof(words), PIN_CE_MCP4802);
+#else
+  gpio_write(PIN_CE_MCP4802, 0);
+  spi_send(word0);
+  spi_send(word1);
   gpio_write(PIN_CE_MCP4802, 1);
+#endif
 }
 
 static uint16_t mcp3202_read(int channel) {
@@ -52,6 +60,13 @@ static uint16_t mcp3202_read(int channel) {
   return ((recv1 & 0x0f) << 8) | recv2;
 }
 
+static void on_adc_samples(const uint16_t *samples, uint32_t count) {
+  // both channels are enabled so samples alternate r0, r1
+  for (uint32_t i = 0; i + 1 < count; i += 2) {
+    printf("r0:%03x r1:%03x\n", samples[i], samples[i + 1]);
+  }
+}
+
 int main(int argc, char** args) {
 
   if (!gpio_open(nullptr)) {
@@ -72,6 +87,28 @@ int main(int argc, char** args) {
   gpio_output(PIN_CE_MCP4802);
   gpio_write(PIN_CE_MCP4802, 1);
 
+#if USE_ADC_STREAM && USE_HW_SPI
+  // the board plays a rising and falling ramp on the DAC by itself
+  uint16_t ramp[2][64];
+  for (int i = 0; i < 64; ++i) {
+    ramp[0][i] = i * 64;
+    ramp[1][i] = 0xfff - i * 64;
+  }
+  dac_wave_load(0,  ramp[0], 64);
+  dac_wave_load(64, ramp[1], 64);
+  dac_wave_select(0, 0,  64);
+  dac_wave_select(1, 64, 64);
+  dac_wave_start(1000, PIN_CE_MCP4802);
+
+  // sample both channels at 1kHz, samples arrive in on_adc_samples
+  if (adc_stream_start(1000, 3, on_adc_samples, PIN_CE_MCP3202)) {
+    for (;;) {
+      gpio_poll();
+      gpio_delay(1);
+    }
+  }
+#endif
+
   // itterate a number of times
   for (int i = 0; i < 1024 * 1024; ++i) {
 
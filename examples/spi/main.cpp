@@ -1,6 +1,7 @@
 #include <thread>
 #include <chrono>
 #include <stdio.h>
+#include <stdlib.h>
 #include "gpio.h"
 
 int main(int argc, char** args) {
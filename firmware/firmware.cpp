@@ -2,8 +2,46 @@
 
 #define BAUD_RATE   230400
 #define PIN_COUNT   28
-#define VERSION_STR "RTk.GPIO v2 10/04/2022\n"
-#define READY_STR   "RTk.GPIO v2 Ready\n"
+#define VERSION_STR "RTk.GPIO v3 19/10/2026\n"
+#define READY_STR   "RTk.GPIO v3 Ready\n"
+#define RX_SIZE     256
+#define TX_SIZE     128
+#define ADC_FRAME   8
+#define WAVE_POOL   128
+#define UART_SIZE   64
+#define UART_FRAME  32
+#define MACRO_COUNT 8
+#define MACRO_POOL  192
+#define MACRO_ARGS  8
+#define PULSE_GATE  50000
+#define ENCODER_COUNT 4
+#define KEYPAD_LINES  4
+#define BUS_COUNT     2
+#define WS2812_MAX    85
+#define ONEWIRE_MAX   64
+#define SOFTPWM_COUNT 8
+#define ANALOG_PINS   8
+
+// optional features, each can be left out of the build to save RAM and
+// flash, see firmware/README.md for the budget of the STM32F030C6
+#ifndef FEATURE_UART
+#define FEATURE_UART    1  // USART2 bridge
+#endif
+#ifndef FEATURE_WAVE
+#define FEATURE_WAVE    1  // SPI DAC waveform tables
+#endif
+#ifndef FEATURE_KEYS
+#define FEATURE_KEYS    1  // debounced inputs and keypad scanning
+#endif
+#ifndef FEATURE_SOFTPWM
+#define FEATURE_SOFTPWM 1  // software PWM and servo pulses
+#endif
+#ifndef FEATURE_WS2812
+#define FEATURE_WS2812  1  // WS2812 pixel strings
+#endif
+#ifndef FEATURE_MACRO
+#define FEATURE_MACRO   1  // on board macros saved to flash
+#endif
 
 // pin number mapping
 static const PinName gpPinMap[] = {
@@ -21,23 +59,428 @@ static const PinName spiPinMosi = PA_7;  // gp10
 static SPI *spi;
 // data to be transmited from the spi interface
 static uint8_t spi_out;
+// SPI bus clock and mode applied whenever the bus is created
+static uint32_t spi_frequency = 1000000;
+static uint8_t  spi_mode      = 0;
+
+// I2C bus
+static const PinName i2cPinSda = PB_7;  // gp2
+static const PinName i2cPinScl = PB_6;  // gp3
+static I2C *i2c;
+// I2C clock frequency applied whenever the bus is created
+static uint32_t i2c_frequency = 100000;
+
+// I2C transaction in progress
+static uint8_t i2c_addr;
+static uint8_t i2c_wlen;
+static uint8_t i2c_rlen;
+static uint8_t i2c_pos;
+
+// data of the command being run, an I2C transfer, a WS2812 frame and 1-Wire
+// data are never in progress together so they share the storage
+static union {
+    uint8_t i2c[255];
+    uint8_t onewire[255];  // write data or ROM codes of a query
+#if FEATURE_WS2812
+    uint8_t ws2812[WS2812_MAX * 3];  // 3 GRB bytes per LED
+#endif
+} cmd_buf;
+
+// USART2 bridge
+static const PinName uartPinTx = PA_2;  // gp14
+static const PinName uartPinRx = PA_3;  // gp15
+#if FEATURE_UART
+static RawSerial *uart;
+#endif
+
+#if FEATURE_UART
+// USART2 receive ring buffer, filled by its rx interrupt
+static uint8_t           uart_rx_buffer[UART_SIZE];
+static volatile uint16_t uart_rx_head;
+static volatile uint16_t uart_rx_tail;
+static volatile uint32_t uart_rx_stamp;  // time data arrived in the empty buffer
+
+// USART2 transmit ring buffer, drained from the main loop
+static uint8_t  uart_tx_buffer[UART_SIZE];
+static uint16_t uart_tx_head;
+static uint16_t uart_tx_tail;
+static uint8_t  uart_wlen;
+#endif
+
+// SPI transaction flags
+enum {
+    SPI_TXN_HOLD_CS = 0x1,  // leave chip select asserted after the transfer
+    SPI_TXN_REPLY   = 0x2,  // send received bytes back to the host
+};
+
+// SPI transaction in progress
+static uint8_t  spi_txn_cs;
+static uint8_t  spi_txn_flags;
+static uint16_t spi_txn_len;
+// a transaction currently has its chip select asserted
+static bool     spi_cs_active;
+
+// the main loop is clocking the SPI bus, the ADC ticker must leave it alone
+static volatile bool     spi_bus_busy;
+
+// SPI ADC (MCP3202) streaming state, samples are taken by the ticker into
+// one frame while the main loop sends the other
+struct adc_frame_t {
+    uint16_t      samples[ADC_FRAME];
+    uint8_t       count;
+    uint32_t      stamp;  // time the first sample of the frame was taken
+    volatile bool ready;  // full, or cut short by a missed tick, and unsent
+};
+static Ticker            adc_ticker;
+static uint8_t           adc_cs;
+static volatile uint8_t  adc_mask;
+static adc_frame_t       adc_frames[2];
+static volatile uint8_t  adc_fill;  // frame the ticker is filling
+
+// LCD commands understood by ST7735 class panels
+enum {
+    LCD_CASET = 0x2A,
+    LCD_RASET = 0x2B,
+    LCD_RAMWR = 0x2C,
+};
+
+// LCD primitive in progress
+static char     lcd_op;
+static uint8_t  lcd_cs;
+static uint8_t  lcd_dc;
+static uint16_t lcd_rect[4];
+static uint8_t  lcd_rect_arg;
+static uint8_t  lcd_runs;
+static uint8_t  lcd_run_len;
+
+#if FEATURE_WAVE
+// waveform playback state for one DAC channel
+struct wave_channel_t {
+    uint16_t offset;       // first sample of the table in the pool
+    uint16_t length;       // number of samples, zero when disabled
+    uint16_t pos;          // next sample to output
+    uint16_t next_offset;  // table to switch to at the end of this loop
+    uint16_t next_length;
+    bool     swap;         // a table switch is pending
+};
+
+// SPI DAC (MCP4802) waveform generator state
+static uint16_t          wave_pool[WAVE_POOL];
+static wave_channel_t    wave_ch[2];
+static Ticker            wave_ticker;
+static volatile uint32_t wave_pending;
+static uint8_t           wave_cs;
+static bool              wave_running;
+static uint16_t          wave_arg_offset;
+static uint16_t          wave_arg_count;
+static uint8_t           wave_arg_channel;
+#endif  // FEATURE_WAVE
+
+// pin or SPI status wait in progress
+static Timer   wait_timer;
+static uint8_t wait_pin;    // pin to watch, or chip select of the SPI device
+static uint8_t wait_level;  // level or masked status that ends the wait
+static uint8_t wait_cmd;
+static uint8_t wait_mask;
+
+// timer input capture channel available on a pin
+struct capture_t {
+    uint8_t      pin;      // gp pin number
+    TIM_TypeDef *tim;
+    uint8_t      channel;  // capture channel, 0 to 3
+    uint8_t      af;       // alternate function connecting the pin to the timer
+};
+
+// pins with a timer capture channel, see firmware/README.md
+static const capture_t capturePins[] = {
+    {  9, TIM3,  0, 1 },  // PA6
+    { 10, TIM3,  1, 1 },  // PA7
+    { 26, TIM3,  2, 1 },  // PB0
+    { 18, TIM3,  3, 1 },  // PB1
+    { 25, TIM3,  0, 1 },  // PB4
+    {  8, TIM3,  1, 1 },  // PB5
+    { 16, TIM16, 0, 2 },  // PB8
+    { 20, TIM17, 0, 2 },  // PB9
+};
+
+// pulse measurement in progress
+static const capture_t *capture;  // timer channel in use, NULL when polling the pin
+static DigitalInOut    *pulse_io;
+static uint8_t          pulse_pin;
+static uint8_t          pulse_level;
+static uint32_t         capture_ovf;
+static uint32_t         capture_mode;
+
+// quadrature encoder decoded by edge interrupts or by TIM3 in encoder mode
+struct encoder_t {
+    InterruptIn     *a;          // edge interrupts, NULL in timer mode
+    InterruptIn     *b;
+    bool             timer;
+    uint8_t          pin_a;      // 0xff when closed
+    uint8_t          pin_b;
+    uint8_t          phase;      // last A/B levels
+    uint16_t         timer_cnt;  // last TIM3 count
+    volatile int32_t count;
+    int32_t          sent;       // count last pushed to the host
+    uint32_t         sent_at;
+    uint32_t         notify_us;  // minimum time between pushes, zero when off
+};
+
+// quadrature encoders
+static encoder_t encoders[ENCODER_COUNT];
+static uint8_t   encoder_id;
+static uint8_t   encoder_pin_a;
+
+#if FEATURE_KEYS
+// debounce state of one input or key
+struct debounce_t {
+    uint8_t time;    // milliseconds a change must be stable for, zero when off
+    uint8_t count;   // milliseconds the input has differed from `stable`
+    bool    stable;  // level last reported to the host
+};
+
+// debounced inputs and keypad matrix scanning, sampled every millisecond
+static Ticker            key_ticker;
+static volatile uint32_t key_pending;
+static debounce_t        key_input[PIN_COUNT];
+static uint8_t           keypad_rows;
+static uint8_t           keypad_cols;
+static uint8_t           keypad_pin[KEYPAD_LINES * 2];  // rows then columns
+static debounce_t        keypad_key[KEYPAD_LINES * KEYPAD_LINES];
+static uint8_t           keypad_arg;
+static uint8_t           keypad_arg_rows;
+static uint8_t           keypad_arg_cols;
+static uint8_t           key_arg_pin;
+#endif  // FEATURE_KEYS
+
+// parallel bus flags
+enum {
+    BUS_STROBE_LOW = 0x1,  // the strobe is active low (8080 WR) rather than high (HD44780 E)
+};
+
+// parallel bus write modes
+enum {
+    BUS_RS     = 0x1,  // drive the register select pin high
+    BUS_NIBBLE = 0x2,  // send only the high nibble of each byte on a 4 bit bus
+};
+
+// parallel bus definition
+struct bus_t {
+    uint8_t  width;     // 4 or 8 data pins, zero when undefined
+    uint8_t  flags;
+    uint8_t  strobe;
+    uint8_t  rs;        // register select, 0xff when unused
+    uint8_t  rw;        // read/write select held low, 0xff when unused
+    uint8_t  data[8];   // lowest data bit first
+    uint16_t delay_us;  // time the peripheral needs after each byte
+};
+
+// parallel buses
+static bus_t   buses[BUS_COUNT];
+static bus_t   bus_arg;
+static uint8_t bus_arg_id;
+static uint8_t bus_arg_pos;
+static uint8_t bus_arg_mode;
+static uint8_t bus_arg_len;
+
+// shift register transfer flags
+enum {
+    SHIFT_MSB_FIRST    = 0x1,  // send or receive the most significant bit first
+    SHIFT_CLOCK_SAMPLE = 0x2,  // sample input bits after the rising clock edge
+};
+
+// shift register transfer in progress
+static uint8_t shift_arg_op;
+static uint8_t shift_arg_data;
+static uint8_t shift_arg_clock;
+static uint8_t shift_arg_latch;
+static uint8_t shift_arg_flags;
+static uint8_t shift_arg_len;
+
+// WS2812 pixel data waiting to be shown, held in cmd_buf
+#if FEATURE_WS2812
+static uint16_t ws2812_arg_len;
+static uint16_t ws2812_arg_pos;
+#endif
+
+// 1-Wire write flags
+enum {
+    ONEWIRE_POWER = 0x1,  // drive the bus high after writing to power parasitic devices
+};
+
+// 1-Wire operation in progress
+static uint8_t onewire_arg_op;
+static uint8_t onewire_arg_pin;
+static uint8_t onewire_arg_flags;
+static uint8_t onewire_arg_len;
+static uint16_t onewire_arg_pos;
+
+#if FEATURE_SOFTPWM
+// software PWM channel, times are in microseconds of the PWM clock
+struct softpwm_t {
+    uint8_t  pin;     // 0xff when unused
+    bool     high;
+    uint32_t period;
+    uint32_t width;
+    uint32_t rise;    // time of the next rising edge
+    uint32_t fall;    // time of the falling edge while high
+};
+
+// software PWM channels, all driven from TIM14
+static softpwm_t softpwm[SOFTPWM_COUNT];
+static uint8_t   softpwm_arg_pin;
+static uint32_t  softpwm_arg_period;
+static uint32_t  softpwm_time;  // PWM clock extended to 32bits
+static uint16_t  softpwm_cnt;   // TIM14 count when softpwm_time was updated
+#endif  // FEATURE_SOFTPWM
+
+// internal ADC capable pins in channel order, the order a scan samples them
+struct analog_pin_t {
+    uint8_t pin;
+    uint8_t channel;
+};
+static const analog_pin_t analogPins[ANALOG_PINS] = {
+    {  0, 1 },  // PA1
+    { 14, 2 },  // PA2
+    { 15, 3 },  // PA3
+    { 11, 5 },  // PA5
+    {  9, 6 },  // PA6
+    { 10, 7 },  // PA7
+    { 26, 8 },  // PB0
+    { 18, 9 },  // PB1
+};
+
+// internal ADC scan, converted continuously into analog_scan by DMA
+static volatile uint16_t analog_scan[ANALOG_PINS];
+static uint32_t          analog_pins;       // mask of the pins being scanned
+static uint32_t          analog_notify_us;
+static uint32_t          analog_sent_at;
+static uint32_t          analog_arg_pins;
+
+// SPI read CRC in progress
+static uint8_t crc_arg_cs;
+static uint8_t crc_arg_len;
+
+#if FEATURE_MACRO
+// byte ranges with a special meaning for macros
+enum {
+    MACRO_TRIGGER = 0x80,  // 0x80 + id runs a stored macro
+    MACRO_ARG     = 0xF0,  // 0xF0 + n in a macro body is replaced by argument n
+};
+
+// a stored macro body within the macro pool
+struct macro_t {
+    uint16_t offset;
+    uint16_t length;  // zero when not defined
+    uint8_t  args;    // number of argument chars following the trigger
+};
+
+// macro storage, laid out so it can be written to flash as is
+struct macro_store_t {
+    uint32_t magic;
+    uint16_t used;
+    uint16_t reserved;
+    macro_t  table[MACRO_COUNT];
+    uint8_t  pool[MACRO_POOL];
+};
+
+// changed whenever the layout or its sizes change
+static const uint32_t MACRO_MAGIC = 0x4D435232;  // "MCR2"
+
+// on board macros
+static macro_store_t macros;
+static bool          macro_running;
+static uint8_t       macro_id;
+static uint16_t      macro_len;
+static bool          macro_fits;
+static char          macro_arg[MACRO_ARGS];
+static uint8_t       macro_arg_pos;
+#endif  // FEATURE_MACRO
 
 // UART serial port
-static Serial serialPort(/*TX=*/PA_9, /*RX=*/PA_10);
+static RawSerial serialPort(/*TX=*/PA_9, /*RX=*/PA_10);
+
+// serial receive ring buffer, filled by the rx interrupt
+static uint8_t           rx_buffer[RX_SIZE];
+static volatile uint16_t rx_head;
+static volatile uint16_t rx_tail;
+
+// serial transmit ring buffer, drained from the main loop
+static uint8_t  tx_buffer[TX_SIZE];
+static uint16_t tx_head;
+static uint16_t tx_tail;
+
+// hex argument being accumulated and where to deliver it
+static uint32_t arg_value;
+static uint8_t  arg_nibbles;
+static void   (*arg_hex_done)(uint32_t value);
+static void   (*arg_pin_done)(uint8_t pin);
 
 // index of the next pin operation
 static uint8_t latched_pin = 0;
 
+// append board timestamps to reads, events and captures
+static bool timestamps;
+
 // currently bound state handler
 static void (*state_handler)(const char dat);
 
 // state machine state handlers
 static void state_spi_xfer_1  (const char dat);
 static void state_spi_xfer_2  (const char dat);
+static void state_hex_arg     (const char dat);
+static void state_pin_arg     (const char dat);
+static void state_lcd_op      (const char dat);
+#if FEATURE_WAVE
+static void state_wave_op     (const char dat);
+#endif
+static void state_i2c_op      (const char dat);
+#if FEATURE_UART
+static void state_uart_op     (const char dat);
+#endif
+#if FEATURE_MACRO
+static void state_macro_op    (const char dat);
+static void state_macro_arg   (const char dat);
+#endif
+static void state_wait_op     (const char dat);
+static void state_pulse_op    (const char dat);
+static void state_encoder_op  (const char dat);
+#if FEATURE_KEYS
+static void state_key_op      (const char dat);
+#endif
+static void state_bus_op      (const char dat);
+static void state_shift_op    (const char dat);
+static void state_onewire_op  (const char dat);
+static void state_analog_op   (const char dat);
 static void state_default(const char dat);
 
+// stop streaming ADC samples
+static void adc_stop(void);
+
+// stop any software PWM channel on a pin, and the PWM timer if none are left
+static void softpwm_release(uint8_t pin) {
+#if FEATURE_SOFTPWM
+    bool active = false;
+    __disable_irq();
+    for (uint8_t i = 0; i < SOFTPWM_COUNT; ++i) {
+        if (softpwm[i].pin == pin) {
+            softpwm[i].pin = 0xff;
+        }
+        active = active || softpwm[i].pin != 0xff;
+    }
+    if (!active) {
+        TIM14->DIER = 0;
+        TIM14->CR1  = 0;
+    }
+    __enable_irq();
+#else
+    (void)pin;
+#endif
+}
+
 // dispose of a bound gpio object
 static void gpio_dispose(uint8_t pin) {
+    softpwm_release(pin);
     if (gp[pin]) {
         delete gp[pin];
         gp[pin] = NULL;
@@ -46,18 +489,84 @@ static void gpio_dispose(uint8_t pin) {
 
 // dispose of a bound spi object
 static void spi_dispose(void) {
+    // the ADC ticker clocks SPI1 directly and would wait forever on the bus
+    // once its clock is gated
+    adc_stop();
     if (spi) {
         delete spi;
         spi = NULL;
     }
 }
 
-// access a pin as a GPIO interface
-static DigitalInOut *gpio_get(uint8_t pin) {
-    // check if the digital pin already exists
-    if (gp[pin]) {
-        return gp[pin];
+// dispose of a bound i2c object
+static void i2c_dispose(void) {
+    if (i2c) {
+        delete i2c;
+        i2c = NULL;
+    }
+}
+
+// dispose of a bound uart object
+static void uart_dispose(void) {
+#if FEATURE_UART
+    if (uart) {
+        delete uart;
+        uart = NULL;
+    }
+    uart_rx_head = uart_rx_tail = 0;
+    uart_tx_head = uart_tx_tail = 0;
+#endif
+}
+
+// close an encoder, the next user of its pins reconfigures them
+static void encoder_dispose(uint8_t id) {
+    encoder_t &e = encoders[id];
+    if (e.timer) {
+        TIM3->CR1  = 0;
+        TIM3->SMCR = 0;
+        e.timer = false;
+    }
+    delete e.a;
+    delete e.b;
+    e.a         = NULL;
+    e.b         = NULL;
+    e.pin_a     = 0xff;
+    e.pin_b     = 0xff;
+    e.notify_us = 0;
+}
+
+// close any encoder using a pin
+static void encoder_release(uint8_t pin) {
+    for (uint8_t i = 0; i < ENCODER_COUNT; ++i) {
+        if (encoders[i].pin_a == pin || encoders[i].pin_b == pin) {
+            encoder_dispose(i);
+        }
+    }
+}
+
+// stop the internal ADC scan, leaving the ADC for single conversions
+static void analog_stop(void) {
+    if (!analog_pins) {
+        return;
+    }
+    ADC1->CR |= ADC_CR_ADSTP;
+    while (ADC1->CR & ADC_CR_ADSTP) {
+    }
+    ADC1->CFGR1 = 0;
+    DMA1_Channel1->CCR = 0;
+    analog_pins = 0;
+}
+
+// stop the internal ADC scan if it uses a pin
+static void analog_release(uint8_t pin) {
+    if (analog_pins & (1u << pin)) {
+        analog_stop();
     }
+}
+
+// free a pin from any GPIO object or peripheral currently using it
+static void pin_claim(uint8_t pin) {
+    gpio_dispose(pin);
     // get the mbed pin
     const PinName mpin = gpPinMap[pin];
     // check if we conflict with the spi object
@@ -67,8 +576,33 @@ static DigitalInOut *gpio_get(uint8_t pin) {
     if (uses_spi) {
         spi_dispose();
     }
+    // check if we conflict with the i2c object
+    const bool uses_i2c = (mpin == i2cPinSda) ||
+                          (mpin == i2cPinScl);
+    if (uses_i2c) {
+        i2c_dispose();
+    }
+    // check if we conflict with the uart object
+    const bool uses_uart = (mpin == uartPinTx) ||
+                           (mpin == uartPinRx);
+    if (uses_uart) {
+        uart_dispose();
+    }
+    // check if we conflict with an encoder
+    encoder_release(pin);
+    // check if we conflict with the internal ADC scan
+    analog_release(pin);
+}
+
+// access a pin as a GPIO interface
+static DigitalInOut *gpio_get(uint8_t pin) {
+    // check if the digital pin already exists
+    if (gp[pin]) {
+        return gp[pin];
+    }
+    pin_claim(pin);
     // create the new GPIO object
-    return gp[pin] = new DigitalInOut(mpin);
+    return gp[pin] = new DigitalInOut(gpPinMap[pin]);
 }
 
 // access the SPI bus
@@ -81,8 +615,47 @@ static SPI *spi_get() {
     gpio_dispose(9);   // spiPinMiso
     gpio_dispose(10);  // spiPinMosi
     gpio_dispose(11);  // spiPinSck
+    encoder_release(9);
+    encoder_release(10);
     // create the new SPI object
-    return spi = new SPI(spiPinMosi, spiPinMiso, spiPinSck);
+    spi = new SPI(spiPinMosi, spiPinMiso, spiPinSck);
+    spi->format(8, spi_mode);
+    spi->frequency(spi_frequency);
+    return spi;
+}
+
+// access the I2C bus
+static I2C *i2c_get() {
+    // check if i2c object already exists
+    if (i2c) {
+        return i2c;
+    }
+    // check if one of the I2C pins is currently used
+    gpio_dispose(2);  // i2cPinSda
+    gpio_dispose(3);  // i2cPinScl
+    encoder_release(2);
+    encoder_release(3);
+    // create the new I2C object
+    i2c = new I2C(i2cPinSda, i2cPinScl);
+    i2c->frequency(i2c_frequency);
+    return i2c;
+}
+
+// check if a pin is one of the hardware SPI pins
+static bool is_spi_pin(uint8_t pin) {
+    return pin == 9 || pin == 10 || pin == 11;
+}
+
+// drive an output pin such as a chip select, ignoring invalid or SPI bus pins
+static void pin_drive(uint8_t pin, int level) {
+    if (pin >= PIN_COUNT || is_spi_pin(pin)) {
+        return;
+    }
+    DigitalInOut *io = gpio_get(pin);
+    if (io) {
+        io->output();
+        io->write(level);
+    }
 }
 
 // convert hex chars to a binary nibble
@@ -95,6 +668,79 @@ static char nibble_to_hex(uint8_t x) {
     return (x >= 10) ? ('A' + (x - 10)) : ('0' + x);
 }
 
+// send as much buffered data as the uart will currently accept
+static void tx_drain(void) {
+    while (tx_tail != tx_head && serialPort.writeable()) {
+        serialPort.putc(tx_buffer[tx_tail]);
+        tx_tail = (tx_tail + 1) % TX_SIZE;
+    }
+}
+
+// queue a char for the host, waiting only if the buffer is full
+static void tx_putc(char c) {
+    const uint16_t next = (tx_head + 1) % TX_SIZE;
+    while (next == tx_tail) {
+        tx_drain();
+    }
+    tx_buffer[tx_head] = uint8_t(c);
+    tx_head = next;
+}
+
+// queue a string for the host
+static void tx_puts(const char *str) {
+    while (*str) {
+        tx_putc(*str++);
+    }
+}
+
+// send a byte to the host as two hex chars
+static void put_hex8(uint8_t x) {
+    tx_putc(nibble_to_hex((x >> 4) & 0xf));  // msb
+    tx_putc(nibble_to_hex((x     ) & 0xf));  // lsb
+}
+
+// send a 32bit value to the host as eight hex chars
+static void put_hex32(uint32_t x) {
+    put_hex8(uint8_t(x >> 24));
+    put_hex8(uint8_t(x >> 16));
+    put_hex8(uint8_t(x >>  8));
+    put_hex8(uint8_t(x      ));
+}
+
+// send a board timestamp if they are enabled
+static void put_stamp(uint32_t stamp) {
+    if (timestamps) {
+        put_hex32(stamp);
+    }
+}
+
+// send an unsolicited event frame to the host
+// '!' <type> <len:2> <data:len*2> [<stamp:8>]
+// the host may receive these between any two bytes of a command reply
+static void event_send(char type, const uint8_t *data, uint8_t len, uint32_t stamp) {
+    tx_putc('!');
+    tx_putc(type);
+    put_hex8(len);
+    for (uint8_t i = 0; i < len; ++i) {
+        put_hex8(data[i]);
+    }
+    put_stamp(stamp);
+}
+
+// read a hex encoded argument of `nibbles` chars then invoke `done`
+static void read_hex_arg(uint8_t nibbles, void (*done)(uint32_t value)) {
+    arg_value     = 0;
+    arg_nibbles   = nibbles;
+    arg_hex_done  = done;
+    state_handler = state_hex_arg;
+}
+
+// read a pin letter argument ('-' for no pin) then invoke `done`
+static void read_pin_arg(void (*done)(uint8_t pin)) {
+    arg_pin_done  = done;
+    state_handler = state_pin_arg;
+}
+
 // perform a pin related action
 static void dispatch_pin(uint8_t pin, uint8_t action) {
     if (pin >= PIN_COUNT) {
@@ -105,20 +751,24 @@ static void dispatch_pin(uint8_t pin, uint8_t action) {
     if (io) {
         // dispatch the operation
         switch (action) {
-        case '0': io->write(0);       break;
-        case '1': io->write(1);       break;
-        case 'O': io->output();       break;
+        case '0': softpwm_release(pin); io->write(0); break;
+        case '1': softpwm_release(pin); io->write(1); break;
+        case 'O': softpwm_release(pin); io->output(); break;
         case 'D': io->mode(PullDown); break;
         case 'U': io->mode(PullUp);   break;
         case 'N': io->mode(PullNone); break;
         case 'I':
+            softpwm_release(pin);
             io->input();
             break;
-        case '?':
-            serialPort.putc('a' + pin);
-            serialPort.putc( io->read() ? '1' : '0' );
+        case '?': {
+            const uint32_t stamp = us_ticker_read();
+            tx_putc('a' + pin);
+            tx_putc( io->read() ? '1' : '0' );
+            put_stamp(stamp);
             break;
         }
+        }
     }
 }
 
@@ -130,120 +780,2985 @@ static void inc_latched_pin(void) {
     }
 }
 
-// reset all assumed state
-static void reset() {
-    // reset the latched pin
-    latched_pin = 0;
-    // dispose of all GPIO pin
-    for (int i=0; i<PIN_COUNT; ++i) {
-        gpio_dispose(i);
+// GPIO port of an mbed pin
+static GPIO_TypeDef *pin_port(PinName mpin) {
+    switch (mpin >> 4) {
+    case 0:  return GPIOA;
+    case 1:  return GPIOB;
+    default: return GPIOF;
     }
-    // dispose of the SPI interface
-    spi_dispose();
-    // default to root state
-    state_handler = state_default;
 }
 
-// SPI transmit state 2
-// latch second byte and then perform the transfer operation
-static void state_spi_xfer_2(const char dat) {
-    // get the spi object we need
-    SPI *spi = spi_get();
-    if (spi) {
-        // latch spi least significant bit
-        const uint8_t d1 = hex_to_nibble(dat);
-        spi_out |= d1 & 0x0f;
-        // send byte over spi
-        const uint8_t recv = spi->write(spi_out);
-        // send response back to host
-        serialPort.putc(nibble_to_hex((recv >> 4) & 0xf));  // msb
-        serialPort.putc(nibble_to_hex((recv     ) & 0xf));  // lsb
+// drive an output pin with a single register write, the pin must already
+// be an output
+static void pin_fast_write(uint8_t pin, int level) {
+    const PinName mpin = gpPinMap[pin];
+    pin_port(mpin)->BSRR = (1u << (mpin & 0xf)) << (level ? 0 : 16);
+}
+
+// exchange one byte on SPI1 with register access, safe from an interrupt
+static uint8_t spi_irq_write(uint8_t value) {
+    while (!(SPI1->SR & SPI_SR_TXE)) {
     }
-    // set next state
-    state_handler = state_default;
+    // byte access so the data register packs a single frame
+    *(__IO uint8_t*)&SPI1->DR = value;
+    while (!(SPI1->SR & SPI_SR_RXNE)) {
+    }
+    return *(__IO uint8_t*)&SPI1->DR;
 }
 
-// SPI transmit state 1
-// latch first byte then wait for the second state
-static void state_spi_xfer_1(const char dat) {
-    // latch spi most significant bit
-    const uint8_t d0 = hex_to_nibble(dat);
-    spi_out = d0 << 4;
-    // set next state
-    state_handler = state_spi_xfer_2;
+// read one channel of an MCP3202
+static uint16_t mcp3202_read(uint8_t channel) {
+    // start, then single ended with the channel set and msb first, then a
+    // dummy byte to clock out the remaining bits
+    pin_fast_write(adc_cs, 0);
+    spi_irq_write(0x01);
+    const uint8_t r1 = spi_irq_write(0x80 | (channel ? 0x40 : 0x00) | 0x20);
+    const uint8_t r2 = spi_irq_write(0x00);
+    pin_fast_write(adc_cs, 1);
+    return ((r1 & 0x0f) << 8) | r2;
 }
 
-// default state
-static void state_default(const char dat) {
-    // pin adjustment
-    if (dat >= 'a' && dat < ('a' + PIN_COUNT)) {
-        // latch this pin for later operations
-        latched_pin = uint8_t(dat - 'a');
-        return;
+// hand the frame being filled to the main loop and fill the other one
+static void adc_close_frame(void) {
+    adc_frame_t &f = adc_frames[adc_fill];
+    if (f.count) {
+        f.ready  = true;
+        adc_fill ^= 1;
     }
-    // latched pin adjustment
-    if (dat == '0' || dat == '1' ||
-        dat == 'I' || dat == 'O' ||
-        dat == '?' ||
-        dat == 'U' || dat == 'D' || dat == 'N') {
-        // perform this action
-        dispatch_pin(/*pin=*/latched_pin, /*op=*/dat);
-        // increment the latched pin
-        inc_latched_pin();
+}
+
+// ADC ticker interrupt, samples are taken here so they are evenly spaced.
+// a tick that finds the bus in use by the main loop or another device
+// selected, or no free frame, is dropped and ends the current frame so that
+// every frame is evenly spaced from its stamp
+static void on_adc_tick(void) {
+    adc_frame_t &f = adc_frames[adc_fill];
+    if (f.ready) {
         return;
     }
-    // SPI operation
-    if (dat == '~') {
-        // enter the spi transfer state
-        state_handler = state_spi_xfer_1;
+    if (spi_bus_busy || spi_cs_active) {
+        adc_close_frame();
         return;
     }
+    // a byte left unread by a transmit only transfer would be taken as
+    // the first reply
+    while (SPI1->SR & SPI_SR_RXNE) {
+        (void)*(__IO uint8_t*)&SPI1->DR;
+    }
+    if (f.count == 0) {
+        f.stamp = us_ticker_read();
+    }
+    for (uint8_t ch = 0; ch < 2; ++ch) {
+        if (adc_mask & (1 << ch)) {
+            f.samples[f.count++] = mcp3202_read(ch);
+        }
+    }
+    if (f.count >= ADC_FRAME) {
+        adc_close_frame();
+    }
 }
 
-static bool global_handler(const char dat) {
-    // return version string
-    if (dat == 'V') {
-        serialPort.puts(VERSION_STR);
-        return true;
+// stop streaming ADC samples
+static void adc_stop(void) {
+    adc_ticker.detach();
+    adc_mask = 0;
+    adc_fill = 0;
+    for (uint8_t i = 0; i < 2; ++i) {
+        adc_frames[i].count = 0;
+        adc_frames[i].ready = false;
     }
-    // reset state
-    if (dat == 'R') {
-        reset();
-        // send ack
-        serialPort.puts("OK");
-        return true;
+}
+
+// send a frame packed as pairs of 12bit values in 3 bytes, an odd sample
+// left at the end of a frame cut short is lost
+static void adc_send_frame(adc_frame_t &f) {
+    uint8_t data[ADC_FRAME / 2 * 3];
+    uint8_t len = 0;
+    for (uint8_t i = 0; i + 1 < f.count; i += 2) {
+        const uint16_t a = f.samples[i + 0];
+        const uint16_t b = f.samples[i + 1];
+        data[len++] = uint8_t(a >> 4);
+        data[len++] = uint8_t(((a & 0xf) << 4) | (b >> 8));
+        data[len++] = uint8_t(b);
     }
-    return false;
+    if (len) {
+        event_send('Q', data, len, f.stamp);
+    }
+    f.count = 0;
+    f.ready = false;
 }
 
-int main() {
-    // reset the GPIO board state
-    reset();
-    // setup the serial port
-    serialPort.baud(BAUD_RATE);
-    serialPort.format(
-        /*     bits=*/8,
-        /*   parity=*/mbed::SerialBase::None,
-        /*stop_bits=*/1);
-    serialPort.printf(READY_STR);
-    // main loop
-    for (;;) {
-        // wait for data to be available
-        if (!serialPort.readable()) {
-            continue;
-        }
-        // note that in this design this is the only place that reads from
-        // the serial port.  this is important to avoid lockups when waiting
-        // for data in nested code.  by reading in on place we can support
-        // a global hander that can perform resets consistently.
-        const uint8_t dat = serialPort.getc();
-        // allow a global handler to deal with this first
-        if (global_handler(dat)) {
-            continue;
+// send any frames the ticker has finished, oldest first
+static void adc_service(void) {
+    // when both are waiting the one the ticker would fill next is older
+    const uint8_t first = adc_fill;
+    for (uint8_t i = 0; i < 2; ++i) {
+        adc_frame_t &f = adc_frames[first ^ i];
+        if (f.ready) {
+            adc_send_frame(f);
         }
-        // invoke state handler
-        if (state_handler) {
+    }
+}
+
+// ADC sample period, start or restart streaming
+// replies 0 when streaming was started or stopped, 1 for an unusable chip
+// select, which leaves streaming stopped
+static void adc_period(uint32_t value) {
+    const uint8_t mask = adc_mask;
+    adc_stop();
+    if (!mask || !value) {
+        tx_putc('0');
+        return;
+    }
+    // the chip select is toggled with register writes inside the ticker
+    if (adc_cs >= PIN_COUNT || is_spi_pin(adc_cs)) {
+        tx_putc('1');
+        return;
+    }
+    adc_mask = mask;
+    spi_get();
+    pin_drive(adc_cs, 1);
+    adc_ticker.attach_us(on_adc_tick, value);
+    tx_putc('0');
+}
+
+// ADC channel mask
+static void adc_channels(uint32_t value) {
+    adc_mask = uint8_t(value) & 0x3;
+    read_hex_arg(8, adc_period);
+}
+
+// ADC chip select pin
+static void adc_chip_select(uint8_t pin) {
+    adc_cs = pin;
+    read_hex_arg(1, adc_channels);
+}
+
+#if FEATURE_WAVE
+// waveform ticker interrupt, serviced from the main loop
+static void on_wave_tick(void) {
+    ++wave_pending;
+}
+
+// stop waveform playback
+static void wave_stop(void) {
+    wave_ticker.detach();
+    wave_running = false;
+    wave_pending = 0;
+}
+
+// write one channel of an MCP4802, gain 1x and output active
+static void mcp4802_write(SPI *spi, uint8_t channel, uint16_t value) {
+    pin_drive(wave_cs, 0);
+    spi->write((channel ? 0x80 : 0x00) | 0x10 | ((value >> 8) & 0x0f));
+    spi->write(value & 0xff);
+    pin_drive(wave_cs, 1);
+}
+
+// output any waveform samples that are due
+static void wave_service(void) {
+    if (!wave_running || !wave_pending) {
+        return;
+    }
+    // never clock the bus while another device is selected
+    if (spi_cs_active) {
+        return;
+    }
+    SPI *spi = spi_get();
+    const bool busy = spi_bus_busy;
+    spi_bus_busy = true;
+    while (wave_pending) {
+        __disable_irq();
+        --wave_pending;
+        __enable_irq();
+        for (uint8_t ch = 0; ch < 2; ++ch) {
+            wave_channel_t &w = wave_ch[ch];
+            if (w.length == 0) {
+                continue;
+            }
+            mcp4802_write(spi, ch, wave_pool[w.offset + w.pos]);
+            if (++w.pos < w.length) {
+                continue;
+            }
+            // loop, switching table if one is waiting
+            w.pos = 0;
+            if (w.swap) {
+                w.offset = w.next_offset;
+                w.length = w.next_length;
+                w.swap   = false;
+            }
+        }
+    }
+    spi_bus_busy = busy;
+}
+
+// waveform sample upload
+static void wave_load_sample(uint32_t value) {
+    if (wave_arg_offset < WAVE_POOL) {
+        wave_pool[wave_arg_offset] = uint16_t(value) & 0xfff;
+    }
+    ++wave_arg_offset;
+    if (--wave_arg_count) {
+        read_hex_arg(3, wave_load_sample);
+    }
+}
+
+// waveform upload sample count
+static void wave_load_count(uint32_t value) {
+    wave_arg_count = uint16_t(value);
+    if (wave_arg_count) {
+        read_hex_arg(3, wave_load_sample);
+    }
+}
+
+// waveform upload pool offset
+static void wave_load_offset(uint32_t value) {
+    wave_arg_offset = uint16_t(value);
+    read_hex_arg(4, wave_load_count);
+}
+
+// waveform table length, select the table for the channel
+static void wave_select_length(uint32_t value) {
+    uint16_t offset = wave_arg_offset;
+    uint16_t length = uint16_t(value);
+    if (offset >= WAVE_POOL || length > WAVE_POOL - offset) {
+        length = 0;
+    }
+    wave_channel_t &w = wave_ch[wave_arg_channel];
+    if (wave_running && w.length) {
+        // switch at the end of the current loop to avoid a glitch
+        w.next_offset = offset;
+        w.next_length = length;
+        w.swap        = true;
+    }
+    else {
+        w.offset = offset;
+        w.length = length;
+        w.pos    = 0;
+        w.swap   = false;
+    }
+}
+
+// waveform table offset
+static void wave_select_offset(uint32_t value) {
+    wave_arg_offset = uint16_t(value);
+    read_hex_arg(4, wave_select_length);
+}
+
+// waveform table channel
+static void wave_select_channel(uint32_t value) {
+    wave_arg_channel = uint8_t(value) & 1;
+    read_hex_arg(4, wave_select_offset);
+}
+
+// waveform sample period, start or stop playback
+static void wave_period(uint32_t value) {
+    wave_stop();
+    if (value) {
+        spi_get();
+        pin_drive(wave_cs, 1);
+        wave_running = true;
+        wave_ticker.attach_us(on_wave_tick, value);
+    }
+}
+
+// waveform DAC chip select pin
+static void wave_chip_select(uint8_t pin) {
+    wave_cs = pin;
+    read_hex_arg(8, wave_period);
+}
+
+// waveform operation state
+static void state_wave_op(const char dat) {
+    switch (dat) {
+    case 'T': read_hex_arg(4, wave_load_offset);    break;
+    case 'C': read_hex_arg(1, wave_select_channel); break;
+    case 'S': read_pin_arg(wave_chip_select);       break;
+    default:
+        state_handler = state_default;
+    }
+}
+#endif  // FEATURE_WAVE
+
+// I2C transaction ready, perform it and reply with the status and data
+// status 0 is success, 1 the write was not acknowledged, 2 the read was not
+static void i2c_run(void) {
+    I2C *bus = i2c_get();
+    const int addr = int(i2c_addr) << 1;
+    uint8_t status = 0;
+    // an empty transaction probes for a device acknowledging its address
+    if (!i2c_wlen && !i2c_rlen) {
+        status = (bus->write(addr, NULL, 0) != 0) ? 1 : 0;
+    }
+    if (i2c_wlen) {
+        // use a repeated start when a read follows
+        if (bus->write(addr, (const char*)cmd_buf.i2c, i2c_wlen, i2c_rlen != 0) != 0) {
+            status = 1;
+        }
+    }
+    if (i2c_rlen && status == 0) {
+        if (bus->read(addr, (char*)cmd_buf.i2c, i2c_rlen) != 0) {
+            status = 2;
+        }
+    }
+    tx_putc(nibble_to_hex(status));
+    for (uint8_t i = 0; i < i2c_rlen; ++i) {
+        put_hex8(status ? 0 : cmd_buf.i2c[i]);
+    }
+}
+
+// I2C write data byte
+static void i2c_write_byte(uint32_t value) {
+    cmd_buf.i2c[i2c_pos++] = uint8_t(value);
+    if (i2c_pos < i2c_wlen) {
+        read_hex_arg(2, i2c_write_byte);
+    }
+    else {
+        i2c_run();
+    }
+}
+
+// I2C read length
+static void i2c_read_length(uint32_t value) {
+    i2c_rlen = uint8_t(value);
+    i2c_pos  = 0;
+    if (i2c_wlen) {
+        read_hex_arg(2, i2c_write_byte);
+    }
+    else {
+        i2c_run();
+    }
+}
+
+// I2C write length
+static void i2c_write_length(uint32_t value) {
+    i2c_wlen = uint8_t(value);
+    read_hex_arg(2, i2c_read_length);
+}
+
+// I2C 7bit slave address
+static void i2c_address(uint32_t value) {
+    i2c_addr = uint8_t(value) & 0x7f;
+    read_hex_arg(2, i2c_write_length);
+}
+
+// I2C clock frequency in Hz
+static void i2c_config_frequency(uint32_t value) {
+    if (value) {
+        i2c_frequency = value;
+        i2c_get()->frequency(i2c_frequency);
+    }
+}
+
+// I2C operation state
+static void state_i2c_op(const char dat) {
+    switch (dat) {
+    case 'X': read_hex_arg(2, i2c_address);          break;
+    case 'F': read_hex_arg(8, i2c_config_frequency); break;
+    default:
+        state_handler = state_default;
+    }
+}
+
+#if FEATURE_UART
+// USART2 receive interrupt, move data into its ring buffer
+static void on_uart_rx(void) {
+    while (uart && uart->readable()) {
+        const uint8_t  dat  = uart->getc();
+        const uint16_t next = (uart_rx_head + 1) % UART_SIZE;
+        if (uart_rx_head == uart_rx_tail) {
+            uart_rx_stamp = us_ticker_read();
+        }
+        // drop data on overflow
+        if (next != uart_rx_tail) {
+            uart_rx_buffer[uart_rx_head] = dat;
+            uart_rx_head = next;
+        }
+    }
+}
+
+// number of bytes waiting in the USART2 receive buffer
+static uint16_t uart_rx_count(void) {
+    return (uart_rx_head + UART_SIZE - uart_rx_tail) % UART_SIZE;
+}
+
+// send as much buffered data as USART2 will currently accept
+static void uart_tx_drain(void) {
+    while (uart && uart_tx_tail != uart_tx_head && uart->writeable()) {
+        uart->putc(uart_tx_buffer[uart_tx_tail]);
+        uart_tx_tail = (uart_tx_tail + 1) % UART_SIZE;
+    }
+}
+
+// forward USART2 data in both directions
+static void uart_service(void) {
+    if (!uart) {
+        return;
+    }
+    uart_tx_drain();
+    // batch received data into frames, sending small frames only while the
+    // link to the host is otherwise idle so throughput adapts to the load
+    const uint16_t count = uart_rx_count();
+    if (count == 0) {
+        return;
+    }
+    if (count < UART_FRAME && tx_head != tx_tail) {
+        return;
+    }
+    uint8_t data[UART_FRAME];
+    uint8_t len = 0;
+    while (len < UART_FRAME && uart_rx_tail != uart_rx_head) {
+        data[len++] = uart_rx_buffer[uart_rx_tail];
+        uart_rx_tail = (uart_rx_tail + 1) % UART_SIZE;
+    }
+    event_send('X', data, len, uart_rx_stamp);
+}
+
+// USART2 write data byte
+static void uart_write_byte(uint32_t value) {
+    // data for a closed bridge is consumed and discarded
+    if (uart) {
+        const uint16_t next = (uart_tx_head + 1) % UART_SIZE;
+        // wait for space, the serial rx buffer holds anything sent meanwhile
+        while (next == uart_tx_tail) {
+            uart_tx_drain();
+        }
+        uart_tx_buffer[uart_tx_head] = uint8_t(value);
+        uart_tx_head = next;
+    }
+    if (--uart_wlen) {
+        read_hex_arg(2, uart_write_byte);
+    }
+    else {
+        tx_putc('K');
+    }
+}
+
+// USART2 write length
+static void uart_write_length(uint32_t value) {
+    uart_wlen = uint8_t(value);
+    if (uart_wlen) {
+        read_hex_arg(2, uart_write_byte);
+    }
+    else {
+        tx_putc('K');
+    }
+}
+
+// USART2 baud rate, open or close the bridge
+static void uart_baud(uint32_t value) {
+    uart_dispose();
+    if (value) {
+        // claim the pins from the GPIO interface
+        gpio_dispose(14);  // uartPinTx
+        gpio_dispose(15);  // uartPinRx
+        encoder_release(14);
+        encoder_release(15);
+        uart = new RawSerial(uartPinTx, uartPinRx);
+        uart->baud(int(value));
+        uart->attach(on_uart_rx, mbed::SerialBase::RxIrq);
+    }
+}
+
+// USART2 operation state
+static void state_uart_op(const char dat) {
+    switch (dat) {
+    case 'O': read_hex_arg(8, uart_baud);         break;
+    case 'W': read_hex_arg(2, uart_write_length); break;
+    default:
+        state_handler = state_default;
+    }
+}
+#endif  // FEATURE_UART
+
+// quadrature steps indexed by the previous and current A/B levels
+static const int8_t encoderSteps[16] = {
+     0, -1, +1,  0,
+    +1,  0,  0, -1,
+    -1,  0,  0, +1,
+     0, +1, -1,  0,
+};
+
+// encoder edge interrupt
+static void encoder_edge(uint8_t id) {
+    encoder_t &e = encoders[id];
+    const uint8_t phase = uint8_t((e.a->read() << 1) | e.b->read());
+    e.count += encoderSteps[(e.phase << 2) | phase];
+    e.phase  = phase;
+}
+
+template <uint8_t ID>
+static void on_encoder_edge(void) {
+    encoder_edge(ID);
+}
+
+static void (*const encoderIrq[ENCODER_COUNT])(void) = {
+    on_encoder_edge<0>, on_encoder_edge<1>, on_encoder_edge<2>, on_encoder_edge<3>,
+};
+
+// check if TIM3 is decoding an encoder
+static bool encoder_timer_busy(void) {
+    for (uint8_t i = 0; i < ENCODER_COUNT; ++i) {
+        if (encoders[i].timer) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// check if a pin pair is TIM3 channel 1 and 2, see firmware/README.md
+static bool encoder_timer_pins(uint8_t a, uint8_t b) {
+    return (a == 9 && b == 10) ||  // PA6, PA7
+           (a == 25 && b == 8);    // PB4, PB5
+}
+
+// route a pin to TIM3 with its pull up enabled
+static void encoder_timer_pin(uint8_t pin) {
+    const PinName  mpin  = gpPinMap[pin];
+    GPIO_TypeDef  *port  = pin_port(mpin);
+    const uint32_t n     = mpin & 0xf;
+    const uint32_t shift = (n & 7) * 4;
+    port->AFR[n >> 3] = (port->AFR[n >> 3] & ~(0xfu << shift)) | (1u << shift);
+    port->PUPDR       = (port->PUPDR & ~(3u << (n * 2))) | (1u << (n * 2));
+    port->MODER       = (port->MODER & ~(3u << (n * 2))) | (2u << (n * 2));
+}
+
+// decode an encoder in hardware, counting every edge of both inputs
+static void encoder_timer_start(encoder_t &e) {
+    encoder_timer_pin(e.pin_a);
+    encoder_timer_pin(e.pin_b);
+    RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
+    TIM3->CR1   = 0;
+    TIM3->SMCR  = TIM_SMCR_SMS_0 | TIM_SMCR_SMS_1;
+    // both channels on their own input, filtered over 8 clocks
+    TIM3->CCMR1 = TIM_CCMR1_CC1S_0 | TIM_CCMR1_IC1F_0 | TIM_CCMR1_IC1F_1 |
+                  TIM_CCMR1_CC2S_0 | TIM_CCMR1_IC2F_0 | TIM_CCMR1_IC2F_1;
+    TIM3->CCER  = 0;
+    TIM3->PSC   = 0;
+    TIM3->ARR   = 0xffff;
+    TIM3->CNT   = 0;
+    TIM3->CR1   = TIM_CR1_CEN;
+    e.timer     = true;
+    e.timer_cnt = 0;
+}
+
+// decode an encoder from edge interrupts
+// returns false if the pins share an EXTI line with another encoder
+static bool encoder_irq_start(uint8_t id) {
+    encoder_t &e = encoders[id];
+    const uint8_t line_a = gpPinMap[e.pin_a] & 0xf;
+    const uint8_t line_b = gpPinMap[e.pin_b] & 0xf;
+    if (line_a == line_b) {
+        return false;
+    }
+    for (uint8_t i = 0; i < ENCODER_COUNT; ++i) {
+        const encoder_t &o = encoders[i];
+        if (i == id || !o.a) {
+            continue;
+        }
+        const uint8_t la = gpPinMap[o.pin_a] & 0xf;
+        const uint8_t lb = gpPinMap[o.pin_b] & 0xf;
+        if (la == line_a || la == line_b || lb == line_a || lb == line_b) {
+            return false;
+        }
+    }
+    e.a = new InterruptIn(gpPinMap[e.pin_a]);
+    e.b = new InterruptIn(gpPinMap[e.pin_b]);
+    e.a->mode(PullUp);
+    e.b->mode(PullUp);
+    e.phase = uint8_t((e.a->read() << 1) | e.b->read());
+    e.a->rise(encoderIrq[id]);
+    e.a->fall(encoderIrq[id]);
+    e.b->rise(encoderIrq[id]);
+    e.b->fall(encoderIrq[id]);
+    return true;
+}
+
+// current count of an encoder
+static int32_t encoder_count(encoder_t &e) {
+    if (e.timer) {
+        // extend the 16bit hardware count, this runs far more often than
+        // it could wrap
+        const uint16_t cnt = uint16_t(TIM3->CNT);
+        e.count    += int16_t(cnt - e.timer_cnt);
+        e.timer_cnt = cnt;
+    }
+    return e.count;
+}
+
+// push encoder counts that have changed to the host
+static void encoder_service(void) {
+    for (uint8_t i = 0; i < ENCODER_COUNT; ++i) {
+        encoder_t &e = encoders[i];
+        if (e.pin_a >= PIN_COUNT) {
+            continue;
+        }
+        const int32_t  count = encoder_count(e);
+        const uint32_t now   = us_ticker_read();
+        if (!e.notify_us || count == e.sent || (now - e.sent_at) < e.notify_us) {
+            continue;
+        }
+        // <id:2> <count:8>
+        const uint8_t data[5] = {
+            i, uint8_t(count >> 24), uint8_t(count >> 16), uint8_t(count >> 8), uint8_t(count),
+        };
+        event_send('E', data, sizeof(data), now);
+        e.sent    = count;
+        e.sent_at = now;
+    }
+}
+
+// encoder B pin, open the encoder and reply with the status
+static void encoder_open_b(uint8_t pin) {
+    encoder_dispose(encoder_id);
+    bool ok = false;
+    if (encoder_pin_a < PIN_COUNT && pin < PIN_COUNT && encoder_pin_a != pin) {
+        pin_claim(encoder_pin_a);
+        pin_claim(pin);
+        encoder_t &e = encoders[encoder_id];
+        e.pin_a = encoder_pin_a;
+        e.pin_b = pin;
+        e.count = 0;
+        e.sent  = 0;
+        if (encoder_timer_pins(e.pin_a, e.pin_b) && !encoder_timer_busy()) {
+            encoder_timer_start(e);
+            ok = true;
+        }
+        else {
+            ok = encoder_irq_start(encoder_id);
+        }
+        if (!ok) {
+            encoder_dispose(encoder_id);
+        }
+    }
+    tx_putc(ok ? '0' : '1');
+}
+
+// encoder A pin
+static void encoder_open_a(uint8_t pin) {
+    encoder_pin_a = pin;
+    read_pin_arg(encoder_open_b);
+}
+
+// encoder id to open
+static void encoder_open_id(uint32_t value) {
+    encoder_id = uint8_t(value) % ENCODER_COUNT;
+    read_pin_arg(encoder_open_a);
+}
+
+// encoder id to read, reply with its count
+static void encoder_read_id(uint32_t value) {
+    encoder_t &e = encoders[value % ENCODER_COUNT];
+    const uint32_t stamp = us_ticker_read();
+    // <count:8> [<stamp:8>]
+    put_hex32(uint32_t(encoder_count(e)));
+    put_stamp(stamp);
+}
+
+// encoder id to zero
+static void encoder_zero_id(uint32_t value) {
+    encoder_t &e = encoders[value % ENCODER_COUNT];
+    encoder_count(e);
+    __disable_irq();
+    e.count = 0;
+    __enable_irq();
+    e.sent = 0;
+}
+
+// encoder push interval in milliseconds, zero to stop pushing
+static void encoder_notify_interval(uint32_t value) {
+    encoder_t &e = encoders[encoder_id];
+    e.notify_us = value * 1000;
+    e.sent      = encoder_count(e);
+}
+
+// encoder id to push
+static void encoder_notify_id(uint32_t value) {
+    encoder_id = uint8_t(value) % ENCODER_COUNT;
+    read_hex_arg(4, encoder_notify_interval);
+}
+
+// encoder operation state
+static void state_encoder_op(const char dat) {
+    switch (dat) {
+    case 'O': read_hex_arg(1, encoder_open_id);   break;
+    case 'R': read_hex_arg(1, encoder_read_id);   break;
+    case 'Z': read_hex_arg(1, encoder_zero_id);   break;
+    case 'N': read_hex_arg(1, encoder_notify_id); break;
+    default:
+        state_handler = state_default;
+    }
+}
+
+#if FEATURE_KEYS
+// key ticker interrupt, scanning is done from the main loop
+static void on_key_tick(void) {
+    ++key_pending;
+}
+
+// run the key ticker while anything needs scanning
+static void key_ticker_update(void) {
+    bool active = keypad_rows != 0;
+    for (uint8_t i = 0; i < PIN_COUNT; ++i) {
+        active = active || key_input[i].time;
+    }
+    key_ticker.detach();
+    key_pending = 0;
+    if (active) {
+        key_ticker.attach_us(on_key_tick, 1000);
+    }
+}
+
+// feed a sample to a debouncer
+// returns true when the stable level changes
+static bool debounce(debounce_t &d, bool level, uint32_t elapsed) {
+    if (level == d.stable) {
+        d.count = 0;
+        return false;
+    }
+    const uint32_t count = d.count + elapsed;
+    if (count < d.time) {
+        d.count = uint8_t(count);
+        return false;
+    }
+    d.count  = 0;
+    d.stable = level;
+    return true;
+}
+
+// sample the keypad matrix, driving one column low at a time and reading
+// the pulled up rows, other columns are left floating so that pressing
+// several keys can not short two driven columns together
+static void keypad_scan(uint32_t elapsed) {
+    for (uint8_t c = 0; c < keypad_cols; ++c) {
+        DigitalInOut *col = gpio_get(keypad_pin[KEYPAD_LINES + c]);
+        col->output();
+        col->write(0);
+        for (uint8_t r = 0; r < keypad_rows; ++r) {
+            const bool down = gpio_get(keypad_pin[r])->read() == 0;
+            const uint8_t key = r * keypad_cols + c;
+            if (debounce(keypad_key[key], down, elapsed)) {
+                // <key:2> <down:2>
+                const uint8_t data[2] = { key, uint8_t(down) };
+                event_send('K', data, sizeof(data), us_ticker_read());
+            }
+        }
+        col->input();
+    }
+}
+
+// sample debounced inputs and scan the keypad
+static void key_service(void) {
+    if (!key_pending) {
+        return;
+    }
+    __disable_irq();
+    const uint32_t elapsed = key_pending;
+    key_pending = 0;
+    __enable_irq();
+    for (uint8_t pin = 0; pin < PIN_COUNT; ++pin) {
+        debounce_t &d = key_input[pin];
+        if (d.time && debounce(d, gpio_get(pin)->read() != 0, elapsed)) {
+            // <pin:2> <level:2>
+            const uint8_t data[2] = { pin, uint8_t(d.stable) };
+            event_send('D', data, sizeof(data), us_ticker_read());
+        }
+    }
+    if (keypad_rows) {
+        keypad_scan(elapsed);
+    }
+}
+
+// stop scanning the keypad
+static void keypad_stop(void) {
+    keypad_rows = 0;
+    keypad_cols = 0;
+    key_ticker_update();
+}
+
+// debounce time for an input, zero stops watching it
+static void key_input_time(uint32_t value) {
+    if (key_arg_pin < PIN_COUNT) {
+        debounce_t &d = key_input[key_arg_pin];
+        d.time  = uint8_t(value);
+        d.count = 0;
+        if (d.time) {
+            DigitalInOut *io = gpio_get(key_arg_pin);
+            io->input();
+            d.stable = io->read() != 0;
+        }
+    }
+    key_ticker_update();
+}
+
+// debounced input pin
+static void key_input_pin(uint8_t pin) {
+    key_arg_pin = pin;
+    read_hex_arg(2, key_input_time);
+}
+
+// keypad debounce time, start scanning
+static void keypad_time(uint32_t value) {
+    for (uint8_t i = 0; i < keypad_arg_rows + keypad_arg_cols; ++i) {
+        const uint8_t n = (i < keypad_arg_rows) ? i : KEYPAD_LINES + i - keypad_arg_rows;
+        if (keypad_pin[n] >= PIN_COUNT) {
+            return;
+        }
+    }
+    keypad_rows = keypad_arg_rows;
+    keypad_cols = keypad_arg_cols;
+    for (uint8_t r = 0; r < keypad_rows; ++r) {
+        DigitalInOut *row = gpio_get(keypad_pin[r]);
+        row->input();
+        row->mode(PullUp);
+    }
+    for (uint8_t c = 0; c < keypad_cols; ++c) {
+        gpio_get(keypad_pin[KEYPAD_LINES + c])->input();
+    }
+    for (uint8_t i = 0; i < KEYPAD_LINES * KEYPAD_LINES; ++i) {
+        keypad_key[i].time   = uint8_t(value);
+        keypad_key[i].count  = 0;
+        keypad_key[i].stable = false;
+    }
+    key_ticker_update();
+}
+
+// keypad row or column pin
+static void keypad_line(uint8_t pin) {
+    const uint8_t i = keypad_arg++;
+    keypad_pin[i < keypad_arg_rows ? i : KEYPAD_LINES + i - keypad_arg_rows] = pin;
+    if (keypad_arg < keypad_arg_rows + keypad_arg_cols) {
+        read_pin_arg(keypad_line);
+    }
+    else {
+        read_hex_arg(2, keypad_time);
+    }
+}
+
+// keypad column count
+static void keypad_columns(uint32_t value) {
+    keypad_arg_cols = uint8_t(value);
+    keypad_arg      = 0;
+    if (keypad_arg_rows && keypad_arg_rows <= KEYPAD_LINES &&
+        keypad_arg_cols && keypad_arg_cols <= KEYPAD_LINES) {
+        read_pin_arg(keypad_line);
+    }
+}
+
+// keypad row count, zero rows stops scanning
+static void keypad_row_count(uint32_t value) {
+    // stop scanning while the new layout arrives
+    keypad_stop();
+    keypad_arg_rows = uint8_t(value);
+    if (keypad_arg_rows) {
+        read_hex_arg(1, keypad_columns);
+    }
+}
+
+// key operation state
+static void state_key_op(const char dat) {
+    switch (dat) {
+    case 'D': read_pin_arg(key_input_pin);      break;
+    case 'M': read_hex_arg(1, keypad_row_count); break;
+    default:
+        state_handler = state_default;
+    }
+}
+#endif  // FEATURE_KEYS
+
+// put a value on the data pins of a bus and strobe it into the peripheral
+// the data pins of each port change together with one BSRR write
+static void bus_strobe(const bus_t &b, uint8_t value, uint8_t bits) {
+    GPIO_TypeDef *const ports[3] = { GPIOA, GPIOB, GPIOF };
+    uint32_t bsrr[3] = { 0, 0, 0 };
+    for (uint8_t i = 0; i < bits; ++i) {
+        const PinName  mpin = gpPinMap[b.data[i]];
+        const uint32_t mask = 1u << (mpin & 0xf);
+        const uint8_t  port = (mpin >> 4) > 1 ? 2 : (mpin >> 4);
+        bsrr[port] |= ((value >> i) & 1) ? mask : (mask << 16);
+    }
+    for (uint8_t i = 0; i < 3; ++i) {
+        if (bsrr[i]) {
+            ports[i]->BSRR = bsrr[i];
+        }
+    }
+    const int active = (b.flags & BUS_STROBE_LOW) ? 0 : 1;
+    // address and data setup time before the strobe, strobe width, then
+    // hold time after it, all comfortably over the HD44780 minimums
+    wait_us(1);
+    pin_fast_write(b.strobe, active);
+    wait_us(1);
+    pin_fast_write(b.strobe, !active);
+    wait_us(1);
+}
+
+// write a byte to a bus
+static void bus_byte(const bus_t &b, uint8_t value, uint8_t mode) {
+    if (b.width == 4) {
+        bus_strobe(b, value >> 4, 4);
+        if (!(mode & BUS_NIBBLE)) {
+            bus_strobe(b, value & 0xf, 4);
+        }
+    }
+    else {
+        bus_strobe(b, value, 8);
+    }
+    if (b.delay_us) {
+        wait_us(b.delay_us);
+    }
+}
+
+// bus write data byte
+static void bus_write_byte(uint32_t value) {
+    const bus_t &b = buses[bus_arg_id];
+    if (b.width) {
+        bus_byte(b, uint8_t(value), bus_arg_mode);
+    }
+    if (--bus_arg_len) {
+        read_hex_arg(2, bus_write_byte);
+    }
+    else {
+        tx_putc('K');
+    }
+}
+
+// bus write length
+static void bus_write_length(uint32_t value) {
+    bus_arg_len = uint8_t(value);
+    const bus_t &b = buses[bus_arg_id];
+    if (b.width && b.rs < PIN_COUNT) {
+        pin_fast_write(b.rs, (bus_arg_mode & BUS_RS) ? 1 : 0);
+    }
+    if (bus_arg_len) {
+        read_hex_arg(2, bus_write_byte);
+    }
+    else {
+        tx_putc('K');
+    }
+}
+
+// bus write mode
+static void bus_write_mode(uint32_t value) {
+    bus_arg_mode = uint8_t(value);
+    read_hex_arg(2, bus_write_length);
+}
+
+// bus write id
+static void bus_write_id(uint32_t value) {
+    bus_arg_id = uint8_t(value) % BUS_COUNT;
+    read_hex_arg(1, bus_write_mode);
+}
+
+// make a bus pin an output at its idle level
+static void bus_pin_idle(uint8_t pin, int level) {
+    if (pin < PIN_COUNT) {
+        DigitalInOut *io = gpio_get(pin);
+        io->write(level);
+        io->output();
+    }
+}
+
+// bus data pin, the definition is complete after the last one
+static void bus_define_data(uint8_t pin) {
+    bus_arg.data[bus_arg_pos++] = pin;
+    if (bus_arg_pos < bus_arg.width) {
+        read_pin_arg(bus_define_data);
+        return;
+    }
+    bool valid = bus_arg.strobe < PIN_COUNT;
+    for (uint8_t i = 0; i < bus_arg.width; ++i) {
+        valid = valid && bus_arg.data[i] < PIN_COUNT;
+    }
+    if (!valid) {
+        buses[bus_arg_id].width = 0;
+        return;
+    }
+    buses[bus_arg_id] = bus_arg;
+    bus_pin_idle(bus_arg.strobe, (bus_arg.flags & BUS_STROBE_LOW) ? 1 : 0);
+    bus_pin_idle(bus_arg.rs, 0);
+    bus_pin_idle(bus_arg.rw, 0);
+    for (uint8_t i = 0; i < bus_arg.width; ++i) {
+        bus_pin_idle(bus_arg.data[i], 0);
+    }
+}
+
+// bus delay after each byte
+static void bus_define_delay(uint32_t value) {
+    bus_arg.delay_us = uint16_t(value);
+    bus_arg_pos = 0;
+    if (bus_arg.width) {
+        read_pin_arg(bus_define_data);
+    }
+    else {
+        buses[bus_arg_id].width = 0;
+    }
+}
+
+// bus read/write select pin
+static void bus_define_rw(uint8_t pin) {
+    bus_arg.rw = pin;
+    read_hex_arg(4, bus_define_delay);
+}
+
+// bus register select pin
+static void bus_define_rs(uint8_t pin) {
+    bus_arg.rs = pin;
+    read_pin_arg(bus_define_rw);
+}
+
+// bus strobe pin
+static void bus_define_strobe(uint8_t pin) {
+    bus_arg.strobe = pin;
+    read_pin_arg(bus_define_rs);
+}
+
+// bus flags
+static void bus_define_flags(uint32_t value) {
+    bus_arg.flags = uint8_t(value);
+    read_pin_arg(bus_define_strobe);
+}
+
+// bus width, only 4 and 8 bit buses are supported
+static void bus_define_width(uint32_t value) {
+    bus_arg.width = (value == 4 || value == 8) ? uint8_t(value) : 0;
+    read_hex_arg(1, bus_define_flags);
+}
+
+// bus definition id
+static void bus_define_id(uint32_t value) {
+    bus_arg_id = uint8_t(value) % BUS_COUNT;
+    read_hex_arg(1, bus_define_width);
+}
+
+// parallel bus operation state
+static void state_bus_op(const char dat) {
+    switch (dat) {
+    case 'D': read_hex_arg(1, bus_define_id); break;
+    case 'W': read_hex_arg(1, bus_write_id);  break;
+    default:
+        state_handler = state_default;
+    }
+}
+
+#if FEATURE_SOFTPWM
+// bring the software PWM clock up to date, called with interrupts disabled
+static uint32_t softpwm_now() {
+    const uint16_t cnt = uint16_t(TIM14->CNT);
+    softpwm_time += uint16_t(cnt - softpwm_cnt);
+    softpwm_cnt   = cnt;
+    return softpwm_time;
+}
+
+// TIM14 compare interrupt, drives every edge that is due and schedules the
+// next one.  channels with edges at the same time change together with a
+// single BSRR write per port so they stay phase aligned
+static void on_softpwm_tick() {
+    TIM14->SR = ~TIM_SR_CC1IF;
+    GPIO_TypeDef *const ports[3] = { GPIOA, GPIOB, GPIOF };
+    uint32_t bsrr[3] = { 0, 0, 0 };
+    const uint32_t now = softpwm_now();
+    // wake at least twice per timer wrap to keep the clock extended
+    uint32_t next = now + 0x8000;
+    for (uint8_t i = 0; i < SOFTPWM_COUNT; ++i) {
+        softpwm_t &c = softpwm[i];
+        if (c.pin == 0xff) {
+            continue;
+        }
+        const PinName  mpin = gpPinMap[c.pin];
+        const uint32_t mask = 1u << (mpin & 0xf);
+        const uint8_t  port = (mpin >> 4) > 1 ? 2 : (mpin >> 4);
+        if (c.high) {
+            if (int32_t(c.fall - now) <= 0) {
+                bsrr[port] |= mask << 16;
+                c.high = false;
+            }
+        }
+        else if (int32_t(c.rise - now) <= 0) {
+            // a width change is picked up at the start of a cycle
+            if (c.width) {
+                bsrr[port] |= mask;
+                c.high = true;
+                c.fall = c.rise + c.width;
+            }
+            c.rise += c.period;
+            // skip cycles that were missed rather than bunching them up
+            if (int32_t(c.rise - now) <= 0) {
+                c.rise = now + c.period;
+            }
+        }
+        const uint32_t edge = c.high ? c.fall : c.rise;
+        if (int32_t(edge - next) < 0) {
+            next = edge;
+        }
+    }
+    for (uint8_t i = 0; i < 3; ++i) {
+        if (bsrr[i]) {
+            ports[i]->BSRR = bsrr[i];
+        }
+    }
+    // an edge that is already due is taken on the next timer tick
+    int32_t delta = int32_t(next - softpwm_now());
+    if (delta < 2) {
+        delta = 2;
+    }
+    TIM14->CCR1 = uint16_t(softpwm_cnt + delta);
+}
+
+// start the software PWM timer counting microseconds
+static void softpwm_timer_start() {
+    if (TIM14->CR1 & TIM_CR1_CEN) {
+        return;
+    }
+    RCC->APB1ENR |= RCC_APB1ENR_TIM14EN;
+    TIM14->PSC   = SystemCoreClock / 1000000 - 1;
+    TIM14->ARR   = 0xffff;
+    TIM14->EGR   = TIM_EGR_UG;
+    TIM14->SR    = 0;
+    softpwm_cnt  = uint16_t(TIM14->CNT);
+    TIM14->CCR1  = uint16_t(softpwm_cnt + 2);
+    NVIC_SetVector(TIM14_IRQn, uint32_t(uintptr_t(on_softpwm_tick)));
+    NVIC_EnableIRQ(TIM14_IRQn);
+    TIM14->DIER  = TIM_DIER_CC1IE;
+    TIM14->CR1   = TIM_CR1_CEN;
+}
+
+// software PWM pulse width, the channel is configured once it is known
+static void softpwm_width(uint32_t value) {
+    const uint8_t  pin    = softpwm_arg_pin;
+    const uint32_t period = softpwm_arg_period;
+    if (pin >= PIN_COUNT) {
+        return;
+    }
+    // a stopped, fully off or fully on pin needs no timer
+    if (period == 0 || value == 0 || value >= period) {
+        softpwm_release(pin);
+        DigitalInOut *io = gpio_get(pin);
+        io->write((period && value) ? 1 : 0);
+        io->output();
+        return;
+    }
+    __disable_irq();
+    softpwm_t *c = NULL;
+    for (uint8_t i = 0; i < SOFTPWM_COUNT; ++i) {
+        if (softpwm[i].pin == pin) {
+            c = &softpwm[i];
+        }
+    }
+    if (c && c->period == period) {
+        // keep the phase and change the width from the next cycle
+        c->width = value;
+        __enable_irq();
+        return;
+    }
+    __enable_irq();
+    if (!c) {
+        DigitalInOut *io = gpio_get(pin);
+        io->write(0);
+        io->output();
+        for (uint8_t i = 0; i < SOFTPWM_COUNT && !c; ++i) {
+            if (softpwm[i].pin == 0xff) {
+                c = &softpwm[i];
+            }
+        }
+        if (!c) {
+            return;
+        }
+    }
+    softpwm_timer_start();
+    __disable_irq();
+    const uint32_t now = softpwm_now();
+    // start in phase with any channel sharing the period
+    uint32_t rise = now + 10;
+    for (uint8_t i = 0; i < SOFTPWM_COUNT; ++i) {
+        const softpwm_t &o = softpwm[i];
+        if (&o != c && o.pin != 0xff && o.period == period) {
+            rise = o.rise;
+            break;
+        }
+    }
+    if (c->pin == pin && c->high) {
+        pin_fast_write(pin, 0);
+    }
+    c->high   = false;
+    c->period = period;
+    c->width  = value;
+    c->rise   = rise;
+    c->pin    = pin;
+    __enable_irq();
+}
+
+// software PWM period
+static void softpwm_period(uint32_t value) {
+    softpwm_arg_period = value;
+    read_hex_arg(8, softpwm_width);
+}
+
+// software PWM pin
+static void softpwm_pin(uint8_t pin) {
+    softpwm_arg_pin = pin;
+    read_hex_arg(8, softpwm_period);
+}
+#endif  // FEATURE_SOFTPWM
+
+// send a 12bit value to the host as three hex chars
+static void put_hex12(uint16_t x) {
+    tx_putc(nibble_to_hex((x >> 8) & 0xf));
+    tx_putc(nibble_to_hex((x >> 4) & 0xf));
+    tx_putc(nibble_to_hex((x     ) & 0xf));
+}
+
+// internal ADC channel of a pin, 0xff if it has none
+static uint8_t analog_channel(uint8_t pin) {
+    for (uint8_t i = 0; i < ANALOG_PINS; ++i) {
+        if (analogPins[i].pin == pin) {
+            return analogPins[i].channel;
+        }
+    }
+    return 0xff;
+}
+
+// position of a scanned pin in analog_scan
+static uint8_t analog_slot(uint8_t pin) {
+    uint8_t slot = 0;
+    for (uint8_t i = 0; i < ANALOG_PINS && analogPins[i].pin != pin; ++i) {
+        if (analog_pins & (1u << analogPins[i].pin)) {
+            ++slot;
+        }
+    }
+    return slot;
+}
+
+// single conversion of an internal ADC pin, replies with a status digit
+// (0 converted, 1 not an ADC pin) and the 12bit value
+static void analog_read(uint8_t pin) {
+    const uint32_t stamp = us_ticker_read();
+    uint16_t value = 0;
+    const bool valid = pin < PIN_COUNT && analog_channel(pin) != 0xff;
+    if (valid) {
+        if (analog_pins & (1u << pin)) {
+            // the scan already has a fresh value
+            value = analog_scan[analog_slot(pin)];
+        }
+        else {
+            analog_stop();
+            pin_claim(pin);
+            AnalogIn ain(gpPinMap[pin]);
+            value = ain.read_u16() >> 4;
+        }
+    }
+    tx_putc(valid ? '0' : '1');
+    put_hex12(value);
+    put_stamp(stamp);
+}
+
+// start the internal ADC converting the selected channels continuously,
+// DMA copying each result into analog_scan
+static void analog_start(uint32_t chselr, uint8_t count) {
+    RCC->APB2ENR |= RCC_APB2ENR_ADCEN;
+    RCC->AHBENR  |= RCC_AHBENR_DMAEN;
+    if (!(ADC1->CR & ADC_CR_ADEN)) {
+        // clock the ADC at PCLK/4 and calibrate it before enabling
+        ADC1->CFGR2 = ADC_CFGR2_CKMODE_1;
+        ADC1->CR |= ADC_CR_ADCAL;
+        while (ADC1->CR & ADC_CR_ADCAL) {
+        }
+        ADC1->CR |= ADC_CR_ADEN;
+        while (!(ADC1->ISR & ADC_ISR_ADRDY)) {
+        }
+    }
+    DMA1_Channel1->CCR   = 0;
+    DMA1_Channel1->CPAR  = uint32_t(uintptr_t(&ADC1->DR));
+    DMA1_Channel1->CMAR  = uint32_t(uintptr_t(analog_scan));
+    DMA1_Channel1->CNDTR = count;
+    DMA1_Channel1->CCR   = DMA_CCR_MSIZE_0 | DMA_CCR_PSIZE_0 | DMA_CCR_MINC |
+                           DMA_CCR_CIRC | DMA_CCR_EN;
+    // the longest sample time suits high impedance sources
+    ADC1->SMPR   = ADC_SMPR_SMP;
+    ADC1->CHSELR = chselr;
+    ADC1->CFGR1  = ADC_CFGR1_CONT | ADC_CFGR1_DMAEN | ADC_CFGR1_DMACFG;
+    ADC1->CR    |= ADC_CR_ADSTART;
+}
+
+// internal ADC scan push interval, the scan starts once it is known
+static void analog_scan_interval(uint32_t value) {
+    analog_stop();
+    uint32_t chselr = 0;
+    uint32_t pins   = 0;
+    uint8_t  count  = 0;
+    for (uint8_t i = 0; i < ANALOG_PINS; ++i) {
+        const uint8_t pin = analogPins[i].pin;
+        if (!(analog_arg_pins & (1u << pin))) {
+            continue;
+        }
+        pin_claim(pin);
+        // analog mode
+        const PinName mpin = gpPinMap[pin];
+        GPIO_TypeDef *port = pin_port(mpin);
+        port->MODER |= 3u << ((mpin & 0xf) * 2);
+        chselr |= 1u << analogPins[i].channel;
+        pins   |= 1u << pin;
+        ++count;
+    }
+    if (!count) {
+        return;
+    }
+    for (uint8_t i = 0; i < ANALOG_PINS; ++i) {
+        analog_scan[i] = 0;
+    }
+    analog_start(chselr, count);
+    analog_pins      = pins;
+    analog_notify_us = value * 1000;
+    analog_sent_at   = us_ticker_read();
+}
+
+// internal ADC scan pin mask
+static void analog_scan_pins(uint32_t value) {
+    analog_arg_pins = value;
+    read_hex_arg(4, analog_scan_interval);
+}
+
+// push the latest scanned values to the host at the requested interval
+static void analog_service(void) {
+    if (!analog_pins || !analog_notify_us) {
+        return;
+    }
+    const uint32_t now = us_ticker_read();
+    if ((now - analog_sent_at) < analog_notify_us) {
+        return;
+    }
+    // <value:4> per scanned pin, in channel order
+    uint8_t data[ANALOG_PINS * 2];
+    uint8_t len = 0;
+    for (uint8_t i = 0; i < ANALOG_PINS; ++i) {
+        if (analog_pins & (1u << analogPins[i].pin)) {
+            const uint16_t value = analog_scan[len / 2];
+            data[len++] = uint8_t(value >> 8);
+            data[len++] = uint8_t(value);
+        }
+    }
+    event_send('A', data, len, now);
+    analog_sent_at = now;
+}
+
+// internal ADC operation state
+static void state_analog_op(const char dat) {
+    switch (dat) {
+    case 'R': read_pin_arg(analog_read);         break;
+    case 'S': read_hex_arg(8, analog_scan_pins); break;
+    default:
+        state_handler = state_default;
+    }
+}
+
+// read an input pin straight from its port
+static int pin_fast_read(uint8_t pin) {
+    const PinName mpin = gpPinMap[pin];
+    return (pin_port(mpin)->IDR >> (mpin & 0xf)) & 1;
+}
+
+// pulse a shift register latch away from its idle level and back
+static void shift_latch(uint8_t pin, int idle) {
+    if (pin < PIN_COUNT) {
+        pin_fast_write(pin, !idle);
+        wait_us(1);
+        pin_fast_write(pin, idle);
+    }
+}
+
+// clock a byte out to a 74HC595 class chain, data changes while the clock
+// is low and is taken on the rising edge
+static void shift_out_byte(uint32_t value) {
+    for (uint8_t i = 0; shift_arg_clock < PIN_COUNT && i < 8; ++i) {
+        const uint8_t bit = (shift_arg_flags & SHIFT_MSB_FIRST) ? (7 - i) : i;
+        pin_fast_write(shift_arg_data, (value >> bit) & 1);
+        pin_fast_write(shift_arg_clock, 1);
+        pin_fast_write(shift_arg_clock, 0);
+    }
+    if (--shift_arg_len) {
+        read_hex_arg(2, shift_out_byte);
+    }
+    else {
+        // the storage register takes the chain on the rising latch edge
+        shift_latch(shift_arg_latch, 0);
+        tx_putc('K');
+    }
+}
+
+// clock a byte in from a 74HC165 class chain, whose first bit is already
+// on its output after the parallel load
+static uint8_t shift_in_byte() {
+    uint8_t value = 0;
+    for (uint8_t i = 0; i < 8; ++i) {
+        const uint8_t bit = (shift_arg_flags & SHIFT_MSB_FIRST) ? (7 - i) : i;
+        if (shift_arg_flags & SHIFT_CLOCK_SAMPLE) {
+            pin_fast_write(shift_arg_clock, 1);
+            value |= pin_fast_read(shift_arg_data) << bit;
+            pin_fast_write(shift_arg_clock, 0);
+        }
+        else {
+            value |= pin_fast_read(shift_arg_data) << bit;
+            pin_fast_write(shift_arg_clock, 1);
+            pin_fast_write(shift_arg_clock, 0);
+        }
+    }
+    return value;
+}
+
+// shift transfer length, the transfer starts once it is known
+static void shift_length(uint32_t value) {
+    shift_arg_len = uint8_t(value);
+    if (shift_arg_op == 'O') {
+        if (shift_arg_len) {
+            read_hex_arg(2, shift_out_byte);
+        }
+        else {
+            shift_latch(shift_arg_latch, 0);
+            tx_putc('K');
+        }
+        return;
+    }
+    // the parallel load is active low
+    shift_latch(shift_arg_latch, 1);
+    for (uint8_t i = 0; i < shift_arg_len; ++i) {
+        put_hex8((shift_arg_clock < PIN_COUNT) ? shift_in_byte() : 0);
+    }
+}
+
+// shift transfer flags
+static void shift_flags(uint32_t value) {
+    shift_arg_flags = uint8_t(value);
+    read_hex_arg(2, shift_length);
+}
+
+// make a shift register pin an output at its idle level
+static void shift_pin_output(uint8_t pin, int level) {
+    if (pin < PIN_COUNT) {
+        DigitalInOut *io = gpio_get(pin);
+        io->write(level);
+        io->output();
+    }
+}
+
+// shift latch pin, the pins are set up once all are known
+static void shift_latch_pin(uint8_t pin) {
+    shift_arg_latch = pin;
+    if (shift_arg_data < PIN_COUNT && shift_arg_clock < PIN_COUNT) {
+        if (shift_arg_op == 'O') {
+            shift_pin_output(shift_arg_data, 0);
+            shift_pin_output(shift_arg_latch, 0);
+        }
+        else {
+            gpio_get(shift_arg_data)->input();
+            shift_pin_output(shift_arg_latch, 1);
+        }
+        shift_pin_output(shift_arg_clock, 0);
+    }
+    else {
+        // still swallow the data bytes of a bad transfer but touch no pins
+        shift_arg_clock = shift_arg_latch = 0xff;
+    }
+    read_hex_arg(1, shift_flags);
+}
+
+// shift clock pin
+static void shift_clock_pin(uint8_t pin) {
+    shift_arg_clock = pin;
+    read_pin_arg(shift_latch_pin);
+}
+
+// shift data pin
+static void shift_data_pin(uint8_t pin) {
+    shift_arg_data = pin;
+    read_pin_arg(shift_clock_pin);
+}
+
+// shift register operation state
+static void state_shift_op(const char dat) {
+    switch (dat) {
+    case 'O':
+    case 'I':
+        shift_arg_op = uint8_t(dat);
+        read_pin_arg(shift_data_pin);
+        break;
+    default:
+        state_handler = state_default;
+    }
+}
+
+#if FEATURE_WS2812
+// SPI bytes encoding two WS2812 bits each at 3MHz, a 0 bit is sent as 1000
+// (333ns high) and a 1 bit as 1100 (667ns high), inside both the WS2812 and
+// WS2812B tolerances
+static const uint8_t ws2812_bits[4] = { 0x88, 0x8C, 0xC8, 0xCC };
+
+// clock the buffered pixels out of the SPI MOSI pin
+static void ws2812_show() {
+    SPI *spi = spi_get();
+    spi->format(8, 0);
+    spi->frequency(3000000);
+    // a gap of more than a few microseconds inside the stream would be seen
+    // as a reset, so the SPI FIFO is fed with interrupts off.  they are only
+    // held off for one LED, 24 bits or 32us, and pending interrupts run
+    // between LEDs while the FIFO still holds about 5us of bits, so serial
+    // data and the timer interrupts are not lost during a long string
+    for (uint16_t i = 0; i < ws2812_arg_len; i += 3) {
+        __disable_irq();
+        for (uint16_t j = i; j < i + 3 && j < ws2812_arg_len; ++j) {
+            const uint8_t value = cmd_buf.ws2812[j];
+            for (int8_t shift = 6; shift >= 0; shift -= 2) {
+                while (!(SPI1->SR & SPI_SR_TXE)) {
+                }
+                // byte access so the data register packs a single frame
+                *(__IO uint8_t*)&SPI1->DR = ws2812_bits[(value >> shift) & 3];
+            }
+        }
+        __enable_irq();
+    }
+    while (SPI1->SR & SPI_SR_BSY) {
+    }
+    // MOSI idles low after the last bit, hold it for the latch time
+    wait_us(300);
+    spi->format(8, spi_mode);
+    spi->frequency(spi_frequency);
+    tx_putc('K');
+}
+
+// WS2812 pixel data byte
+static void ws2812_byte(uint32_t value) {
+    if (ws2812_arg_pos < sizeof(cmd_buf.ws2812)) {
+        cmd_buf.ws2812[ws2812_arg_pos] = uint8_t(value);
+    }
+    if (++ws2812_arg_pos < ws2812_arg_len) {
+        read_hex_arg(2, ws2812_byte);
+    }
+    else {
+        if (ws2812_arg_len > sizeof(cmd_buf.ws2812)) {
+            ws2812_arg_len = sizeof(cmd_buf.ws2812);
+        }
+        ws2812_show();
+    }
+}
+
+// WS2812 pixel data length in bytes
+static void ws2812_length(uint32_t value) {
+    ws2812_arg_len = uint16_t(value);
+    ws2812_arg_pos = 0;
+    if (ws2812_arg_len) {
+        read_hex_arg(2, ws2812_byte);
+    }
+    else {
+        tx_putc('K');
+    }
+}
+#endif  // FEATURE_WS2812
+
+// set the direction of a 1-Wire pin, the output level is always low so the
+// bus is pulled low by an output and released by an input
+static void onewire_drive(uint8_t pin, bool low) {
+    const PinName mpin = gpPinMap[pin];
+    GPIO_TypeDef *port = pin_port(mpin);
+    const uint32_t n = mpin & 0xf;
+    port->BSRR  = (1u << n) << 16;
+    port->MODER = (port->MODER & ~(3u << (n * 2))) | ((low ? 1u : 0u) << (n * 2));
+}
+
+// drive a 1-Wire bus high to power parasitic devices until the next operation
+static void onewire_power(uint8_t pin) {
+    const PinName mpin = gpPinMap[pin];
+    GPIO_TypeDef *port = pin_port(mpin);
+    const uint32_t n = mpin & 0xf;
+    port->BSRR  = 1u << n;
+    port->MODER = (port->MODER & ~(3u << (n * 2))) | (1u << (n * 2));
+}
+
+// take a pin for use as a 1-Wire bus, released and relying on an external pull up
+static void onewire_claim(uint8_t pin) {
+    gpio_get(pin)->input();
+}
+
+// send a reset pulse, returning true if a device answered with a presence pulse
+// interrupts stay on, a serial byte arrives every 43us and the USART holds
+// only one, so the bus is polled for the 60us or longer presence pulse
+static bool onewire_reset(uint8_t pin) {
+    onewire_drive(pin, true);
+    wait_us(480);
+    onewire_drive(pin, false);
+    const uint32_t start = us_ticker_read();
+    // devices wait 15us to 60us before pulling the bus low
+    wait_us(15);
+    bool present = false;
+    while (us_ticker_read() - start < 240) {
+        present = present || !pin_fast_read(pin);
+    }
+    wait_us(240);
+    return present;
+}
+
+// a single read or write time slot, a write of 1 is the same as a read
+static int onewire_slot(uint8_t pin, int bit) {
+    if (bit) {
+        // the release and sample must fall within 15us of the falling edge
+        __disable_irq();
+        onewire_drive(pin, true);
+        wait_us(6);
+        onewire_drive(pin, false);
+        wait_us(9);
+        bit = pin_fast_read(pin);
+        __enable_irq();
+        wait_us(55);
+    }
+    else {
+        // a 0 may be held low for up to 120us, leaving room for interrupts
+        onewire_drive(pin, true);
+        wait_us(60);
+        onewire_drive(pin, false);
+        wait_us(10);
+    }
+    return bit;
+}
+
+// write a byte, least significant bit first
+static void onewire_write(uint8_t pin, uint8_t value) {
+    for (uint8_t i = 0; i < 8; ++i) {
+        onewire_slot(pin, (value >> i) & 1);
+    }
+}
+
+// read a byte, least significant bit first
+static uint8_t onewire_read(uint8_t pin) {
+    uint8_t value = 0;
+    for (uint8_t i = 0; i < 8; ++i) {
+        value |= onewire_slot(pin, 1) << i;
+    }
+    return value;
+}
+
+// find every device on a bus and send their ROM codes to the host as they
+// are found, follows the search algorithm of Maxim application note 187
+static void onewire_search(uint8_t pin) {
+    uint8_t count = 0;
+    uint8_t rom[8] = { 0 };
+    int last_discrepancy = -1;
+    bool done = false;
+    while (!done && count < ONEWIRE_MAX) {
+        if (!onewire_reset(pin)) {
+            break;
+        }
+        onewire_write(pin, 0xF0);
+        int discrepancy = -1;
+        for (int bit = 0; bit < 64; ++bit) {
+            const int id  = onewire_slot(pin, 1);
+            const int cmp = onewire_slot(pin, 1);
+            if (id && cmp) {
+                // nothing answered, the bus changed during the search
+                done = true;
+                break;
+            }
+            int dir;
+            if (id != cmp) {
+                dir = id;
+            }
+            else {
+                // devices disagree on this bit
+                dir = (bit < last_discrepancy) ? ((rom[bit >> 3] >> (bit & 7)) & 1) :
+                                                 (bit == last_discrepancy);
+                if (!dir) {
+                    discrepancy = bit;
+                }
+            }
+            rom[bit >> 3] = (rom[bit >> 3] & ~(1 << (bit & 7))) | (dir << (bit & 7));
+            onewire_slot(pin, dir);
+        }
+        if (done) {
+            break;
+        }
+        for (uint8_t i = 0; i < 8; ++i) {
+            put_hex8(rom[i]);
+        }
+        ++count;
+        last_discrepancy = discrepancy;
+        done = discrepancy < 0;
+    }
+    tx_putc('-');
+}
+
+// write the buffered data to the bus then reply, the host waits for the
+// reply before it sends more so the receive buffer can not overflow
+static void onewire_write_data(uint8_t pin) {
+    if (pin < PIN_COUNT) {
+        for (uint8_t i = 0; i < onewire_arg_len; ++i) {
+            onewire_write(pin, cmd_buf.onewire[i]);
+        }
+        if (onewire_arg_flags & ONEWIRE_POWER) {
+            onewire_power(pin);
+        }
+    }
+    tx_putc('K');
+}
+
+// 1-Wire write data byte, the bus is only used once every byte has arrived
+static void onewire_write_byte(uint32_t value) {
+    cmd_buf.onewire[onewire_arg_pos] = uint8_t(value);
+    if (++onewire_arg_pos < onewire_arg_len) {
+        read_hex_arg(2, onewire_write_byte);
+        return;
+    }
+    onewire_write_data(onewire_arg_pin);
+}
+
+// read the scratchpad of each queried device with match ROM, or send FF
+// bytes for one that did not answer or did not fit in the buffer
+static void onewire_query(uint8_t pin) {
+    for (uint16_t n = 0; n < onewire_arg_len; ++n) {
+        const uint16_t offset = n * 8;
+        if (pin < PIN_COUNT && offset + 8u <= sizeof(cmd_buf.onewire) && onewire_reset(pin)) {
+            onewire_write(pin, 0x55);
+            for (uint8_t i = 0; i < 8; ++i) {
+                onewire_write(pin, cmd_buf.onewire[offset + i]);
+            }
+            onewire_write(pin, 0xBE);
+            for (uint8_t i = 0; i < 9; ++i) {
+                put_hex8(onewire_read(pin));
+            }
+        }
+        else {
+            for (uint8_t i = 0; i < 9; ++i) {
+                put_hex8(0xff);
+            }
+        }
+    }
+}
+
+// 1-Wire ROM code byte of a scratchpad query, the bus is only used once
+// every code has arrived so none are received during bus I/O
+static void onewire_rom_byte(uint32_t value) {
+    if (onewire_arg_pos < sizeof(cmd_buf.onewire)) {
+        cmd_buf.onewire[onewire_arg_pos] = uint8_t(value);
+    }
+    if (++onewire_arg_pos < onewire_arg_len * 8) {
+        read_hex_arg(2, onewire_rom_byte);
+        return;
+    }
+    onewire_query(onewire_arg_pin);
+}
+
+// 1-Wire byte or device count, the operation starts once it is known
+static void onewire_length(uint32_t value) {
+    onewire_arg_len = uint8_t(value);
+    const uint8_t pin = onewire_arg_pin;
+    switch (onewire_arg_op) {
+    case 'W':
+        if (onewire_arg_len) {
+            onewire_arg_pos = 0;
+            read_hex_arg(2, onewire_write_byte);
+        }
+        else {
+            onewire_write_data(pin);
+        }
+        break;
+    case 'I':
+        for (uint8_t i = 0; i < onewire_arg_len; ++i) {
+            put_hex8(pin < PIN_COUNT ? onewire_read(pin) : 0xff);
+        }
+        break;
+    case 'Q':
+        if (onewire_arg_len) {
+            onewire_arg_pos = 0;
+            read_hex_arg(2, onewire_rom_byte);
+        }
+        break;
+    }
+}
+
+// 1-Wire flags of a write
+static void onewire_write_flags(uint32_t value) {
+    onewire_arg_flags = uint8_t(value);
+    read_hex_arg(2, onewire_length);
+}
+
+// 1-Wire bus pin
+static void onewire_bus_pin(uint8_t pin) {
+    onewire_arg_pin = pin;
+    if (pin < PIN_COUNT) {
+        onewire_claim(pin);
+    }
+    switch (onewire_arg_op) {
+    case 'R':
+        tx_putc((pin < PIN_COUNT && onewire_reset(pin)) ? '0' : '1');
+        break;
+    case 'S':
+        if (pin < PIN_COUNT) {
+            onewire_search(pin);
+        }
+        else {
+            tx_putc('-');
+        }
+        break;
+    case 'W':
+        read_hex_arg(1, onewire_write_flags);
+        break;
+    default:
+        read_hex_arg(2, onewire_length);
+    }
+}
+
+// 1-Wire operation state
+static void state_onewire_op(const char dat) {
+    switch (dat) {
+    case 'R':
+    case 'W':
+    case 'I':
+    case 'S':
+    case 'Q':
+        onewire_arg_op = uint8_t(dat);
+        read_pin_arg(onewire_bus_pin);
+        break;
+    default:
+        state_handler = state_default;
+    }
+}
+
+// run timer driven work and keep the host link moving, called from the
+// main loop and from commands that run for a long time
+static void background_service(void) {
+    tx_drain();
+    adc_service();
+#if FEATURE_WAVE
+    wave_service();
+#endif
+#if FEATURE_UART
+    uart_service();
+#endif
+    encoder_service();
+#if FEATURE_KEYS
+    key_service();
+#endif
+    analog_service();
+}
+
+// CRC32 (IEEE 802.3) of one byte, a nibble at a time from a small table
+static uint32_t crc32_byte(uint32_t crc, uint8_t data) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+        0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    crc ^= data;
+    crc = (crc >> 4) ^ table[crc & 0xf];
+    crc = (crc >> 4) ^ table[crc & 0xf];
+    return crc;
+}
+
+// CRC read length, clocks the data in once it is known and replies with
+// its CRC32 as crc:8
+static void crc_length(uint32_t value) {
+    SPI *spi = spi_get();
+    uint32_t crc = 0xffffffff;
+    for (uint32_t i = 0; i < value; ++i) {
+        crc = crc32_byte(crc, uint8_t(spi->write(0xff)));
+        // keep events flowing during long reads
+        if ((i & 0xfff) == 0xfff) {
+            background_service();
+        }
+    }
+    pin_drive(crc_arg_cs, 1);
+    spi_cs_active = false;
+    put_hex32(~crc);
+}
+
+// CRC read header byte, sent to select the data to read
+static void crc_header_byte(uint32_t value) {
+    spi_get()->write(uint8_t(value));
+    if (--crc_arg_len) {
+        read_hex_arg(2, crc_header_byte);
+    }
+    else {
+        read_hex_arg(8, crc_length);
+    }
+}
+
+// CRC read header length
+static void crc_header_length(uint32_t value) {
+    crc_arg_len = uint8_t(value);
+    spi_get();
+    pin_drive(crc_arg_cs, 0);
+    // streamed ADC samples must not be read while the device is selected
+    spi_cs_active = true;
+    if (crc_arg_len) {
+        read_hex_arg(2, crc_header_byte);
+    }
+    else {
+        read_hex_arg(8, crc_length);
+    }
+}
+
+// CRC read chip select
+static void crc_select(uint8_t pin) {
+    crc_arg_cs = pin;
+    read_hex_arg(1, crc_header_length);
+}
+
+// start timing a wait
+static void wait_start(void) {
+    wait_timer.reset();
+    wait_timer.start();
+}
+
+// check if a wait has run for `timeout` microseconds
+static bool wait_expired(uint32_t timeout) {
+    return uint32_t(wait_timer.read_us()) >= timeout;
+}
+
+// reply to a wait with its status and the elapsed time in microseconds
+// status 0 is the condition was met, 1 the wait timed out
+static void wait_reply(bool met) {
+    wait_timer.stop();
+    tx_putc(met ? '0' : '1');
+    put_hex32(uint32_t(wait_timer.read_us()));
+}
+
+// pin wait timeout, watch the pin until it reaches the level
+static void wait_pin_timeout(uint32_t value) {
+    bool met = false;
+    wait_start();
+    if (wait_pin < PIN_COUNT) {
+        DigitalInOut *io = gpio_get(wait_pin);
+        // servicing the SPI bus would take back a pin we are watching
+        const bool service = !is_spi_pin(wait_pin);
+        for (;;) {
+            met = (io->read() != 0) == (wait_level != 0);
+            if (met || wait_expired(value)) {
+                break;
+            }
+            if (service) {
+                background_service();
+            }
+        }
+    }
+    wait_reply(met);
+}
+
+// pin wait level
+static void wait_pin_level(uint32_t value) {
+    wait_level = uint8_t(value);
+    read_hex_arg(8, wait_pin_timeout);
+}
+
+// pin wait pin
+static void wait_pin_select(uint8_t pin) {
+    wait_pin = pin;
+    read_hex_arg(1, wait_pin_level);
+}
+
+// SPI status wait timeout, read the status until the masked value matches
+static void wait_spi_timeout(uint32_t value) {
+    SPI *spi = spi_get();
+    uint8_t status = 0;
+    bool    met    = false;
+    wait_start();
+    for (;;) {
+        pin_drive(wait_pin, 0);
+        spi->write(wait_cmd);
+        status = uint8_t(spi->write(0xff));
+        pin_drive(wait_pin, 1);
+        met = (status & wait_mask) == wait_level;
+        if (met || wait_expired(value)) {
+            break;
+        }
+        background_service();
+    }
+    wait_reply(met);
+    put_hex8(status);
+}
+
+// SPI status wait value
+static void wait_spi_value(uint32_t value) {
+    wait_level = uint8_t(value);
+    read_hex_arg(8, wait_spi_timeout);
+}
+
+// SPI status wait mask
+static void wait_spi_mask(uint32_t value) {
+    wait_mask = uint8_t(value);
+    read_hex_arg(2, wait_spi_value);
+}
+
+// SPI status wait read status command
+static void wait_spi_command(uint32_t value) {
+    wait_cmd = uint8_t(value);
+    read_hex_arg(2, wait_spi_mask);
+}
+
+// SPI status wait chip select pin
+static void wait_spi_select(uint8_t pin) {
+    wait_pin = pin;
+    read_hex_arg(2, wait_spi_command);
+}
+
+// wait operation state
+static void state_wait_op(const char dat) {
+    switch (dat) {
+    case 'P': read_pin_arg(wait_pin_select); break;
+    case 'S': read_pin_arg(wait_spi_select); break;
+    default:
+        state_handler = state_default;
+    }
+}
+
+// route a pin to its timer capture channel and count microseconds
+static void capture_start(const capture_t *c) {
+    const PinName  mpin  = gpPinMap[c->pin];
+    GPIO_TypeDef  *port  = pin_port(mpin);
+    const uint32_t n     = mpin & 0xf;
+    const uint32_t shift = (n & 7) * 4;
+    // select the alternate function, remembering the mode to restore
+    capture_mode = (port->MODER >> (n * 2)) & 3;
+    port->AFR[n >> 3] = (port->AFR[n >> 3] & ~(0xfu << shift)) | (uint32_t(c->af) << shift);
+    port->MODER       = (port->MODER & ~(3u << (n * 2))) | (2u << (n * 2));
+    // enable the timer clock
+    if (c->tim == TIM3) {
+        RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
+    }
+    if (c->tim == TIM16) {
+        RCC->APB2ENR |= RCC_APB2ENR_TIM16EN;
+    }
+    if (c->tim == TIM17) {
+        RCC->APB2ENR |= RCC_APB2ENR_TIM17EN;
+    }
+    // free running 1MHz counter with the channel capturing its own input
+    TIM_TypeDef *t = c->tim;
+    t->CR1 = 0;
+    t->PSC = SystemCoreClock / 1000000 - 1;
+    t->ARR = 0xffff;
+    __IO uint32_t &ccmr = (c->channel < 2) ? t->CCMR1 : t->CCMR2;
+    const uint32_t ccs  = (c->channel & 1) * 8;
+    ccmr    = (ccmr & ~(0xffu << ccs)) | (1u << ccs);
+    t->CCER = TIM_CCER_CC1E << (c->channel * 4);
+    t->EGR  = TIM_EGR_UG;
+    t->SR   = 0;
+    t->CR1  = TIM_CR1_CEN;
+    capture_ovf = 0;
+}
+
+// stop the capture timer and give the pin back to the GPIO interface
+static void capture_stop(const capture_t *c) {
+    c->tim->CR1  = 0;
+    c->tim->CCER = 0;
+    const PinName  mpin = gpPinMap[c->pin];
+    GPIO_TypeDef  *port = pin_port(mpin);
+    const uint32_t n    = mpin & 0xf;
+    port->MODER = (port->MODER & ~(3u << (n * 2))) | (capture_mode << (n * 2));
+}
+
+// start measuring a pin, using a timer capture channel where it has one
+static bool pulse_begin(void) {
+    if (pulse_pin >= PIN_COUNT) {
+        return false;
+    }
+    capture = NULL;
+    for (uint32_t i = 0; i < sizeof(capturePins) / sizeof(capturePins[0]); ++i) {
+        if (capturePins[i].pin == pulse_pin) {
+            capture = &capturePins[i];
+        }
+    }
+    // TIM3 may be busy decoding an encoder
+    if (capture && capture->tim == TIM3 && encoder_timer_busy()) {
+        capture = NULL;
+    }
+    pulse_io = gpio_get(pulse_pin);
+    if (capture) {
+        capture_start(capture);
+    }
+    wait_start();
+    return true;
+}
+
+// convert a pulse measurement time into a board timestamp
+static uint32_t pulse_stamp(uint32_t time) {
+    uint32_t now;
+    if (capture) {
+        TIM_TypeDef   *t   = capture->tim;
+        const uint32_t cnt = t->CNT;
+        now = capture_ovf + cnt;
+        if ((t->SR & TIM_SR_UIF) && cnt < 0x8000) {
+            now += 0x10000;
+        }
+    }
+    else {
+        now = uint32_t(wait_timer.read_us());
+    }
+    return us_ticker_read() - (now - time);
+}
+
+// finish measuring a pin
+static void pulse_end(void) {
+    if (capture) {
+        capture_stop(capture);
+    }
+    wait_timer.stop();
+}
+
+// wait for the pin to rise or fall, timestamping the edge in microseconds
+// timestamps from the capture timer are taken by hardware and are exact,
+// pins without one are polled against the wait timer
+static bool pulse_edge(bool rising, uint32_t timeout, uint32_t *time) {
+    if (!capture) {
+        while ((pulse_io->read() != 0) != rising) {
+            if (wait_expired(timeout)) {
+                return false;
+            }
+        }
+        *time = uint32_t(wait_timer.read_us());
+        return true;
+    }
+    TIM_TypeDef   *t    = capture->tim;
+    __IO uint32_t &ccr  = (&t->CCR1)[capture->channel];
+    const uint32_t ccp  = TIM_CCER_CC1P << (capture->channel * 4);
+    const uint32_t ccif = TIM_SR_CC1IF  << capture->channel;
+    t->CCER = rising ? (t->CCER & ~ccp) : (t->CCER | ccp);
+    // discard anything captured before the polarity was set
+    t->SR = ~(ccif | (TIM_SR_CC1OF << capture->channel));
+    for (;;) {
+        const uint32_t sr = t->SR;
+        if (sr & ccif) {
+            const uint32_t value = ccr;
+            uint32_t ovf = capture_ovf;
+            // the counter wrapped before the edge but was not yet counted
+            if ((sr & TIM_SR_UIF) && value < 0x8000) {
+                ovf += 0x10000;
+            }
+            *time = ovf + value;
+            return true;
+        }
+        if (sr & TIM_SR_UIF) {
+            t->SR = ~TIM_SR_UIF;
+            capture_ovf += 0x10000;
+        }
+        if (wait_expired(timeout)) {
+            return false;
+        }
+    }
+}
+
+// pulse width timeout, measure one pulse with pulseIn semantics
+static void pulse_in_timeout(uint32_t value) {
+    const bool active = pulse_level != 0;
+    uint32_t start = 0;
+    uint32_t end   = 0;
+    bool met = pulse_begin();
+    // let a pulse that is already in progress finish first
+    if (met && (pulse_io->read() != 0) == active) {
+        met = pulse_edge(!active, value, &start);
+    }
+    met = met && pulse_edge( active, value, &start);
+    met = met && pulse_edge(!active, value, &end);
+    const uint32_t stamp = pulse_stamp(start);
+    pulse_end();
+    // <status:1> <width:8> [<stamp:8>]
+    tx_putc(met ? '0' : '1');
+    put_hex32(met ? (end - start) : 0);
+    put_stamp(stamp);
+}
+
+// pulse width level
+static void pulse_in_level(uint32_t value) {
+    pulse_level = uint8_t(value);
+    read_hex_arg(8, pulse_in_timeout);
+}
+
+// pulse width pin
+static void pulse_in_select(uint8_t pin) {
+    pulse_pin = pin;
+    read_hex_arg(1, pulse_in_level);
+}
+
+// frequency timeout, measure whole cycles for up to the gate time
+static void pulse_freq_timeout(uint32_t value) {
+    uint32_t cycles = 0;
+    uint32_t period = 0;
+    uint32_t high   = 0;
+    uint32_t first  = 0;
+    if (pulse_begin() && pulse_edge(true, value, &first)) {
+        uint32_t rise = first;
+        while (period < PULSE_GATE && cycles < 0xffff) {
+            uint32_t fall, next;
+            if (!pulse_edge(false, value, &fall) ||
+                !pulse_edge(true,  value, &next)) {
+                break;
+            }
+            high  += fall - rise;
+            period = next - first;
+            rise   = next;
+            ++cycles;
+        }
+    }
+    const uint32_t stamp = pulse_stamp(first);
+    pulse_end();
+    // <status:1> <cycles:4> <period:8> <high:8> [<stamp:8>]
+    tx_putc(cycles ? '0' : '1');
+    put_hex8(uint8_t(cycles >> 8));
+    put_hex8(uint8_t(cycles));
+    put_hex32(period);
+    put_hex32(high);
+    put_stamp(stamp);
+}
+
+// frequency pin
+static void pulse_freq_select(uint8_t pin) {
+    pulse_pin = pin;
+    read_hex_arg(8, pulse_freq_timeout);
+}
+
+// pulse measurement operation state
+static void state_pulse_op(const char dat) {
+    switch (dat) {
+    case 'P': read_pin_arg(pulse_in_select);   break;
+    case 'F': read_pin_arg(pulse_freq_select); break;
+    default:
+        state_handler = state_default;
+    }
+}
+
+#if FEATURE_MACRO
+#if DEVICE_FLASH
+// end of the firmware image in flash, as later mbed releases define it in
+// FlashIAP.h, found from the symbols the toolchain's linker script places
+#if !defined(FLASHIAP_APP_ROM_END_ADDR)
+#if defined(__ARMCC_VERSION)
+extern uint32_t Load$$LR$$LR_IROM1$$Limit[];
+#define FLASHIAP_APP_ROM_END_ADDR uint32_t(uintptr_t(Load$$LR$$LR_IROM1$$Limit))
+#elif defined(__GNUC__)
+extern uint32_t __etext;
+extern uint32_t __data_start__;
+extern uint32_t __data_end__;
+#define FLASHIAP_APP_ROM_END_ADDR uint32_t( \
+    uintptr_t(&__etext) + uintptr_t(&__data_end__) - uintptr_t(&__data_start__))
+#endif
+#endif
+
+// location of the macro store in the last flash sector, or zero when the
+// firmware image reaches into that sector and it must not be erased
+static uint32_t macro_flash_addr(FlashIAP &flash) {
+    const uint32_t end  = flash.get_flash_start() + flash.get_flash_size();
+    const uint32_t addr = end - flash.get_sector_size(end - 1);
+#if defined(FLASHIAP_APP_ROM_END_ADDR)
+    if (FLASHIAP_APP_ROM_END_ADDR > addr) {
+        return 0;
+    }
+#endif
+    return addr;
+}
+#endif
+
+// restore the macros saved in flash, or clear them if none were saved
+static void macro_load(void) {
+    macros.magic = 0;
+#if DEVICE_FLASH
+    FlashIAP flash;
+    if (flash.init() == 0) {
+        const uint32_t addr = macro_flash_addr(flash);
+        if (addr) {
+            flash.read(&macros, addr, sizeof(macros));
+        }
+        flash.deinit();
+    }
+#endif
+    if (macros.magic != MACRO_MAGIC || macros.used > MACRO_POOL) {
+        memset(&macros, 0, sizeof(macros));
+        macros.magic = MACRO_MAGIC;
+    }
+}
+
+// write the macros to flash so they survive a power cycle
+// returns 0 on success
+static uint8_t macro_save(void) {
+#if DEVICE_FLASH
+    FlashIAP flash;
+    if (flash.init() != 0) {
+        return 1;
+    }
+    const uint32_t addr = macro_flash_addr(flash);
+    if (!addr) {
+        flash.deinit();
+        return 1;
+    }
+    int err = flash.erase(addr, flash.get_sector_size(addr));
+    if (err == 0) {
+        err = flash.program(&macros, addr, sizeof(macros));
+    }
+    flash.deinit();
+    return err ? 1 : 0;
+#else
+    return 1;
+#endif
+}
+
+// remove a macro body from the pool, closing the gap it leaves
+static void macro_remove(uint8_t id) {
+    macro_t &m = macros.table[id];
+    if (m.length) {
+        const uint16_t end = m.offset + m.length;
+        memmove(macros.pool + m.offset, macros.pool + end, macros.used - end);
+        for (uint8_t i = 0; i < MACRO_COUNT; ++i) {
+            if (macros.table[i].offset >= end) {
+                macros.table[i].offset -= m.length;
+            }
+        }
+        macros.used -= m.length;
+    }
+    m.offset = 0;
+    m.length = 0;
+    m.args   = 0;
+}
+
+// macro definition complete, count its arguments and reply with the status
+static void macro_define_end(void) {
+    if (macro_fits) {
+        macro_t &m = macros.table[macro_id];
+        m.length = macro_len;
+        for (uint16_t i = 0; i < m.length; ++i) {
+            const uint8_t dat = macros.pool[m.offset + i];
+            if (dat >= MACRO_ARG && dat < MACRO_ARG + MACRO_ARGS) {
+                const uint8_t n = dat - MACRO_ARG + 1;
+                m.args = (n > m.args) ? n : m.args;
+            }
+        }
+    }
+    tx_putc(macro_fits ? '0' : '1');
+}
+
+// macro body byte
+static void macro_define_byte(uint32_t value) {
+    if (macro_fits) {
+        macros.pool[macros.used++] = uint8_t(value);
+    }
+    if (--macro_len) {
+        read_hex_arg(2, macro_define_byte);
+    }
+    else {
+        if (macro_fits) {
+            macro_len = macros.used - macros.table[macro_id].offset;
+        }
+        macro_define_end();
+    }
+}
+
+// macro body length, replace any existing body if the new one fits in its
+// place, a body that does not fit leaves the old one defined
+static void macro_define_length(uint32_t value) {
+    macro_len = uint16_t(value);
+    if (macro_fits) {
+        const uint16_t free = MACRO_POOL - macros.used + macros.table[macro_id].length;
+        macro_fits = macro_len <= free;
+    }
+    if (macro_fits) {
+        macro_remove(macro_id);
+        macros.table[macro_id].offset = macros.used;
+    }
+    if (macro_len) {
+        read_hex_arg(2, macro_define_byte);
+    }
+    else {
+        macro_define_end();
+    }
+}
+
+// macro definition id
+static void macro_define_id(uint32_t value) {
+    macro_id = uint8_t(value);
+    // a macro can not redefine macros while it is running, the body of an
+    // unknown id is still read so the stream stays in step
+    macro_fits = (macro_id < MACRO_COUNT) && !macro_running;
+    read_hex_arg(4, macro_define_length);
+}
+
+// play a macro body through the state machine, substituting arguments
+static void macro_run(void) {
+    const macro_t &m = macros.table[macro_id];
+    macro_running = true;
+    for (uint16_t i = 0; i < m.length; ++i) {
+        uint8_t dat = macros.pool[m.offset + i];
+        if (dat >= MACRO_ARG && dat < MACRO_ARG + MACRO_ARGS) {
+            dat = uint8_t(macro_arg[dat - MACRO_ARG]);
+        }
+        state_handler(char(dat));
+    }
+    macro_running = false;
+}
+
+// macro trigger byte, collect any arguments then run it
+static void macro_trigger(uint8_t id) {
+    // macros do not nest
+    if (macro_running) {
+        return;
+    }
+    macro_id = id;
+    if (macros.table[id].args) {
+        macro_arg_pos = 0;
+        state_handler = state_macro_arg;
+    }
+    else {
+        macro_run();
+    }
+}
+
+// macro argument state
+static void state_macro_arg(const char dat) {
+    macro_arg[macro_arg_pos++] = dat;
+    if (macro_arg_pos >= macros.table[macro_id].args) {
+        state_handler = state_default;
+        macro_run();
+    }
+}
+
+// macro operation state
+static void state_macro_op(const char dat) {
+    state_handler = state_default;
+    switch (dat) {
+    case 'D':
+        read_hex_arg(1, macro_define_id);
+        break;
+    case 'S':
+        tx_putc(nibble_to_hex(macro_save()));
+        break;
+    case 'C':
+        if (!macro_running) {
+            memset(&macros, 0, sizeof(macros));
+            macros.magic = MACRO_MAGIC;
+        }
+        break;
+    }
+}
+#endif  // FEATURE_MACRO
+
+// enable or disable timestamps, acknowledging so the host knows which
+// replies and events carry them
+static void timestamp_enable(uint32_t value) {
+    timestamps = value != 0;
+    tx_putc('K');
+}
+
+// reset all assumed state
+static void reset() {
+    // reset the latched pin
+    latched_pin = 0;
+    // close all encoders
+    for (uint8_t i = 0; i < ENCODER_COUNT; ++i) {
+        encoder_dispose(i);
+    }
+    // stop the internal ADC scan
+    analog_stop();
+#if FEATURE_SOFTPWM
+    // stop all software PWM channels
+    for (uint8_t i = 0; i < SOFTPWM_COUNT; ++i) {
+        softpwm_release(softpwm[i].pin);
+    }
+#endif
+    // forget parallel bus definitions
+    for (uint8_t i = 0; i < BUS_COUNT; ++i) {
+        buses[i].width = 0;
+    }
+#if FEATURE_KEYS
+    // stop debouncing and keypad scanning
+    for (uint8_t i = 0; i < PIN_COUNT; ++i) {
+        key_input[i].time = 0;
+    }
+    keypad_stop();
+#endif
+    // dispose of all GPIO pin
+    for (int i=0; i<PIN_COUNT; ++i) {
+        gpio_dispose(i);
+    }
+    // stop any streaming and playback
+    adc_stop();
+#if FEATURE_WAVE
+    wave_stop();
+    wave_ch[0].length = 0;
+    wave_ch[1].length = 0;
+#endif
+    // dispose of the SPI interface and restore its defaults
+    spi_dispose();
+    spi_frequency = 1000000;
+    spi_mode      = 0;
+    // dispose of the I2C interface and restore its defaults
+    i2c_dispose();
+    i2c_frequency = 100000;
+    // close the USART2 bridge
+    uart_dispose();
+    spi_cs_active = false;
+    timestamps    = false;
+#if FEATURE_MACRO
+    // macros revert to those saved in flash
+    macro_load();
+#endif
+    // default to root state
+    state_handler = state_default;
+}
+
+// hex argument state
+// accumulate nibbles then hand the value to the continuation
+static void state_hex_arg(const char dat) {
+    arg_value = (arg_value << 4) | (hex_to_nibble(dat) & 0xf);
+    if (--arg_nibbles == 0) {
+        // the continuation may select the next state
+        state_handler = state_default;
+        arg_hex_done(arg_value);
+    }
+}
+
+// pin argument state
+static void state_pin_arg(const char dat) {
+    const uint8_t pin = (dat >= 'a' && dat < ('a' + PIN_COUNT)) ?
+        uint8_t(dat - 'a') : 0xff;
+    // the continuation may select the next state
+    state_handler = state_default;
+    arg_pin_done(pin);
+}
+
+// SPI transaction complete, release chip select unless asked to hold it
+static void spi_txn_end(void) {
+    spi_cs_active = (spi_txn_flags & SPI_TXN_HOLD_CS) != 0;
+    if (!spi_cs_active) {
+        pin_drive(spi_txn_cs, 1);
+    }
+}
+
+// SPI transaction data byte
+static void spi_txn_byte(uint32_t value) {
+    SPI *spi = spi_get();
+    const uint8_t recv = spi->write(uint8_t(value));
+    if (spi_txn_flags & SPI_TXN_REPLY) {
+        put_hex8(recv);
+    }
+    if (--spi_txn_len) {
+        read_hex_arg(2, spi_txn_byte);
+    }
+    else {
+        spi_txn_end();
+    }
+}
+
+// SPI transaction length, assert chip select and start the transfer
+static void spi_txn_length(uint32_t value) {
+    spi_txn_len = uint16_t(value);
+    // bring up the bus before selecting the slave
+    spi_get();
+    pin_drive(spi_txn_cs, 0);
+    spi_cs_active = true;
+    if (spi_txn_len) {
+        read_hex_arg(2, spi_txn_byte);
+    }
+    else {
+        spi_txn_end();
+    }
+}
+
+// SPI transaction flags
+static void spi_txn_flag(uint32_t value) {
+    spi_txn_flags = uint8_t(value);
+    read_hex_arg(4, spi_txn_length);
+}
+
+// SPI mode, apply the new bus configuration
+static void spi_config_mode(uint32_t value) {
+    spi_mode = uint8_t(value) & 0x3;
+    SPI *spi = spi_get();
+    spi->format(8, spi_mode);
+    spi->frequency(spi_frequency);
+}
+
+// SPI clock frequency in Hz
+static void spi_config_frequency(uint32_t value) {
+    if (value) {
+        spi_frequency = value;
+    }
+    read_hex_arg(1, spi_config_mode);
+}
+
+// SPI transaction chip select pin
+static void spi_txn_chip_select(uint8_t pin) {
+    spi_txn_cs = pin;
+    read_hex_arg(1, spi_txn_flag);
+}
+
+static void lcd_run_length(uint32_t value);
+
+// send a command byte to an LCD, chip select must already be asserted
+static void lcd_cmd(SPI *spi, uint8_t cmd) {
+    pin_drive(lcd_dc, 0);
+    spi->write(cmd);
+    pin_drive(lcd_dc, 1);
+}
+
+// send a 16bit big endian value to an LCD
+static void lcd_write16(SPI *spi, uint16_t value) {
+    spi->write(value >> 8);
+    spi->write(value & 0xff);
+}
+
+// set the LCD address window from lcd_rect and start a RAM write
+static void lcd_window(void) {
+    SPI *spi = spi_get();
+    pin_drive(lcd_cs, 0);
+    lcd_cmd(spi, LCD_CASET);
+    lcd_write16(spi, lcd_rect[0]);  // XSTART
+    lcd_write16(spi, lcd_rect[2]);  // XEND
+    lcd_cmd(spi, LCD_RASET);
+    lcd_write16(spi, lcd_rect[1]);  // YSTART
+    lcd_write16(spi, lcd_rect[3]);  // YEND
+    lcd_cmd(spi, LCD_RAMWR);
+    pin_drive(lcd_cs, 1);
+}
+
+// send a run of identical pixels as RAMWR data
+static void lcd_pixels(uint16_t colour, uint32_t count) {
+    SPI *spi = spi_get();
+    pin_drive(lcd_cs, 0);
+    while (count--) {
+        lcd_write16(spi, colour);
+    }
+    pin_drive(lcd_cs, 1);
+}
+
+// LCD fill colour, fill the window and acknowledge
+static void lcd_fill_colour(uint32_t value) {
+    lcd_window();
+    const uint32_t w = uint32_t(lcd_rect[2] - lcd_rect[0]) + 1;
+    const uint32_t h = uint32_t(lcd_rect[3] - lcd_rect[1]) + 1;
+    if (lcd_rect[2] >= lcd_rect[0] && lcd_rect[3] >= lcd_rect[1]) {
+        lcd_pixels(uint16_t(value), w * h);
+    }
+    tx_putc('K');
+}
+
+// LCD window coordinate
+static void lcd_rect_coord(uint32_t value) {
+    lcd_rect[lcd_rect_arg++] = uint16_t(value);
+    if (lcd_rect_arg < 4) {
+        read_hex_arg(4, lcd_rect_coord);
+        return;
+    }
+    if (lcd_op == 'F') {
+        read_hex_arg(4, lcd_fill_colour);
+    }
+    else {
+        lcd_window();
+    }
+}
+
+// LCD RLE run colour, expand the run
+static void lcd_run_colour(uint32_t value) {
+    lcd_pixels(uint16_t(value), uint32_t(lcd_run_len) + 1);
+    if (--lcd_runs) {
+        read_hex_arg(2, lcd_run_length);
+    }
+    else {
+        tx_putc('K');
+    }
+}
+
+// LCD RLE run length (minus one)
+static void lcd_run_length(uint32_t value) {
+    lcd_run_len = uint8_t(value);
+    read_hex_arg(4, lcd_run_colour);
+}
+
+// LCD RLE run count
+static void lcd_run_count(uint32_t value) {
+    lcd_runs = uint8_t(value);
+    if (lcd_runs) {
+        read_hex_arg(2, lcd_run_length);
+    }
+    else {
+        tx_putc('K');
+    }
+}
+
+// LCD data/command pin, start reading the operation arguments
+static void lcd_data_command(uint8_t pin) {
+    lcd_dc = pin;
+    switch (lcd_op) {
+    case 'F':
+    case 'W':
+        lcd_rect_arg = 0;
+        read_hex_arg(4, lcd_rect_coord);
+        break;
+    case 'R':
+        read_hex_arg(2, lcd_run_count);
+        break;
+    }
+}
+
+// LCD chip select pin
+static void lcd_chip_select(uint8_t pin) {
+    lcd_cs = pin;
+    read_pin_arg(lcd_data_command);
+}
+
+// LCD operation state
+static void state_lcd_op(const char dat) {
+    if (dat == 'F' || dat == 'W' || dat == 'R') {
+        lcd_op = dat;
+        read_pin_arg(lcd_chip_select);
+        return;
+    }
+    state_handler = state_default;
+}
+
+// SPI transmit state 2
+// latch second byte and then perform the transfer operation
+static void state_spi_xfer_2(const char dat) {
+    // get the spi object we need
+    SPI *spi = spi_get();
+    if (spi) {
+        // latch spi least significant bit
+        const uint8_t d1 = hex_to_nibble(dat);
+        spi_out |= d1 & 0x0f;
+        // send byte over spi
+        const uint8_t recv = spi->write(spi_out);
+        // send response back to host
+        put_hex8(recv);
+    }
+    // set next state
+    state_handler = state_default;
+}
+
+// SPI transmit state 1
+// latch first byte then wait for the second state
+static void state_spi_xfer_1(const char dat) {
+    // latch spi most significant bit
+    const uint8_t d0 = hex_to_nibble(dat);
+    spi_out = d0 << 4;
+    // set next state
+    state_handler = state_spi_xfer_2;
+}
+
+// default state
+static void state_default(const char dat) {
+    // pin adjustment
+    if (dat >= 'a' && dat < ('a' + PIN_COUNT)) {
+        // latch this pin for later operations
+        latched_pin = uint8_t(dat - 'a');
+        return;
+    }
+    // latched pin adjustment
+    if (dat == '0' || dat == '1' ||
+        dat == 'I' || dat == 'O' ||
+        dat == '?' ||
+        dat == 'U' || dat == 'D' || dat == 'N') {
+        // perform this action
+        dispatch_pin(/*pin=*/latched_pin, /*op=*/dat);
+        // increment the latched pin
+        inc_latched_pin();
+        return;
+    }
+    // SPI operation
+    if (dat == '~') {
+        // enter the spi transfer state
+        state_handler = state_spi_xfer_1;
+        return;
+    }
+    // SPI transaction with chip select handled here
+    if (dat == 'S') {
+        read_pin_arg(spi_txn_chip_select);
+        return;
+    }
+    // SPI bus configuration
+    if (dat == 'F') {
+        read_hex_arg(8, spi_config_frequency);
+        return;
+    }
+    // LCD drawing primitive
+    if (dat == 'L') {
+        state_handler = state_lcd_op;
+        return;
+    }
+    // start or stop streaming SPI ADC samples
+    if (dat == 'Q') {
+        read_pin_arg(adc_chip_select);
+        return;
+    }
+#if FEATURE_WAVE
+    // SPI DAC waveform generator
+    if (dat == 'G') {
+        state_handler = state_wave_op;
+        return;
+    }
+#endif
+    // I2C transaction or configuration
+    if (dat == 'T') {
+        state_handler = state_i2c_op;
+        return;
+    }
+#if FEATURE_UART
+    // USART2 bridge
+    if (dat == 'X') {
+        state_handler = state_uart_op;
+        return;
+    }
+#endif
+    // wait for a pin level or SPI status
+    if (dat == 'W') {
+        state_handler = state_wait_op;
+        return;
+    }
+    // reply with the board time for clock synchronisation
+    if (dat == 'P') {
+        put_hex32(us_ticker_read());
+        return;
+    }
+    // enable or disable timestamps
+    if (dat == '@') {
+        read_hex_arg(1, timestamp_enable);
+        return;
+    }
+    // CRC of data read from an SPI device
+    if (dat == 'C') {
+        read_pin_arg(crc_select);
+        return;
+    }
+    // internal ADC conversions
+    if (dat == 'A') {
+        state_handler = state_analog_op;
+        return;
+    }
+#if FEATURE_SOFTPWM
+    // software PWM and servo pulses
+    if (dat == '%') {
+        read_pin_arg(softpwm_pin);
+        return;
+    }
+#endif
+    // 1-Wire bus master
+    if (dat == 'Z') {
+        state_handler = state_onewire_op;
+        return;
+    }
+#if FEATURE_WS2812
+    // WS2812 pixel data
+    if (dat == 'Y') {
+        read_hex_arg(4, ws2812_length);
+        return;
+    }
+#endif
+    // shift register chains
+    if (dat == 'J') {
+        state_handler = state_shift_op;
+        return;
+    }
+    // parallel bus definition or write
+    if (dat == 'B') {
+        state_handler = state_bus_op;
+        return;
+    }
+#if FEATURE_KEYS
+    // debounced inputs and keypad scanning
+    if (dat == 'K') {
+        state_handler = state_key_op;
+        return;
+    }
+#endif
+    // quadrature encoder
+    if (dat == 'E') {
+        state_handler = state_encoder_op;
+        return;
+    }
+    // measure a pulse width or frequency
+    if (dat == 'H') {
+        state_handler = state_pulse_op;
+        return;
+    }
+#if FEATURE_MACRO
+    // define or store macros
+    if (dat == 'M') {
+        state_handler = state_macro_op;
+        return;
+    }
+#endif
+#if FEATURE_MACRO
+    // run a macro
+    const uint8_t trigger = uint8_t(dat);
+    if (trigger >= MACRO_TRIGGER && trigger < MACRO_TRIGGER + MACRO_COUNT) {
+        macro_trigger(trigger - MACRO_TRIGGER);
+        return;
+    }
+#endif
+}
+
+static bool global_handler(const char dat) {
+    // return version string
+    if (dat == 'V') {
+        tx_puts(VERSION_STR);
+        return true;
+    }
+    // reset state
+    if (dat == 'R') {
+        reset();
+        // send ack
+        tx_puts("OK");
+        return true;
+    }
+    return false;
+}
+
+// serial receive interrupt, move data into the ring buffer
+static void on_serial_rx(void) {
+    while (serialPort.readable()) {
+        const uint8_t  dat  = serialPort.getc();
+        const uint16_t next = (rx_head + 1) % RX_SIZE;
+        // drop data on overflow
+        if (next != rx_tail) {
+            rx_buffer[rx_head] = dat;
+            rx_head = next;
+        }
+    }
+}
+
+// pop a byte from the receive ring buffer
+static bool rx_pop(uint8_t *dat) {
+    if (rx_tail == rx_head) {
+        return false;
+    }
+    *dat = rx_buffer[rx_tail];
+    rx_tail = (rx_tail + 1) % RX_SIZE;
+    return true;
+}
+
+int main() {
+    // reset the GPIO board state
+    reset();
+    // setup the serial port
+    serialPort.baud(BAUD_RATE);
+    serialPort.format(
+        /*     bits=*/8,
+        /*   parity=*/mbed::SerialBase::None,
+        /*stop_bits=*/1);
+    serialPort.attach(on_serial_rx, mbed::SerialBase::RxIrq);
+    tx_puts(READY_STR);
+    // main loop
+    for (;;) {
+        // note that in this design this is the only place that consumes
+        // serial data.  this is important to avoid lockups when waiting
+        // for data in nested code.  by reading in on place we can support
+        // a global hander that can perform resets consistently.  the rx
+        // interrupt only buffers data so that long running commands do not
+        // drop bytes the host has already sent.
+        // run any timer driven work while the bus is free
+        background_service();
+        uint8_t dat;
+        if (!rx_pop(&dat)) {
+            continue;
+        }
+        // commands may clock the SPI bus at any point, keep the ADC ticker
+        // off it until they return
+        spi_bus_busy = true;
+        // allow a global handler to deal with this first
+        if (!global_handler(dat) && state_handler) {
+            // invoke state handler
             state_handler(dat);
         }
+        spi_bus_busy = false;
     }
 }
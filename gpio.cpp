@@ -4,8 +4,14 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <atomic>
 
 #include "gpio.h"
+#include "WiringPiSPI.h"
+#include "WiringPiI2C.h"
+#include "softPwm.h"
 
 #define gpio_debug    0
 #define gpio_no_cache 0
@@ -203,6 +209,15 @@ static uint32_t serial_read(serial_t* serial, void* dst, size_t nbytes) {
   return nb_read;
 }
 
+static uint32_t serial_available(serial_t* serial) {
+  DWORD errors = 0;
+  COMSTAT stat = { 0 };
+  if (ClearCommError(serial->handle, &errors, &stat) == FALSE) {
+    return 0;
+  }
+  return stat.cbInQue;
+}
+
 static void serial_flush(serial_t* serial) {
   FlushFileBuffers(serial->handle);
 }
@@ -215,317 +230,3258 @@ static void serial_flush(serial_t* serial) {
 
 #if !defined(_MSC_VER)
 
-// TODO
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+struct serial_t {
+  int fd;
+};
+
+static bool get_port_name(const char* port, char* out, size_t size) {
+
+  // make out an empty string by default
+  *out = '\0';
+
+  // use a user supplied device name
+  if (port) {
+    snprintf(out, size, "%s", port);
+    return true;
+  }
+
+  // find the first available USB serial adapter
+  static const char *prefix[] = { "/dev/ttyUSB", "/dev/ttyACM" };
+  for (const char *p : prefix) {
+    for (int i = 0; i < 8; ++i) {
+      char temp[32];
+      snprintf(temp, sizeof(temp), "%s%d", p, i);
+      if (access(temp, R_OK | W_OK) == 0) {
+        snprintf(out, size, "%s", temp);
+        return true;
+      }
+    }
+  }
+
+  // no success
+  return false;
+}
+
+static speed_t baud_to_speed(uint32_t baud_rate) {
+  switch (baud_rate) {
+  case 9600:   return B9600;
+  case 19200:  return B19200;
+  case 38400:  return B38400;
+  case 57600:  return B57600;
+  case 115200: return B115200;
+  case 230400: return B230400;
+  default:     return B0;
+  }
+}
+
+static bool serial_configure(int fd, uint32_t baud_rate) {
+  const speed_t speed = baud_to_speed(baud_rate);
+  termios tio;
+  if (speed == B0 || tcgetattr(fd, &tio) != 0) {
+    return false;
+  }
+  // 8N1 raw binary with no flow control
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+  // reads return whatever has arrived, or nothing after 100ms
+  tio.c_cc[VMIN]  = 0;
+  tio.c_cc[VTIME] = 1;
+  if (cfsetispeed(&tio, speed) != 0 || cfsetospeed(&tio, speed) != 0) {
+    return false;
+  }
+  if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+    return false;
+  }
+  tcflush(fd, TCIOFLUSH);
+  return true;
+}
+
+static serial_t* serial_open(const char *port, uint32_t baud_rate) {
+  // construct serial device name
+  char dev_name[64];
+  if (!get_port_name(port, dev_name, sizeof(dev_name))) {
+    return NULL;
+  }
+  // open the serial device
+  const int fd = open(dev_name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (!serial_configure(fd, baud_rate)) {
+    close(fd);
+    return NULL;
+  }
+  // wrap in serial object
+  serial_t* serial = (serial_t*)malloc(sizeof(serial_t));
+  if (serial == NULL) {
+    close(fd);
+    return NULL;
+  }
+  serial->fd = fd;
+  return serial;
+}
+
+static void serial_close(serial_t* serial) {
+  assert(serial);
+  close(serial->fd);
+  free(serial);
+}
+
+static uint32_t serial_send(serial_t* serial, const void* src, size_t nbytes) {
+  assert(serial && src && nbytes);
+  size_t nb_written = 0;
+  while (nb_written < nbytes) {
+    const ssize_t n = write(serial->fd, (const uint8_t*)src + nb_written, nbytes - nb_written);
+    if (n <= 0) {
+      break;
+    }
+    nb_written += size_t(n);
+  }
+
+  if (gpio_debug) {
+    printf("sent %zu, done %zu ", nbytes, nb_written);
+    for (size_t i = 0; i < nb_written; ++i) {
+      char d = ((uint8_t*)src)[i];
+      printf("%02x(%c) ", d, d);
+    }
+    printf("\n");
+  }
+  return uint32_t(nb_written);
+}
+
+static uint32_t serial_read(serial_t* serial, void* dst, size_t nbytes) {
+  assert(serial && dst && nbytes);
+  const ssize_t nb_read = read(serial->fd, dst, nbytes);
+  if (nb_read <= 0) {
+    return 0;
+  }
+
+  if (gpio_debug) {
+    printf("read %zu, got %zd ", nbytes, nb_read);
+    for (ssize_t i = 0; i < nb_read; ++i) {
+      char d = ((uint8_t*)dst)[i];
+      printf("%02x(%c) ", d, d);
+    }
+    printf("\n");
+  }
+  return uint32_t(nb_read);
+}
+
+static uint32_t serial_available(serial_t* serial) {
+  int count = 0;
+  if (ioctl(serial->fd, FIONREAD, &count) != 0) {
+    return 0;
+  }
+  return uint32_t(count);
+}
+
+static void serial_flush(serial_t* serial) {
+  tcdrain(serial->fd);
+}
 
 #endif  // !defined(_MSC_VER)
 
 //-----------------------------------------------------------------------------
-// GPIO
+// SOCKETS
 //-----------------------------------------------------------------------------
 
-#define PIN_COUNT 28
+#if defined(_MSC_VER)
 
-#define CHECK_PIN(PIN) \
-  assert(PIN >= 0 && PIN <= PIN_COUNT)
+#include <winsock2.h>
+#include <ws2tcpip.h>
 
-enum pin_type_t {
-  type_unknown,
-  type_input,
-  type_output,
-  type_spi
-};
+typedef SOCKET socket_fd_t;
+#define SOCKET_INVALID INVALID_SOCKET
+#define socket_close   closesocket
+#define socket_poll    WSAPoll
+#define socket_ioctl   ioctlsocket
 
-enum pin_pull_t {
-  pull_unknown,
-  pull_up,
-  pull_down,
-  pull_none,
-};
+#else
 
-enum pin_drive_t {
-  drive_unknown,
-  drive_low,
-  drive_high,
-};
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
-struct pin_state_t {
-  pin_type_t  type;
-  pin_pull_t  pull;
-  pin_drive_t drive;
+typedef int socket_fd_t;
+#define SOCKET_INVALID (-1)
+#define socket_close   close
+#define socket_poll    poll
+#define socket_ioctl   ioctl
+
+#endif  // defined(_MSC_VER)
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+struct socket_t {
+  socket_fd_t fd;
 };
 
-struct state_t {
-  bool        enhanced_mode;
-  uint32_t    latched_pin;
-  pin_state_t pin[PIN_COUNT];
+// wrap a connected socket, closing it on failure
+static void* socket_wrap(socket_fd_t fd) {
+  socket_t *sock = (socket_t*)malloc(sizeof(socket_t));
+  if (sock == NULL) {
+    socket_close(fd);
+    return NULL;
+  }
+  sock->fd = fd;
+  return sock;
+}
+
+static void socket_link_close(void *link) {
+  socket_t *sock = (socket_t*)link;
+  socket_close(sock->fd);
+  free(sock);
+}
+
+static uint32_t socket_send_all(socket_fd_t fd, const void *src, uint32_t nbytes) {
+  uint32_t sent = 0;
+  while (sent < nbytes) {
+    const int n = int(send(fd, (const char*)src + sent, int(nbytes - sent), MSG_NOSIGNAL));
+    if (n <= 0) {
+      break;
+    }
+    sent += uint32_t(n);
+  }
+  return sent;
+}
+
+static uint32_t socket_link_send(void *link, const void *src, uint32_t nbytes) {
+  const socket_t *sock = (const socket_t*)link;
+  return socket_send_all(sock->fd, src, nbytes);
+}
+
+// wait up to 100ms for data, like a serial port read timeout
+static uint32_t socket_link_read(void *link, void *dst, uint32_t nbytes) {
+  const socket_t *sock = (const socket_t*)link;
+  pollfd fds = {};
+  fds.fd     = sock->fd;
+  fds.events = POLLIN;
+  if (socket_poll(&fds, 1, 100) <= 0) {
+    return 0;
+  }
+  const int n = int(recv(sock->fd, (char*)dst, int(nbytes), 0));
+  return n > 0 ? uint32_t(n) : 0;
+}
+
+static uint32_t socket_link_available(void *link) {
+  const socket_t *sock = (const socket_t*)link;
+#if defined(_MSC_VER)
+  u_long count = 0;
+#else
+  int count = 0;
+#endif
+  if (socket_ioctl(sock->fd, FIONREAD, &count) != 0) {
+    return 0;
+  }
+  return uint32_t(count);
+}
+
+// connect to "host:port"
+static void* tcp_link_open(const char *address) {
+  if (!address) {
+    return NULL;
+  }
+#if defined(_MSC_VER)
+  static bool wsa_started = false;
+  if (!wsa_started) {
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+      return NULL;
+    }
+    wsa_started = true;
+  }
+#endif
+  char host[256];
+  const char *colon = strrchr(address, ':');
+  if (!colon || size_t(colon - address) >= sizeof(host)) {
+    return NULL;
+  }
+  memcpy(host, address, colon - address);
+  host[colon - address] = '\0';
+
+  addrinfo hints = {};
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *info = NULL;
+  if (getaddrinfo(host, colon + 1, &hints, &info) != 0) {
+    return NULL;
+  }
+  socket_fd_t fd = SOCKET_INVALID;
+  for (addrinfo *i = info; i; i = i->ai_next) {
+    fd = socket(i->ai_family, i->ai_socktype, i->ai_protocol);
+    if (fd == SOCKET_INVALID) {
+      continue;
+    }
+    if (connect(fd, i->ai_addr, int(i->ai_addrlen)) == 0) {
+      break;
+    }
+    socket_close(fd);
+    fd = SOCKET_INVALID;
+  }
+  freeaddrinfo(info);
+  if (fd == SOCKET_INVALID) {
+    return NULL;
+  }
+  // commands are small and latency bound
+  const int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+  return socket_wrap(fd);
+}
+
+#if !defined(_MSC_VER)
+
+// connect to a socket path
+static socket_fd_t unix_connect(const char *path) {
+  sockaddr_un addr = {};
+  if (!path || strlen(path) >= sizeof(addr.sun_path)) {
+    return SOCKET_INVALID;
+  }
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  const socket_fd_t fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == SOCKET_INVALID) {
+    return SOCKET_INVALID;
+  }
+  if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+    socket_close(fd);
+    return SOCKET_INVALID;
+  }
+  return fd;
+}
+
+static void* unix_link_open(const char *address) {
+  const socket_fd_t fd = unix_connect(address);
+  return (fd == SOCKET_INVALID) ? NULL : socket_wrap(fd);
+}
+
+#endif  // !defined(_MSC_VER)
+
+//-----------------------------------------------------------------------------
+// RTKGPIOD
+//-----------------------------------------------------------------------------
+
+#if !defined(_MSC_VER)
+
+// the daemon frames requests as <op:1> <len:2> with little endian lengths:
+//   'S' len data  - send `len` bytes to the board
+//   'R' len       - read up to `len` bytes, waiting up to 100ms for them
+//   'A' len       - read up to `len` bytes already received, without waiting
+// and answers each 'R' or 'A' with <len:2> data
+
+#define DAEMON_CHUNK 4096
+
+struct daemon_link_t {
+  socket_fd_t fd;
+  uint8_t     data[DAEMON_CHUNK];  // bytes fetched by `available`
+  uint32_t    head;
+  uint32_t    tail;
 };
 
-static state_t   state;
-static serial_t *serial;
+static bool socket_recv_all(socket_fd_t fd, void *dst, uint32_t nbytes) {
+  uint32_t got = 0;
+  while (got < nbytes) {
+    const int n = int(recv(fd, (char*)dst + got, int(nbytes - got), 0));
+    if (n <= 0) {
+      return false;
+    }
+    got += uint32_t(n);
+  }
+  return true;
+}
 
-// increment the latched pin with wrapping
-static void latched_pin_inc() {
-  ++state.latched_pin;
-  if (state.latched_pin >= PIN_COUNT) {
-    state.latched_pin = 0;
+static bool daemon_send_frame(daemon_link_t *daemon, uint8_t op, const void *src, uint32_t len) {
+  uint8_t frame[3 + DAEMON_CHUNK] = { op, uint8_t(len), uint8_t(len >> 8) };
+  const uint32_t size = (op == 'S') ? 3 + len : 3;
+  if (op == 'S') {
+    memcpy(frame + 3, src, len);
   }
+  return socket_send_all(daemon->fd, frame, size) == size;
 }
 
-static void gpio_set_pin(int pin) {
-  CHECK_PIN(pin);
-  if (serial) {
-    char data = 'a' + char(pin);
-    // early exit if bin already bound
-    if (state.enhanced_mode && !gpio_no_cache) {
-      if (state.latched_pin == pin) {
-        return;
-      }
+// issue a read request and collect its reply
+static uint32_t daemon_request(daemon_link_t *daemon, uint8_t op, void *dst, uint32_t nbytes) {
+  const uint32_t want = nbytes < 0xffff ? nbytes : 0xffff;
+  uint8_t len[2];
+  if (!daemon_send_frame(daemon, op, NULL, want) ||
+      !socket_recv_all(daemon->fd, len, sizeof(len))) {
+    return 0;
+  }
+  const uint32_t got = len[0] | (len[1] << 8);
+  if (got > want || !socket_recv_all(daemon->fd, dst, got)) {
+    return 0;
+  }
+  return got;
+}
+
+static void* daemon_link_open(const char *address) {
+  const socket_fd_t fd = unix_connect((address && *address) ? address : RTKGPIOD_SOCKET);
+  if (fd == SOCKET_INVALID) {
+    return NULL;
+  }
+  daemon_link_t *daemon = (daemon_link_t*)malloc(sizeof(daemon_link_t));
+  if (daemon == NULL) {
+    socket_close(fd);
+    return NULL;
+  }
+  daemon->fd   = fd;
+  daemon->head = 0;
+  daemon->tail = 0;
+  return daemon;
+}
+
+static void daemon_link_close(void *link) {
+  daemon_link_t *daemon = (daemon_link_t*)link;
+  socket_close(daemon->fd);
+  free(daemon);
+}
+
+static uint32_t daemon_link_send(void *link, const void *src, uint32_t nbytes) {
+  daemon_link_t *daemon = (daemon_link_t*)link;
+  uint32_t sent = 0;
+  while (sent < nbytes) {
+    const uint32_t len = (nbytes - sent) < DAEMON_CHUNK ? (nbytes - sent) : DAEMON_CHUNK;
+    if (!daemon_send_frame(daemon, 'S', (const uint8_t*)src + sent, len)) {
+      break;
     }
-    // explicitly set the pin
-    serial_send(serial, &data, 1);
-    state.latched_pin = pin;
+    sent += len;
   }
+  return sent;
 }
 
-static void gpio_action(int pin, char action) {
-  CHECK_PIN(pin);
-  if (serial) {
-    // set the pin
-    gpio_set_pin(pin);
-    // perform the action
-    serial_send(serial, &action, 1);
-    latched_pin_inc();
+static uint32_t daemon_link_read(void *link, void *dst, uint32_t nbytes) {
+  daemon_link_t *daemon = (daemon_link_t*)link;
+  // hand out anything fetched by `available` first
+  if (daemon->head != daemon->tail) {
+    const uint32_t avail = daemon->tail - daemon->head;
+    const uint32_t n = nbytes < avail ? nbytes : avail;
+    memcpy(dst, daemon->data + daemon->head, n);
+    daemon->head += n;
+    return n;
   }
+  return daemon_request(daemon, 'R', dst, nbytes);
 }
 
-static uint8_t hex_to_nibble(char x) {
-  return (x >= '0' && x <= '9') ? (x - '0') : ((x - 'A') + 10);
+// the daemon can only be asked for data, so fetch what it has
+static uint32_t daemon_link_available(void *link) {
+  daemon_link_t *daemon = (daemon_link_t*)link;
+  if (daemon->head == daemon->tail) {
+    daemon->head = 0;
+    daemon->tail = daemon_request(daemon, 'A', daemon->data, sizeof(daemon->data));
+  }
+  return daemon->tail - daemon->head;
 }
 
-static char nibble_to_hex(uint8_t x) {
-  return (x >= 10) ? ('A' + (x - 10)) : ('0' + x);
+#endif  // !defined(_MSC_VER)
+
+//-----------------------------------------------------------------------------
+// LOOPBACK
+//-----------------------------------------------------------------------------
+
+#define LOOPBACK_SIZE 4096
+
+struct loopback_t {
+  uint8_t  data[LOOPBACK_SIZE];  // replies not yet read
+  uint32_t head;
+  uint32_t tail;
+  uint64_t sent;
+};
+
+static loopback_t loopback;
+
+// queued replies are kept so they can answer the reset sent by gpio_open
+static void* loop_link_open(const char *) {
+  loopback.sent = 0;
+  return &loopback;
 }
 
-static void pin_dispose(int pin) {
-  state.pin[pin].drive = drive_unknown;
-  state.pin[pin].pull  = pull_unknown;
-  state.pin[pin].type  = type_spi;
+static void loop_link_close(void *) {
 }
 
-extern "C" {
+static uint32_t loop_link_send(void *, const void *, uint32_t nbytes) {
+  loopback.sent += nbytes;
+  return nbytes;
+}
 
-void gpio_delay(uint32_t ms) {
-  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+static uint32_t loop_link_read(void *, void *dst, uint32_t nbytes) {
+  const uint32_t avail = loopback.tail - loopback.head;
+  const uint32_t n = nbytes < avail ? nbytes : avail;
+  memcpy(dst, loopback.data + loopback.head, n);
+  loopback.head += n;
+  return n;
+}
+
+static uint32_t loop_link_available(void *) {
+  return loopback.tail - loopback.head;
+}
+
+//-----------------------------------------------------------------------------
+// TRANSPORTS
+//-----------------------------------------------------------------------------
+
+#define TRANSPORT_MAX 8
+
+static void* serial_link_open(const char *address) {
+  const int baud = 230400;
+  return serial_open(address, baud);
+}
+
+static void serial_link_close(void *link) {
+  serial_close((serial_t*)link);
+}
+
+static uint32_t serial_link_send(void *link, const void *src, uint32_t nbytes) {
+  return serial_send((serial_t*)link, src, nbytes);
+}
+
+static uint32_t serial_link_read(void *link, void *dst, uint32_t nbytes) {
+  return serial_read((serial_t*)link, dst, nbytes);
+}
+
+static void serial_link_flush(void *link) {
+  serial_flush((serial_t*)link);
+}
+
+static uint32_t serial_link_available(void *link) {
+  return serial_available((serial_t*)link);
+}
+
+static const gpio_transport_t transport_serial = {
+  "serial", serial_link_open, serial_link_close, serial_link_send,
+  serial_link_read, serial_link_flush, serial_link_available, /*shared=*/false,
+};
+
+static const gpio_transport_t transport_builtin[] = {
+  transport_serial,
+  { "tcp",  tcp_link_open,  socket_link_close, socket_link_send,
+    socket_link_read, NULL, socket_link_available, /*shared=*/false },
+#if !defined(_MSC_VER)
+  { "unix", unix_link_open, socket_link_close, socket_link_send,
+    socket_link_read, NULL, socket_link_available, /*shared=*/false },
+  { "rtkgpiod", daemon_link_open, daemon_link_close, daemon_link_send,
+    daemon_link_read, NULL, daemon_link_available, /*shared=*/true },
+#endif
+  { "loop", loop_link_open, loop_link_close, loop_link_send,
+    loop_link_read, NULL, loop_link_available, /*shared=*/false },
+};
+
+static const gpio_transport_t *transport_user[TRANSPORT_MAX];
+static int transport_user_count;
+
+// check if a uri starts with `scheme:`, returning the address after it
+static const char* uri_match(const char *uri, const char *scheme) {
+  const size_t len = strlen(scheme);
+  if (strncmp(uri, scheme, len) != 0 || uri[len] != ':') {
+    return NULL;
+  }
+  const char *address = uri + len + 1;
+  return (strncmp(address, "//", 2) == 0) ? address + 2 : address;
+}
+
+
+//-----------------------------------------------------------------------------
+// GPIO
+//-----------------------------------------------------------------------------
+
+#define PIN_COUNT 28
+
+#define CHECK_PIN(PIN) \
+  assert(PIN >= 0 && PIN <= PIN_COUNT)
+
+// largest payload sent in a single SPI transaction command
+#define SPI_CHUNK 256
+
+// largest number of waveform samples sent in a single upload command
+#define WAVE_CHUNK 128
+
+// size of the host side receive buffer
+#define RX_SIZE 1024
+
+// size of the host side buffer for data received by the USART2 bridge
+#define UART_RX_SIZE 4096
+
+// largest payload sent in a single USART2 bridge write command
+#define UART_CHUNK 128
+
+// bytes written to a parallel bus per 'BW' command
+#define BUS_CHUNK 128
+
+// spi status waits that can be queued before collecting their replies
+#define WAIT_QUEUE_SIZE 8
+
+// bytes shifted per 'J' command
+#define SHIFT_CHUNK 128
+
+// bytes written or read per 'Z' command
+#define ONEWIRE_CHUNK 255
+
+// sensors read per 'ZQ' command
+#define ONEWIRE_QUERY 16
+
+// marks the start of an unsolicited event frame from the board
+#define EVENT_MARKER '!'
+
+// number of ping results kept for estimating the board clock
+#define SYNC_SAMPLES 16
+
+// largest number of RLE runs sent in a single LCD command
+#define LCD_RUN_CHUNK 64
+
+// worst case time the board takes to clock out one LCD pixel, ~12us per
+// byte through the mbed SPI driver
+#define LCD_PIXEL_US 25
+
+// LCD commands understood by ST7735 class panels
+enum {
+  lcd_caset = 0x2A,
+  lcd_raset = 0x2B,
+  lcd_ramwr = 0x2C,
+};
+
+// SPI transaction flags understood by the firmware
+enum {
+  spi_txn_hold_cs = 0x1,
+  spi_txn_reply   = 0x2,
+};
+
+enum pin_type_t {
+  type_unknown,
+  type_input,
+  type_output,
+  type_spi,
+  type_i2c,
+  type_uart,
+  type_encoder,
+};
+
+enum pin_pull_t {
+  pull_unknown,
+  pull_up,
+  pull_down,
+  pull_none,
+};
+
+enum pin_drive_t {
+  drive_unknown,
+  drive_low,
+  drive_high,
+};
+
+struct pin_state_t {
+  pin_type_t  type;
+  pin_pull_t  pull;
+  pin_drive_t drive;
+};
+
+struct state_t {
+  bool        enhanced_mode;
+  int         firmware_version;
+  uint32_t    latched_pin;
+  pin_state_t pin[PIN_COUNT];
+  uint32_t    spi_frequency;
+  int         spi_mode;
+
+  adc_stream_callback_t adc_callback;
+  encoder_callback_t    encoder_callback[gpio_encoder_count];
+  keypad_callback_t     keypad_callback;
+  int                   keypad_cols;
+  debounce_callback_t   debounce_callback[PIN_COUNT];
+  analog_callback_t     analog_callback;
+  int                   analog_pins[gpio_analog_pins];  // scanned pins in channel order
+  int                   analog_count;
+
+  bool        timestamps;      // replies and events carry board timestamps
+  uint64_t    board_time;      // latest board time seen, extended to 64bits
+  uint64_t    last_timestamp;
+};
+
+// ping results relating board time to host time
+struct clock_sync_t {
+  uint64_t board[SYNC_SAMPLES];
+  uint64_t host[SYNC_SAMPLES];  // host time half way through the ping
+  uint32_t rtt[SYNC_SAMPLES];
+  int      count;
+  int      next;
+  // host time = host_ref + (board time - board_ref) * rate
+  uint64_t board_ref;
+  uint64_t host_ref;
+  double   rate;
+};
+
+struct rx_buffer_t {
+  char     data[RX_SIZE];
+  uint32_t head;
+  uint32_t tail;
+};
+
+struct uart_buffer_t {
+  uint8_t  data[UART_RX_SIZE];
+  uint32_t head;
+  uint32_t tail;
+};
+
+// commands captured while recording a macro
+struct macro_record_t {
+  bool     active;
+  bool     valid;
+  int      id;
+  uint8_t  data[gpio_macro_size];
+  uint32_t size;
+  uint32_t pins;        // pins the recorded commands act on
+  bool     spi_config;  // the SPI bus configuration was changed
+  state_t  saved;       // host state before recording started
+};
+
+// spi status waits whose replies have not been collected yet
+struct wait_queue_t {
+  uint32_t timeout_ms[WAIT_QUEUE_SIZE];
+  int32_t  result[WAIT_QUEUE_SIZE];  // host polled results with older firmware
+  uint8_t  status[WAIT_QUEUE_SIZE];
+  int      head;
+  int      count;
+};
+
+// parallel bus definition, kept to drive the bus from the host with older
+// firmware
+struct bus_def_t {
+  int      width;  // zero when undefined
+  int      data[8];
+  int      strobe;
+  int      rs;
+  int      rw;
+  uint32_t delay_us;
+  int      flags;
+};
+
+// what running a stored macro may change behind our back
+struct macro_effect_t {
+  uint32_t pins;
+  bool     spi_config;
+};
+
+static state_t        state;
+static rx_buffer_t    rx;
+static uart_buffer_t  uart_rx;
+static macro_record_t record;
+static clock_sync_t   clock_sync;
+static macro_effect_t macro_effect[gpio_macro_count];
+static bus_def_t      bus_def[gpio_bus_count];
+static wait_queue_t   wait_queue;
+
+// the open connection to the board
+static const gpio_transport_t *link_transport;
+static void                   *link_handle;
+
+// traffic counters published with the pin state
+struct link_stats_t {
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+  uint64_t events;
+  uint64_t pin_reads;
+  uint64_t pin_writes;
+};
+
+// the last level read from a pin
+struct pin_level_t {
+  uint8_t  level;       // 0xff until read
+  uint64_t read_us;
+  uint64_t read_stamp;
+};
+
+#if !defined(_MSC_VER)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static link_stats_t   stats;
+static pin_level_t    pin_level[PIN_COUNT];
+static gpio_mirror_t *mirror;                  // published pin state, or NULL
+static char           mirror_name[64];
+
+static_assert(int(type_encoder) == gpio_mirror_encoder &&
+              int(pull_none)    == gpio_mirror_pull_none &&
+              int(drive_high)   == gpio_mirror_high &&
+              PIN_COUNT         == gpio_mirror_pins, "mirror values must match the shadow state");
+
+// host monotonic clock in microseconds
+static uint64_t host_time_us() {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// copy the shadow state into the published mirror
+// note: the sequence is odd while the copy is made so readers can retry
+static void mirror_update() {
+  if (!mirror) {
+    return;
+  }
+  mirror->sequence = mirror->sequence + 1;
+  std::atomic_thread_fence(std::memory_order_release);
+  for (int i = 0; i < PIN_COUNT; ++i) {
+    gpio_mirror_pin_t &pin = mirror->pin[i];
+    pin.type       = uint8_t(state.pin[i].type);
+    pin.pull       = uint8_t(state.pin[i].pull);
+    pin.drive      = uint8_t(state.pin[i].drive);
+    pin.level      = pin_level[i].level;
+    pin.read_us    = pin_level[i].read_us;
+    pin.read_stamp = pin_level[i].read_stamp;
+  }
+  mirror->update_us      = host_time_us();
+  mirror->board_time     = state.board_time;
+  mirror->bytes_sent     = stats.bytes_sent;
+  mirror->bytes_received = stats.bytes_received;
+  mirror->events         = stats.events;
+  mirror->pin_reads      = stats.pin_reads;
+  mirror->pin_writes     = stats.pin_writes;
+  std::atomic_thread_fence(std::memory_order_release);
+  mirror->sequence = mirror->sequence + 1;
+}
+
+// check if commands that would not change any state may be skipped
+static bool cache_enabled() {
+  // a recorded macro can not rely on the state when it is later run
+  // other clients of a shared board may have changed anything
+  return !gpio_no_cache && !record.active && !(link_transport && link_transport->shared);
+}
+
+// check if a board wide setting may be skipped when unchanged, which holds
+// on a shared board too as rtkgpiod restores each client's own settings
+static bool setting_cache_enabled() {
+  return !gpio_no_cache && !record.active;
+}
+
+// send a command to the board, or capture it while recording a macro
+static void link_send(const void *src, uint32_t nbytes) {
+  if (record.active) {
+    if (record.size + nbytes > sizeof(record.data)) {
+      record.valid = false;
+      return;
+    }
+    memcpy(record.data + record.size, src, nbytes);
+    record.size += nbytes;
+    return;
+  }
+  link_transport->send(link_handle, src, nbytes);
+  stats.bytes_sent += nbytes;
+  // publishes anything changed since the last command
+  mirror_update();
+}
+
+// increment the latched pin with wrapping
+static void latched_pin_inc() {
+  ++state.latched_pin;
+  if (state.latched_pin >= PIN_COUNT) {
+    state.latched_pin = 0;
+  }
+}
+
+static void gpio_set_pin(int pin) {
+  CHECK_PIN(pin);
+  if (link_handle) {
+    char data = 'a' + char(pin);
+    // early exit if bin already bound
+    if (state.enhanced_mode && cache_enabled()) {
+      if (state.latched_pin == pin) {
+        return;
+      }
+    }
+    // explicitly set the pin
+    link_send(&data, 1);
+    state.latched_pin = pin;
+  }
+}
+
+static void gpio_action(int pin, char action) {
+  CHECK_PIN(pin);
+  if (link_handle) {
+    if (record.active) {
+      record.pins |= 1u << pin;
+    }
+    // set the pin
+    gpio_set_pin(pin);
+    // perform the action
+    link_send(&action, 1);
+    latched_pin_inc();
+  }
+}
+
+static uint8_t hex_to_nibble(char x) {
+  return (x >= '0' && x <= '9') ? (x - '0') : ((x - 'A') + 10);
+}
+
+static char nibble_to_hex(uint8_t x) {
+  return (x >= 10) ? ('A' + (x - 10)) : ('0' + x);
+}
+
+static void pin_dispose(int pin, pin_type_t type = type_spi) {
+  state.pin[pin].drive = drive_unknown;
+  state.pin[pin].pull  = pull_unknown;
+  state.pin[pin].type  = type;
+  mirror_update();
+}
+
+// encode a byte as two hex chars
+static char *put_hex8(char *dst, uint8_t x) {
+  dst[0] = nibble_to_hex((x & 0xf0) >> 4);
+  dst[1] = nibble_to_hex((x & 0x0f));
+  return dst + 2;
+}
+
+// encode a 16bit value as four hex chars
+static char *put_hex16(char *dst, uint16_t x) {
+  dst = put_hex8(dst, uint8_t(x >> 8));
+  return put_hex8(dst, uint8_t(x));
+}
+
+// encode a 32bit value as eight hex chars
+static char *put_hex32(char *dst, uint32_t x) {
+  dst = put_hex16(dst, uint16_t(x >> 16));
+  return put_hex16(dst, uint16_t(x));
+}
+
+// decode a byte from two hex chars
+static uint8_t get_hex8(const char *src) {
+  return (hex_to_nibble(src[0]) << 4) | hex_to_nibble(src[1]);
+}
+
+// decode a 32bit value from eight hex chars
+static uint32_t get_hex32(const char *src) {
+  uint32_t x = 0;
+  for (int i = 0; i < 8; ++i) {
+    x = (x << 4) | hex_to_nibble(src[i]);
+  }
+  return x;
+}
+
+// decode a 32bit board timestamp, extending it to 64bits
+// timestamps arrive roughly in order so the nearest match is taken
+static uint64_t get_board_time(const char *src) {
+  const uint32_t stamp = get_hex32(src);
+  if (state.board_time == 0) {
+    state.board_time = stamp;
+  }
+  state.board_time += int32_t(stamp - uint32_t(state.board_time));
+  return state.board_time;
+}
+
+// refit the board clock from the ping results, trusting the fastest pings
+static void clock_sync_update() {
+  int best = 0;
+  for (int i = 1; i < clock_sync.count; ++i) {
+    if (clock_sync.rtt[i] < clock_sync.rtt[best]) {
+      best = i;
+    }
+  }
+  clock_sync.board_ref = clock_sync.board[best];
+  clock_sync.host_ref  = clock_sync.host[best];
+  // least squares fit of host time against board time
+  const uint32_t limit = clock_sync.rtt[best] * 2 + 100;
+  double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (int i = 0; i < clock_sync.count; ++i) {
+    if (clock_sync.rtt[i] > limit) {
+      continue;
+    }
+    const double x = double(int64_t(clock_sync.board[i] - clock_sync.board_ref));
+    const double y = double(int64_t(clock_sync.host[i]  - clock_sync.host_ref));
+    n   += 1;
+    sx  += x;
+    sy  += y;
+    sxx += x * x;
+    sxy += x * y;
+  }
+  const double var = n * sxx - sx * sx;
+  clock_sync.rate = (n >= 2 && var > 0) ? (n * sxy - sx * sy) / var : 1.0;
+}
+
+// encode a pin number as used for firmware command arguments
+static char pin_arg(int pin) {
+  return (pin >= 0 && pin < PIN_COUNT) ? char('a' + pin) : '-';
+}
+
+// start an 'L' LCD command
+static char *lcd_header(char *dst, char op, int cs, int dc) {
+  dst[0] = 'L';
+  dst[1] = op;
+  dst[2] = pin_arg(cs);
+  dst[3] = pin_arg(dc);
+  return dst + 4;
+}
+
+// the firmware leaves chip select released and data/command selecting data
+static void lcd_pins_released(int cs, int dc) {
+  if (cs >= 0 && cs < PIN_COUNT) {
+    state.pin[cs].type  = type_output;
+    state.pin[cs].drive = drive_high;
+  }
+  state.pin[dc].type  = type_output;
+  state.pin[dc].drive = drive_high;
+}
+
+// extract the major version number from a board version string
+static int parse_version(const char *str) {
+  const char *v = strstr(str, " v");
+  return v ? atoi(v + 2) : 0;
+}
+
+// check if the board firmware supports the v3 bulk commands
+static bool has_bulk_commands() {
+  return state.enhanced_mode && state.firmware_version >= 3;
+}
+
+// fetch a received byte, reading at most `want` bytes from the serial port
+// when the buffer is empty so we never wait on data that is not coming
+static bool rx_getc(char *out, uint32_t want) {
+  if (rx.head == rx.tail) {
+    rx.head = 0;
+    rx.tail = link_transport->read(link_handle, rx.data, want < RX_SIZE ? want : RX_SIZE);
+    if (rx.tail == 0) {
+      return false;
+    }
+    stats.bytes_received += rx.tail;
+  }
+  *out = rx.data[rx.head++];
+  return true;
+}
+
+// unpack 12bit sample pairs streamed from an SPI ADC
+static void adc_stream_event(const uint8_t *data, uint32_t len) {
+  uint16_t samples[(255 / 3) * 2];
+  uint32_t count = 0;
+  for (uint32_t i = 0; i + 2 < len; i += 3) {
+    samples[count++] = (data[i + 0] << 4) | (data[i + 1] >> 4);
+    samples[count++] = ((data[i + 1] & 0x0f) << 8) | data[i + 2];
+  }
+  if (state.adc_callback && count) {
+    state.adc_callback(samples, count);
+  }
+}
+
+// buffer data received by the USART2 bridge until it is read
+static void uart_event(const uint8_t *data, uint32_t len) {
+  for (uint32_t i = 0; i < len; ++i) {
+    const uint32_t next = (uart_rx.head + 1) % UART_RX_SIZE;
+    // drop data on overflow
+    if (next == uart_rx.tail) {
+      break;
+    }
+    uart_rx.data[uart_rx.head] = data[i];
+    uart_rx.head = next;
+  }
+}
+
+// pass a pushed encoder count to its callback
+static void encoder_event(const uint8_t *data, uint32_t len) {
+  if (len < 5 || data[0] >= gpio_encoder_count) {
+    return;
+  }
+  const int32_t count = int32_t((uint32_t(data[1]) << 24) | (uint32_t(data[2]) << 16) |
+                                (uint32_t(data[3]) <<  8) |  uint32_t(data[4]));
+  if (state.encoder_callback[data[0]]) {
+    state.encoder_callback[data[0]](data[0], count);
+  }
+}
+
+// pass a debounced keypad change to its callback
+static void keypad_event(const uint8_t *data, uint32_t len) {
+  if (len < 2 || !state.keypad_callback || !state.keypad_cols) {
+    return;
+  }
+  state.keypad_callback(data[0] / state.keypad_cols, data[0] % state.keypad_cols, data[1]);
+}
+
+// pass a debounced input change to its callback
+static void debounce_event(const uint8_t *data, uint32_t len) {
+  if (len < 2 || data[0] >= PIN_COUNT) {
+    return;
+  }
+  pin_level_t &pin = pin_level[data[0]];
+  pin.level      = data[1] ? 1 : 0;
+  pin.read_us    = host_time_us();
+  pin.read_stamp = state.timestamps ? state.last_timestamp : 0;
+  if (state.debounce_callback[data[0]]) {
+    state.debounce_callback[data[0]](data[0], data[1]);
+  }
+}
+
+// pass the latest internal ADC scan values to their callback
+static void analog_event(const uint8_t *data, uint32_t len) {
+  if (!state.analog_callback) {
+    return;
+  }
+  for (int i = 0; i < state.analog_count && uint32_t(i * 2 + 1) < len; ++i) {
+    state.analog_callback(state.analog_pins[i], uint16_t((data[i * 2] << 8) | data[i * 2 + 1]));
+  }
+}
+
+// pass a received event to whoever is interested in it
+static void event_dispatch(char type, const uint8_t *data, uint32_t len) {
+  switch (type) {
+  case 'Q': adc_stream_event(data, len); break;
+  case 'X': uart_event(data, len);       break;
+  case 'E': encoder_event(data, len);    break;
+  case 'K': keypad_event(data, len);     break;
+  case 'D': debounce_event(data, len);   break;
+  case 'A': analog_event(data, len);     break;
+  }
+}
+
+// receive the rest of an event frame after its marker and dispatch it
+// <type> <len:2> <data:len*2>
+static void event_recv() {
+  char head[3];
+  for (uint32_t i = 0; i < sizeof(head); ++i) {
+    if (!rx_getc(head + i, sizeof(head) - i)) {
+      return;
+    }
+  }
+  const uint32_t len = get_hex8(head + 1);
+  uint8_t data[255];
+  for (uint32_t i = 0; i < len; ++i) {
+    char hex[2];
+    if (!rx_getc(hex + 0, (len - i) * 2) ||
+        !rx_getc(hex + 1, (len - i) * 2 - 1)) {
+      return;
+    }
+    data[i] = get_hex8(hex);
+  }
+  if (state.timestamps) {
+    char stamp[8];
+    for (uint32_t i = 0; i < sizeof(stamp); ++i) {
+      if (!rx_getc(stamp + i, sizeof(stamp) - i)) {
+        return;
+      }
+    }
+    state.last_timestamp = get_board_time(stamp);
+  }
+  ++stats.events;
+  event_dispatch(head[0], data, len);
+}
+
+// read a command reply, handling any event frames mixed in with it
+static uint32_t link_read(void *dst, uint32_t nbytes) {
+  char *out = (char*)dst;
+  // a command expecting a reply can not be part of a macro
+  if (record.active) {
+    record.valid = false;
+    memset(dst, 0, nbytes);
+    return 0;
+  }
+  uint32_t got = 0;
+  while (got < nbytes) {
+    char c;
+    if (!rx_getc(&c, nbytes - got)) {
+      break;
+    }
+    if (c == EVENT_MARKER) {
+      event_recv();
+      continue;
+    }
+    out[got++] = c;
+  }
+  return got;
+}
+
+// read a reply that may take up to `ms` milliseconds to arrive, which can be
+// longer than a single serial read waits for
+static uint32_t link_read_wait(void *dst, uint32_t nbytes, uint32_t ms) {
+  const uint64_t deadline = host_time_us() + uint64_t(ms) * 1000;
+  char *out = (char*)dst;
+  uint32_t got = link_read(out, nbytes);
+  while (got < nbytes && !record.active && host_time_us() < deadline) {
+    got += link_read(out + got, nbytes - got);
+  }
+  return got;
+}
+
+// set an LCD address window from the host, used with older firmware
+static void lcd_window(int cs, int dc, int x0, int y0, int x1, int y1) {
+  const uint8_t cmd[3] = { lcd_caset, lcd_raset, lcd_ramwr };
+  const uint8_t arg[2][4] = {
+    { uint8_t(x0 >> 8), uint8_t(x0), uint8_t(x1 >> 8), uint8_t(x1) },
+    { uint8_t(y0 >> 8), uint8_t(y0), uint8_t(y1 >> 8), uint8_t(y1) },
+  };
+  gpio_output(dc);
+  for (int i = 0; i < 3; ++i) {
+    gpio_write(dc, 0);
+    spi_hw_transfer(cmd + i, nullptr, 1, cs);
+    gpio_write(dc, 1);
+    if (i < 2) {
+      spi_hw_transfer(arg[i], nullptr, 4, cs);
+    }
+  }
+}
+
+// wait for the board to acknowledge drawing `pixels` pixels, which can take
+// far longer than a single serial read waits for
+static bool lcd_wait_ack(uint32_t pixels) {
+  char ack = '\0';
+  const uint32_t ms = 100 + uint32_t((uint64_t(pixels) * LCD_PIXEL_US) / 1000);
+  return link_read_wait(&ack, 1, ms) == 1 && ack == 'K';
+}
+
+extern "C" {
+
+void gpio_delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+bool gpio_open(const char *port) {
+
+  if (link_handle) {
+    link_transport->close(link_handle);
+    link_handle = NULL;
+  }
+
+  // open the link with the transport the port names
+  const char *address = NULL;
+  link_transport = gpio_transport_find(port, &address);
+  link_handle = link_transport->open(address);
+  if (!link_handle) {
+    return false;
+  }
+
+  // traffic is counted from each open
+  stats = link_stats_t();
+
+  // soft reset the RTk.GPIO board
+  rx.head = rx.tail = 0;
+  state.enhanced_mode = false;
+  link_transport->send(link_handle, "R", 1);
+  char recv[2] = { '\0', '\0' };
+  if (link_read(recv, sizeof(recv))) {
+    if (recv[0] == 'O' && recv[1] == 'K') {
+      state.enhanced_mode = true;
+    }
+  }
+
+  // query the firmware version to find which commands are available
+  state.firmware_version = 0;
+  if (state.enhanced_mode) {
+    char version[32];
+    gpio_board_version(version, sizeof(version));
+    state.firmware_version = parse_version(version);
+  }
+
+  // the firmware resets its SPI bus to 1MHz mode 0
+  state.spi_frequency = 1000000;
+  state.spi_mode      = 0;
+
+  // encoders, keypad scanning and debouncing are stopped by the reset
+  for (int i = 0; i < gpio_encoder_count; ++i) {
+    state.encoder_callback[i] = nullptr;
+  }
+  for (int i = 0; i < PIN_COUNT; ++i) {
+    state.debounce_callback[i] = nullptr;
+  }
+  state.keypad_callback = nullptr;
+  state.analog_callback = nullptr;
+  state.analog_count    = 0;
+
+  // replies to queued waits will not arrive
+  wait_queue.head  = 0;
+  wait_queue.count = 0;
+
+  // bus definitions are forgotten by the reset
+  for (int i = 0; i < gpio_bus_count; ++i) {
+    bus_def[i].width = 0;
+  }
+
+  // timestamps are disabled by the reset and the board may have restarted
+  state.timestamps = false;
+  clock_sync.count = 0;
+  clock_sync.next  = 0;
+
+  // macros saved on the board are restored by the reset
+  record.active = false;
+  for (int i = 0; i < gpio_macro_count; ++i) {
+    macro_effect[i].pins       = ~0u;
+    macro_effect[i].spi_config = true;
+  }
+
+  // default to initially unknown state
+  for (int i = 0; i < PIN_COUNT; ++i) {
+    auto &pin = state.pin[i];
+    pin.drive = drive_unknown;
+    pin.type  = type_unknown;
+    pin.pull  = pull_unknown;
+    pin_level[i].level      = 0xff;
+    pin_level[i].read_us    = 0;
+    pin_level[i].read_stamp = 0;
+  }
+  mirror_update();
+
+  return true;
+}
+
+bool gpio_is_open(void) {
+  return link_handle != NULL;
+}
+
+void gpio_close(void) {
+  if (link_handle) {
+    link_transport->close(link_handle);
+    link_handle = nullptr;
+  }
+}
+
+bool gpio_transport_register(const gpio_transport_t *transport) {
+  if (!transport || !transport->scheme || !transport->open || !transport->close ||
+      !transport->send || !transport->read || transport_user_count >= TRANSPORT_MAX) {
+    return false;
+  }
+  transport_user[transport_user_count++] = transport;
+  return true;
+}
+
+void gpio_loopback_reply(const void *src, uint32_t size) {
+  // move unread replies to the front to make room
+  if (loopback.head) {
+    memmove(loopback.data, loopback.data + loopback.head, loopback.tail - loopback.head);
+    loopback.tail -= loopback.head;
+    loopback.head  = 0;
+  }
+  const uint32_t room = LOOPBACK_SIZE - loopback.tail;
+  const uint32_t n = size < room ? size : room;
+  memcpy(loopback.data + loopback.tail, src, n);
+  loopback.tail += n;
+}
+
+const gpio_transport_t* gpio_transport_find(const char *uri, const char **address) {
+  *address = uri;
+  if (!uri) {
+    return &transport_serial;
+  }
+  for (int i = transport_user_count - 1; i >= 0; --i) {
+    if (const char *rest = uri_match(uri, transport_user[i]->scheme)) {
+      *address = rest;
+      return transport_user[i];
+    }
+  }
+  for (const gpio_transport_t &t : transport_builtin) {
+    if (const char *rest = uri_match(uri, t.scheme)) {
+      *address = rest;
+      return &t;
+    }
+  }
+  return &transport_serial;
+}
+
+uint64_t gpio_loopback_sent(void) {
+  return loopback.sent;
+}
+
+void gpio_input(int pin) {
+  CHECK_PIN(pin);
+
+  auto &type = state.pin[pin].type;
+  if (type != type_input || !cache_enabled()) {
+    gpio_action(pin, 'I');
+    type = type_input;
+  }
+  mirror_update();
+}
+
+void gpio_output(int pin) {
+  CHECK_PIN(pin);
+
+  auto &type = state.pin[pin].type;
+  if (type != type_output || !cache_enabled()) {
+    gpio_action(pin, 'O');
+    type = type_output;
+  }
+  mirror_update();
+}
+
+void gpio_write(int pin, int d) {
+  CHECK_PIN(pin);
+
+  pin_drive_t target = d ? drive_high : drive_low;
+  auto &drive = state.pin[pin].drive;
+  if (drive != target || !cache_enabled()) {
+    gpio_action(pin, d ? '1' : '0');
+    drive = target;
+  }
+  ++stats.pin_writes;
+  mirror_update();
+}
+
+void gpio_pull(int pin, int p) {
+  CHECK_PIN(pin);
+
+  pin_pull_t target = (p == gpio_pull_up)   ? pull_up   :
+                      (p == gpio_pull_down) ? pull_down :
+                                              pull_none;
+  const char action = (p == 1) ? 'U' :
+                      (p == 0) ? 'D' :
+                                 'N';
+  auto &pull = state.pin[pin].pull;
+  if (pull != target || !cache_enabled()) {
+    gpio_action(pin, action);
+    pull = target;
+  }
+  mirror_update();
+}
+
+int gpio_read(int pin) {
+  CHECK_PIN(pin);
+  gpio_action(pin, '?');
+  // <pin> <level> [<stamp:8>]
+  char data[10] = { 0 };
+  const uint32_t size = !state.enhanced_mode ? 4 :
+                        state.timestamps     ? 10 : 2;
+  const bool ok = link_read(data, size) == size;
+  if (ok && state.timestamps) {
+    state.last_timestamp = get_board_time(data + 2);
+  }
+  const int level = (data[1] == '1') ? 1 : 0;
+  if (ok) {
+    pin_level_t &last = pin_level[pin];
+    last.level      = uint8_t(level);
+    last.read_us    = host_time_us();
+    last.read_stamp = state.timestamps ? state.last_timestamp : 0;
+  }
+  ++stats.pin_reads;
+  mirror_update();
+  return level;
+}
+
+void gpio_board_version(char* dst, uint32_t dst_size) {
+  assert(dst && dst_size);
+  if (link_handle) {
+    const char* end = dst + (dst_size - 1);
+    // request the version string
+    // note: we send two bytes but the second is ignored but required by the firmware
+    link_send("V_", state.enhanced_mode ? 1 : 2);
+
+    // while we have more space
+    for (; dst < end; ++dst) {
+      char recv = '\0';
+      link_read(&recv, 1);
+      // exit on new line or carage return
+      if (recv == '\r' || recv == '\n' || recv == '\0') {
+        break;
+      }
+      // append character
+      *dst = recv;
+    }
+  }
+  // append trailing zero
+  *dst = '\0';
+}
+
+void spi_sw_init(int cs, int sck, int mosi, int miso) {
+
+  CHECK_PIN(sck);
+  CHECK_PIN(mosi);
+  CHECK_PIN(miso);
+
+  if (cs >= 0 && cs <= PIN_COUNT) {
+    gpio_output(cs);
+    gpio_write(cs, 1);  // cs high (not asserted)
+  }
+
+  gpio_output(mosi);
+  gpio_write (mosi, 1);
+  gpio_output(sck);
+  gpio_write (sck,  1);
+  gpio_input (miso);
+}
+
+uint8_t spi_sw_send(uint8_t data, int cs, int sck, int mosi, int miso) {
+
+  CHECK_PIN(sck);
+  CHECK_PIN(mosi);
+  CHECK_PIN(miso);
+
+  // pull CS low
+  if (cs >= 0 && cs <= PIN_COUNT)
+    gpio_write(cs, 0);
+
+  uint8_t recv = 0;
+  for (int i = 0; i < 8; ++i) {
+    // clock goes low
+    gpio_write(sck, 0);
+    // shift data out
+    gpio_write(mosi, (data & 0x80) ? 1 : 0);
+    data = (data << 1);
+    // clock goes high
+    gpio_write(sck, 1);
+    // shift new data in
+    recv = (recv << 1) | (gpio_read(miso) ? 1 : 0);
+  }
+
+  // pull CS high
+  if (cs >= 0 && cs <= PIN_COUNT)
+    gpio_write(cs, 1);
+
+  return recv;
+}
+
+uint8_t spi_hw_send(uint8_t data, int cs) {
+
+  if (!state.enhanced_mode) {
+    spi_sw_init();
+    return spi_sw_send(data, cs);
+  }
+
+  // invalidate HW spi pins
+  pin_dispose(9);
+  pin_dispose(10);
+  pin_dispose(11);
+
+  // pull CS low
+  if (cs >= 0 && cs <= PIN_COUNT)
+    gpio_write(cs, 0);
+
+  // send byte to transmit
+  char out[3] = { '~' };
+  put_hex8(out + 1, data);
+  link_send(out, sizeof(out));
+
+  // send byte to receive
+  char dst[2] = { 0, 0 };
+  link_read(dst, 2);
+
+  const uint8_t ret = get_hex8(dst);
+
+  // pull CS high
+  if (cs >= 0 && cs <= PIN_COUNT)
+    gpio_write(cs, 1);
+
+  return ret;
+}
+
+void spi_hw_config(uint32_t frequency, int mode) {
+  if (!has_bulk_commands() || !link_handle) {
+    return;
+  }
+  if (frequency == state.spi_frequency && mode == state.spi_mode && setting_cache_enabled()) {
+    return;
+  }
+  // 'F' <frequency:8> <mode:1>
+  char out[10];
+  char *ptr = out;
+  *ptr++ = 'F';
+  ptr = put_hex32(ptr, frequency);
+  *ptr++ = nibble_to_hex(uint8_t(mode & 3));
+  link_send(out, ptr - out);
+
+  state.spi_frequency = frequency;
+  state.spi_mode      = mode;
+  if (record.active) {
+    record.spi_config = true;
+  }
+}
+
+void spi_hw_transfer(const uint8_t *tx, uint8_t *rx, uint32_t size, int cs, bool hold_cs) {
+
+  const bool has_cs = (cs >= 0 && cs < PIN_COUNT);
+
+  // fall back to one command per byte on older firmware
+  if (!has_bulk_commands()) {
+    if (has_cs) {
+      gpio_output(cs);
+      gpio_write(cs, 0);
+    }
+    for (uint32_t i = 0; i < size; ++i) {
+      const uint8_t recv = spi_hw_send(tx ? tx[i] : 0xff);
+      if (rx) {
+        rx[i] = recv;
+      }
+    }
+    if (has_cs && !hold_cs) {
+      gpio_write(cs, 1);
+    }
+    return;
+  }
+
+  if (!link_handle) {
+    return;
+  }
+
+  // invalidate HW spi pins
+  pin_dispose(9);
+  pin_dispose(10);
+  pin_dispose(11);
+
+  // the transfer is split into chunks with chip select held between them
+  uint32_t done = 0;
+  do {
+    const uint32_t len  = (size - done) > SPI_CHUNK ? SPI_CHUNK : (size - done);
+    const bool     last = (done + len) == size;
+
+    const uint8_t flags = (rx                 ? spi_txn_reply   : 0) |
+                          ((!last || hold_cs) ? spi_txn_hold_cs : 0);
+
+    // 'S' <cs> <flags> <len:4> <data:len*2>
+    char out[7 + SPI_CHUNK * 2];
+    char *ptr = out;
+    *ptr++ = 'S';
+    *ptr++ = pin_arg(cs);
+    *ptr++ = nibble_to_hex(flags);
+    ptr = put_hex16(ptr, uint16_t(len));
+    for (uint32_t i = 0; i < len; ++i) {
+      ptr = put_hex8(ptr, tx ? tx[done + i] : 0xff);
+    }
+    link_send(out, ptr - out);
+
+    // collect the data clocked in during the transfer
+    if (rx && len) {
+      char dst[SPI_CHUNK * 2];
+      link_read(dst, len * 2);
+      for (uint32_t i = 0; i < len; ++i) {
+        rx[done + i] = get_hex8(dst + i * 2);
+      }
+    }
+
+    done += len;
+  } while (done < size);
+
+  // the firmware now owns the chip select level
+  if (has_cs) {
+    state.pin[cs].type  = type_output;
+    state.pin[cs].drive = hold_cs ? drive_low : drive_high;
+  }
+}
+
+void spi_lcd_fill(int cs, int dc, int x0, int y0, int x1, int y1, uint16_t colour) {
+  CHECK_PIN(dc);
+
+  if (!has_bulk_commands()) {
+    lcd_window(cs, dc, x0, y0, x1, y1);
+    const uint8_t pixel[2] = { uint8_t(colour >> 8), uint8_t(colour) };
+    for (int y = y0; y <= y1; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        spi_hw_transfer(pixel, nullptr, 2, cs);
+      }
+    }
+    return;
+  }
+
+  if (!link_handle) {
+    return;
+  }
+
+  // 'LF' <cs> <dc> <x0:4> <y0:4> <x1:4> <y1:4> <colour:4>
+  char out[4 + 5 * 4];
+  char *ptr = lcd_header(out, 'F', cs, dc);
+  ptr = put_hex16(ptr, uint16_t(x0));
+  ptr = put_hex16(ptr, uint16_t(y0));
+  ptr = put_hex16(ptr, uint16_t(x1));
+  ptr = put_hex16(ptr, uint16_t(y1));
+  ptr = put_hex16(ptr, colour);
+  link_send(out, ptr - out);
+
+  // wait for the fill to complete so later commands are not dropped
+  lcd_wait_ack(uint32_t(x1 - x0 + 1) * uint32_t(y1 - y0 + 1));
+
+  lcd_pins_released(cs, dc);
+}
+
+void spi_lcd_blit_rle(int cs, int dc, int x0, int y0, int x1, int y1, const uint16_t *pixels, int stride) {
+  CHECK_PIN(dc);
+
+  if (!has_bulk_commands()) {
+    lcd_window(cs, dc, x0, y0, x1, y1);
+    for (int y = y0; y <= y1; ++y) {
+      const uint16_t *row = pixels + (y - y0) * stride;
+      for (int x = 0; x <= (x1 - x0); ++x) {
+        const uint8_t pixel[2] = { uint8_t(row[x] >> 8), uint8_t(row[x]) };
+        spi_hw_transfer(pixel, nullptr, 2, cs);
+      }
+    }
+    return;
+  }
+
+  if (!link_handle) {
+    return;
+  }
+
+  // 'LW' <cs> <dc> <x0:4> <y0:4> <x1:4> <y1:4>
+  char out[4 + 2 + LCD_RUN_CHUNK * 6];
+  char *ptr = lcd_header(out, 'W', cs, dc);
+  ptr = put_hex16(ptr, uint16_t(x0));
+  ptr = put_hex16(ptr, uint16_t(y0));
+  ptr = put_hex16(ptr, uint16_t(x1));
+  ptr = put_hex16(ptr, uint16_t(y1));
+  link_send(out, ptr - out);
+
+  // 'LR' <cs> <dc> <count:2> { <length-1:2> <colour:4> }
+  // runs are sent in chunks, each acknowledged once expanded, so the board
+  // receive buffer can never overflow while it is busy clocking out pixels
+  int      runs   = 0;
+  uint32_t chunk  = 0;  // pixels covered by the runs in this chunk
+  ptr = lcd_header(out, 'R', cs, dc) + 2;
+
+  uint16_t colour = 0;
+  int      length = 0;
+  const int w = x1 - x0 + 1;
+  const int h = y1 - y0 + 1;
+  for (int i = 0; i <= w * h; ++i) {
+    const bool end = (i == w * h);
+    const uint16_t pixel = end ? 0 : pixels[(i / w) * stride + (i % w)];
+    // extend the current run
+    if (!end && length && pixel == colour && length < 256) {
+      ++length;
+      continue;
+    }
+    // emit the current run
+    if (length) {
+      ptr = put_hex8(ptr, uint8_t(length - 1));
+      ptr = put_hex16(ptr, colour);
+      chunk += uint32_t(length);
+      ++runs;
+    }
+    // send the chunk when full or at the end of the image
+    if (runs && (runs == LCD_RUN_CHUNK || end)) {
+      put_hex8(out + 4, uint8_t(runs));
+      link_send(out, ptr - out);
+      lcd_wait_ack(chunk);
+      runs  = 0;
+      chunk = 0;
+      ptr   = out + 6;
+    }
+    colour = pixel;
+    length = 1;
+  }
+
+  lcd_pins_released(cs, dc);
+}
+
+int i2c_transfer(int addr, const uint8_t *wr, uint32_t wlen, uint8_t *rd, uint32_t rlen) {
+  if (!has_bulk_commands() || !link_handle || wlen > 255 || rlen > 255) {
+    return -1;
+  }
+
+  // invalidate HW i2c pins
+  pin_dispose(2, type_i2c);
+  pin_dispose(3, type_i2c);
+
+  // 'TX' <addr:2> <wlen:2> <rlen:2> <data:wlen*2>
+  char out[8 + 255 * 2];
+  char *ptr = out;
+  *ptr++ = 'T';
+  *ptr++ = 'X';
+  ptr = put_hex8(ptr, uint8_t(addr & 0x7f));
+  ptr = put_hex8(ptr, uint8_t(wlen));
+  ptr = put_hex8(ptr, uint8_t(rlen));
+  for (uint32_t i = 0; i < wlen; ++i) {
+    ptr = put_hex8(ptr, wr[i]);
+  }
+  link_send(out, ptr - out);
+
+  // <status:1> <data:rlen*2>
+  char dst[1 + 255 * 2];
+  if (link_read(dst, 1 + rlen * 2) != 1 + rlen * 2) {
+    return -1;
+  }
+  for (uint32_t i = 0; i < rlen; ++i) {
+    rd[i] = get_hex8(dst + 1 + i * 2);
+  }
+  return (dst[0] == '0') ? 0 : -1;
+}
+
+void i2c_config(uint32_t frequency) {
+  if (!has_bulk_commands() || !link_handle) {
+    return;
+  }
+  pin_dispose(2, type_i2c);
+  pin_dispose(3, type_i2c);
+
+  // 'TF' <frequency:8>
+  char out[10] = { 'T', 'F' };
+  put_hex32(out + 2, frequency);
+  link_send(out, sizeof(out));
+}
+
+bool adc_stream_start(uint32_t rate, int channels, adc_stream_callback_t callback, int cs) {
+  CHECK_PIN(cs);
+
+  if (!has_bulk_commands() || !link_handle || !rate || !(channels & 3)) {
+    return false;
+  }
+
+  // invalidate HW spi pins
+  pin_dispose(9);
+  pin_dispose(10);
+  pin_dispose(11);
+
+  state.adc_callback = callback;
+
+  // 'Q' <cs> <channels:1> <period_us:8>
+  char out[3 + 8];
+  char *ptr = out;
+  *ptr++ = 'Q';
+  *ptr++ = pin_arg(cs);
+  *ptr++ = nibble_to_hex(uint8_t(channels & 3));
+  ptr = put_hex32(ptr, 1000000 / rate);
+  link_send(out, ptr - out);
+
+  // <status:1>, 1 when the chip select can not be used
+  char status = '\0';
+  if (link_read(&status, 1) != 1 || status != '0') {
+    state.adc_callback = nullptr;
+    return false;
+  }
+
+  // the firmware now owns the chip select level
+  state.pin[cs].type  = type_output;
+  state.pin[cs].drive = drive_high;
+  return true;
+}
+
+void adc_stream_stop(void) {
+  if (has_bulk_commands() && link_handle) {
+    link_send("Q-000000000", 11);
+    // <status:1>
+    char status = '\0';
+    link_read(&status, 1);
+  }
+  state.adc_callback = nullptr;
+}
+
+bool dac_wave_load(uint32_t offset, const uint16_t *samples, uint32_t count) {
+  if (!has_bulk_commands() || !link_handle || offset + count > dac_wave_pool) {
+    return false;
+  }
+  // 'GT' <offset:4> <count:4> { <sample:3> }
+  for (uint32_t done = 0; done < count;) {
+    const uint32_t len = (count - done) > WAVE_CHUNK ? WAVE_CHUNK : (count - done);
+    char out[10 + WAVE_CHUNK * 3];
+    char *ptr = out;
+    *ptr++ = 'G';
+    *ptr++ = 'T';
+    ptr = put_hex16(ptr, uint16_t(offset + done));
+    ptr = put_hex16(ptr, uint16_t(len));
+    for (uint32_t i = 0; i < len; ++i) {
+      const uint16_t x = samples[done + i];
+      *ptr++ = nibble_to_hex((x >> 8) & 0xf);
+      *ptr++ = nibble_to_hex((x >> 4) & 0xf);
+      *ptr++ = nibble_to_hex((x     ) & 0xf);
+    }
+    link_send(out, ptr - out);
+    done += len;
+  }
+  return true;
+}
+
+void dac_wave_select(int channel, uint32_t offset, uint32_t length) {
+  if (!has_bulk_commands() || !link_handle) {
+    return;
+  }
+  // 'GC' <channel:1> <offset:4> <length:4>
+  char out[11];
+  char *ptr = out;
+  *ptr++ = 'G';
+  *ptr++ = 'C';
+  *ptr++ = nibble_to_hex(uint8_t(channel & 1));
+  ptr = put_hex16(ptr, uint16_t(offset));
+  ptr = put_hex16(ptr, uint16_t(length));
+  link_send(out, ptr - out);
+}
+
+bool dac_wave_start(uint32_t rate, int cs) {
+  CHECK_PIN(cs);
+
+  if (!has_bulk_commands() || !link_handle || !rate) {
+    return false;
+  }
+
+  // invalidate HW spi pins
+  pin_dispose(9);
+  pin_dispose(10);
+  pin_dispose(11);
+
+  // 'GS' <cs> <period_us:8>
+  char out[11];
+  char *ptr = out;
+  *ptr++ = 'G';
+  *ptr++ = 'S';
+  *ptr++ = pin_arg(cs);
+  ptr = put_hex32(ptr, 1000000 / rate);
+  link_send(out, ptr - out);
+
+  // the firmware now owns the chip select level
+  state.pin[cs].type  = type_output;
+  state.pin[cs].drive = drive_high;
+  return true;
+}
+
+void dac_wave_stop(void) {
+  if (has_bulk_commands() && link_handle) {
+    link_send("GS-00000000", 11);
+  }
+}
+
+bool ws2812_show(const uint8_t *pixels, uint32_t count) {
+  if (!has_bulk_commands() || !link_handle || count > ws2812_max_pixels) {
+    return false;
+  }
+
+  // invalidate HW spi pins
+  pin_dispose(9);
+  pin_dispose(10);
+  pin_dispose(11);
+
+  // 'Y' <len:4> <data:len*2>
+  const uint32_t size = count * 3;
+  char out[5 + ws2812_max_pixels * 3 * 2];
+  char *ptr = out;
+  *ptr++ = 'Y';
+  ptr = put_hex16(ptr, uint16_t(size));
+  for (uint32_t i = 0; i < size; ++i) {
+    ptr = put_hex8(ptr, pixels[i]);
+  }
+  link_send(out, ptr - out);
+
+  // the board replies once the LEDs have latched the data
+  char ack = '\0';
+  return link_read(&ack, 1) == 1;
+}
+
+// start a 'Z' 1-Wire command
+static char *onewire_header(char *dst, char op, int pin) {
+  *dst++ = 'Z';
+  *dst++ = op;
+  *dst++ = pin_arg(pin);
+  // the firmware now owns the bus pin
+  pin_dispose(pin, type_unknown);
+  return dst;
+}
+
+// dallas CRC8 of 1-Wire ROM codes and scratchpads
+static uint8_t onewire_crc8(const uint8_t *data, uint32_t size) {
+  uint8_t crc = 0;
+  for (uint32_t i = 0; i < size; ++i) {
+    crc ^= data[i];
+    for (int j = 0; j < 8; ++j) {
+      crc = (crc & 1) ? ((crc >> 1) ^ 0x8C) : (crc >> 1);
+    }
+  }
+  return crc;
+}
+
+bool onewire_reset(int pin) {
+  CHECK_PIN(pin);
+  if (!has_bulk_commands() || !link_handle) {
+    return false;
+  }
+  // 'ZR' <pin>
+  char out[3];
+  onewire_header(out, 'R', pin);
+  link_send(out, sizeof(out));
+  char status = '1';
+  return link_read(&status, 1) == 1 && status == '0';
+}
+
+bool onewire_write(int pin, const uint8_t *data, uint32_t size, bool power) {
+  CHECK_PIN(pin);
+  if (!has_bulk_commands() || !link_handle) {
+    return false;
+  }
+  uint32_t done = 0;
+  while (done < size) {
+    const uint32_t len  = (size - done) > ONEWIRE_CHUNK ? ONEWIRE_CHUNK : (size - done);
+    const bool     last = done + len == size;
+    // 'ZW' <pin> <flags:1> <len:2> <data:len*2>
+    char out[6 + ONEWIRE_CHUNK * 2];
+    char *ptr = onewire_header(out, 'W', pin);
+    *ptr++ = (power && last) ? '1' : '0';
+    ptr = put_hex8(ptr, uint8_t(len));
+    for (uint32_t i = 0; i < len; ++i) {
+      ptr = put_hex8(ptr, data[done + i]);
+    }
+    link_send(out, ptr - out);
+    // the board replies once the chunk is on the bus, a byte takes ~0.6ms
+    char ack = '\0';
+    if (link_read_wait(&ack, 1, 100 + len) != 1 || ack != 'K') {
+      return false;
+    }
+    done += len;
+  }
+  return true;
+}
+
+bool onewire_read(int pin, uint8_t *data, uint32_t size) {
+  CHECK_PIN(pin);
+  if (!has_bulk_commands() || !link_handle) {
+    return false;
+  }
+  uint32_t done = 0;
+  while (done < size) {
+    const uint32_t len = (size - done) > ONEWIRE_CHUNK ? ONEWIRE_CHUNK : (size - done);
+    // 'ZI' <pin> <len:2>
+    char out[5];
+    put_hex8(onewire_header(out, 'I', pin), uint8_t(len));
+    link_send(out, sizeof(out));
+    char in[ONEWIRE_CHUNK * 2];
+    if (link_read(in, len * 2) != len * 2) {
+      return false;
+    }
+    for (uint32_t i = 0; i < len; ++i) {
+      data[done + i] = get_hex8(in + i * 2);
+    }
+    done += len;
+  }
+  return true;
+}
+
+int onewire_search(int pin, uint64_t *roms, int max) {
+  CHECK_PIN(pin);
+  if (!has_bulk_commands() || !link_handle) {
+    return 0;
+  }
+  // 'ZS' <pin>
+  char out[3];
+  onewire_header(out, 'S', pin);
+  link_send(out, sizeof(out));
+
+  // the board sends each ROM code as it finds it, then '-'
+  int found = 0;
+  for (;;) {
+    char in[16];
+    // finding a device takes around 15ms of bus time
+    if (link_read_wait(in, 1, 200) != 1 || in[0] == '-') {
+      break;
+    }
+    if (link_read(in + 1, 15) != 15) {
+      break;
+    }
+    uint8_t rom[8];
+    for (int i = 0; i < 8; ++i) {
+      rom[i] = get_hex8(in + i * 2);
+    }
+    if (onewire_crc8(rom, 7) != rom[7] || found >= max) {
+      continue;
+    }
+    uint64_t code = 0;
+    for (int i = 7; i >= 0; --i) {
+      code = (code << 8) | rom[i];
+    }
+    roms[found++] = code;
+  }
+  return found;
+}
+
+bool ds18b20_convert_all(int pin, bool parasite) {
+  if (!onewire_reset(pin)) {
+    return false;
+  }
+  // skip ROM then convert T
+  const uint8_t cmd[2] = { 0xCC, 0x44 };
+  return onewire_write(pin, cmd, sizeof(cmd), parasite);
+}
+
+int ds18b20_read_all(int pin, const uint64_t *roms, int count, float *celsius) {
+  CHECK_PIN(pin);
+  for (int i = 0; i < count; ++i) {
+    celsius[i] = NAN;
+  }
+  if (!has_bulk_commands() || !link_handle) {
+    return 0;
+  }
+  int good = 0;
+  for (int done = 0; done < count; ) {
+    const int len = (count - done) > ONEWIRE_QUERY ? ONEWIRE_QUERY : (count - done);
+    // 'ZQ' <pin> <count:2> { <rom:16> }
+    char out[5 + ONEWIRE_QUERY * 16];
+    char *ptr = put_hex8(onewire_header(out, 'Q', pin), uint8_t(len));
+    for (int i = 0; i < len; ++i) {
+      for (int j = 0; j < 8; ++j) {
+        ptr = put_hex8(ptr, uint8_t(roms[done + i] >> (j * 8)));
+      }
+    }
+    link_send(out, ptr - out);
+
+    // the board replies with the 9 byte scratchpad of each sensor, taking
+    // around 7ms of bus time for each
+    char in[ONEWIRE_QUERY * 18];
+    if (link_read_wait(in, len * 18, 100 + len * 10) != uint32_t(len * 18)) {
+      break;
+    }
+    for (int i = 0; i < len; ++i) {
+      uint8_t pad[9];
+      for (int j = 0; j < 9; ++j) {
+        pad[j] = get_hex8(in + i * 18 + j * 2);
+      }
+      if (onewire_crc8(pad, 8) != pad[8]) {
+        continue;
+      }
+      const int16_t raw = int16_t(pad[0] | (pad[1] << 8));
+      // the DS18S20 counts in half degrees, the others in sixteenths
+      const bool half = (roms[done + i] & 0xff) == 0x10;
+      celsius[done + i] = half ? raw / 2.f : raw / 16.f;
+      ++good;
+    }
+    done += len;
+  }
+  return good;
+}
+
+bool gpio_pwm(int pin, uint32_t period_us, uint32_t width_us) {
+  CHECK_PIN(pin);
+  if (!has_bulk_commands() || !link_handle) {
+    return false;
+  }
+  // '%' <pin> <period:8> <width:8>
+  char out[18];
+  char *ptr = out;
+  *ptr++ = '%';
+  *ptr++ = pin_arg(pin);
+  ptr = put_hex32(ptr, period_us);
+  ptr = put_hex32(ptr, width_us);
+  link_send(out, ptr - out);
+
+  state.pin[pin].type  = type_output;
+  state.pin[pin].drive = drive_unknown;
+  if (!period_us || !width_us) {
+    state.pin[pin].drive = drive_low;
+  }
+  else if (width_us >= period_us) {
+    state.pin[pin].drive = drive_high;
+  }
+  return true;
+}
+
+bool gpio_servo(int pin, uint32_t pulse_us) {
+  return gpio_pwm(pin, pulse_us ? 20000 : 0, pulse_us);
+}
+
+bool uart_open(uint32_t baud) {
+  if (!has_bulk_commands() || !link_handle || !baud) {
+    return false;
+  }
+
+  // invalidate USART2 pins
+  pin_dispose(14, type_uart);
+  pin_dispose(15, type_uart);
+
+  uart_rx.head = uart_rx.tail = 0;
+
+  // 'XO' <baud:8>
+  char out[10] = { 'X', 'O' };
+  put_hex32(out + 2, baud);
+  link_send(out, sizeof(out));
+  return true;
+}
+
+void uart_close(void) {
+  if (has_bulk_commands() && link_handle) {
+    link_send("XO00000000", 10);
+  }
+}
+
+uint32_t uart_write(const void *src, uint32_t size) {
+  if (!has_bulk_commands() || !link_handle) {
+    return 0;
+  }
+  const uint8_t *in = (const uint8_t*)src;
+  uint32_t done = 0;
+  while (done < size) {
+    const uint32_t len = (size - done) > UART_CHUNK ? UART_CHUNK : (size - done);
+    // 'XW' <len:2> <data:len*2>
+    char out[4 + UART_CHUNK * 2] = { 'X', 'W' };
+    char *ptr = put_hex8(out + 2, uint8_t(len));
+    for (uint32_t i = 0; i < len; ++i) {
+      ptr = put_hex8(ptr, in[done + i]);
+    }
+    link_send(out, ptr - out);
+    // wait until the board has buffered the chunk
+    char ack = '\0';
+    if (link_read(&ack, 1) != 1) {
+      break;
+    }
+    done += len;
+  }
+  return done;
+}
+
+uint32_t uart_read(void *dst, uint32_t size) {
+  gpio_poll();
+  uint8_t *out = (uint8_t*)dst;
+  uint32_t got = 0;
+  while (got < size && uart_rx.tail != uart_rx.head) {
+    out[got++] = uart_rx.data[uart_rx.tail];
+    uart_rx.tail = (uart_rx.tail + 1) % UART_RX_SIZE;
+  }
+  return got;
+}
+
+int32_t gpio_wait_level(int pin, int level, uint32_t timeout_us) {
+  CHECK_PIN(pin);
+
+  // poll from the host on older firmware
+  if (!has_bulk_commands()) {
+    const uint64_t start = host_time_us();
+    for (;;) {
+      const uint64_t elapsed = host_time_us() - start;
+      if (gpio_read(pin) == (level ? 1 : 0)) {
+        return int32_t(elapsed);
+      }
+      if (!link_handle || elapsed >= timeout_us) {
+        return -1;
+      }
+    }
+  }
+
+  if (!link_handle) {
+    return -1;
+  }
+
+  // 'WP' <pin> <level:1> <timeout:8>
+  char out[12];
+  char *ptr = out;
+  *ptr++ = 'W';
+  *ptr++ = 'P';
+  *ptr++ = pin_arg(pin);
+  *ptr++ = level ? '1' : '0';
+  ptr = put_hex32(ptr, timeout_us);
+  link_send(out, ptr - out);
+
+  // <status:1> <elapsed:8>
+  char dst[9];
+  if (link_read_wait(dst, sizeof(dst), timeout_us / 1000 + 100) != sizeof(dst) ||
+      dst[0] != '0') {
+    return -1;
+  }
+  return int32_t(get_hex32(dst + 1));
+}
+
+bool spi_wait_status_queue(uint8_t cmd, uint8_t mask, uint8_t value, uint32_t timeout_us, int cs) {
+
+  const bool has_cs = (cs >= 0 && cs < PIN_COUNT);
+
+  if (wait_queue.count >= WAIT_QUEUE_SIZE) {
+    return false;
+  }
+  const int slot = (wait_queue.head + wait_queue.count) % WAIT_QUEUE_SIZE;
+
+  // poll from the host on older firmware, keeping the result for later
+  if (!has_bulk_commands()) {
+    const uint64_t start = host_time_us();
+    for (;;) {
+      const uint64_t elapsed = host_time_us() - start;
+      const uint8_t tx[2] = { cmd, 0xff };
+      uint8_t rx[2] = { 0, 0 };
+      spi_hw_transfer(tx, rx, 2, cs);
+      wait_queue.status[slot] = rx[1];
+      if ((rx[1] & mask) == value) {
+        wait_queue.result[slot] = int32_t(elapsed);
+        break;
+      }
+      if (!link_handle || elapsed >= timeout_us) {
+        wait_queue.result[slot] = -1;
+        break;
+      }
+    }
+    ++wait_queue.count;
+    return true;
+  }
+
+  if (!link_handle) {
+    return false;
+  }
+
+  // invalidate HW spi pins
+  pin_dispose(9);
+  pin_dispose(10);
+  pin_dispose(11);
+
+  // 'WS' <cs> <cmd:2> <mask:2> <value:2> <timeout:8>
+  char out[17];
+  char *ptr = out;
+  *ptr++ = 'W';
+  *ptr++ = 'S';
+  *ptr++ = pin_arg(cs);
+  ptr = put_hex8(ptr, cmd);
+  ptr = put_hex8(ptr, mask);
+  ptr = put_hex8(ptr, value);
+  ptr = put_hex32(ptr, timeout_us);
+  link_send(out, ptr - out);
+
+  // the firmware now owns the chip select level
+  if (has_cs) {
+    state.pin[cs].type  = type_output;
+    state.pin[cs].drive = drive_high;
+  }
+
+  wait_queue.timeout_ms[slot] = timeout_us / 1000 + 100;
+  ++wait_queue.count;
+  return true;
+}
+
+int32_t spi_wait_status_result(uint8_t *status) {
+  if (!wait_queue.count) {
+    return -1;
+  }
+  const int slot = wait_queue.head;
+  wait_queue.head = (wait_queue.head + 1) % WAIT_QUEUE_SIZE;
+  --wait_queue.count;
+
+  if (!has_bulk_commands()) {
+    if (status) {
+      *status = wait_queue.status[slot];
+    }
+    return wait_queue.result[slot];
+  }
+
+  // <status:1> <elapsed:8> <spi status:2>
+  char dst[11];
+  if (link_read_wait(dst, sizeof(dst), wait_queue.timeout_ms[slot]) != sizeof(dst)) {
+    return -1;
+  }
+  if (status) {
+    *status = get_hex8(dst + 9);
+  }
+  return (dst[0] == '0') ? int32_t(get_hex32(dst + 1)) : -1;
+}
+
+int32_t spi_wait_status(uint8_t cmd, uint8_t mask, uint8_t value, uint32_t timeout_us, int cs) {
+  // collect anything already queued so the replies stay in order
+  while (wait_queue.count) {
+    spi_wait_status_result(nullptr);
+  }
+  if (!spi_wait_status_queue(cmd, mask, value, timeout_us, cs)) {
+    return -1;
+  }
+  return spi_wait_status_result(nullptr);
+}
+
+uint32_t gpio_crc32(uint32_t crc, const void *data, uint32_t size) {
+  const uint8_t *src = (const uint8_t*)data;
+  crc = ~crc;
+  for (uint32_t i = 0; i < size; ++i) {
+    crc ^= src[i];
+    for (int j = 0; j < 8; ++j) {
+      crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320u : 0);
+    }
+  }
+  return ~crc;
+}
+
+bool spi_crc32(const uint8_t *header, uint32_t header_size, uint32_t size, uint32_t *crc, int cs) {
+  if (header_size > 15) {
+    return false;
+  }
+
+  // read the data back and check it on the host with older firmware
+  if (!has_bulk_commands()) {
+    if (!link_handle) {
+      return false;
+    }
+    if (header_size) {
+      spi_hw_transfer(header, nullptr, header_size, cs, /*hold_cs=*/true);
+    }
+    uint8_t block[SPI_CHUNK];
+    uint32_t value = 0;
+    uint32_t done  = 0;
+    do {
+      const uint32_t len = (size - done) > SPI_CHUNK ? SPI_CHUNK : (size - done);
+      spi_hw_transfer(nullptr, block, len, cs, /*hold_cs=*/(done + len) < size);
+      value = gpio_crc32(value, block, len);
+      done += len;
+    } while (done < size);
+    *crc = value;
+    return true;
+  }
+
+  if (!link_handle) {
+    return false;
+  }
+
+  // invalidate HW spi pins
+  pin_dispose(9);
+  pin_dispose(10);
+  pin_dispose(11);
+
+  // 'C' <cs> <hlen:1> <header:hlen*2> <len:8>
+  char out[12 + 15 * 2];
+  char *ptr = out;
+  *ptr++ = 'C';
+  *ptr++ = pin_arg(cs);
+  *ptr++ = nibble_to_hex(uint8_t(header_size));
+  for (uint32_t i = 0; i < header_size; ++i) {
+    ptr = put_hex8(ptr, header[i]);
+  }
+  ptr = put_hex32(ptr, size);
+  link_send(out, ptr - out);
+
+  if (cs >= 0 && cs < PIN_COUNT) {
+    state.pin[cs].type  = type_output;
+    state.pin[cs].drive = drive_high;
+  }
+
+  // the board clocks the data in at the SPI rate, allow for its overheads
+  const uint32_t wait_ms = 100 + size / 32;
+  char in[8];
+  if (link_read_wait(in, sizeof(in), wait_ms) != sizeof(in)) {
+    return false;
+  }
+  *crc = get_hex32(in);
+  return true;
+}
+
+int32_t gpio_pulse_in(int pin, int level, uint32_t timeout_us) {
+  CHECK_PIN(pin);
+  if (!has_bulk_commands() || !link_handle) {
+    return -1;
+  }
+
+  // 'HP' <pin> <level:1> <timeout:8>
+  char out[12];
+  char *ptr = out;
+  *ptr++ = 'H';
+  *ptr++ = 'P';
+  *ptr++ = pin_arg(pin);
+  *ptr++ = level ? '1' : '0';
+  ptr = put_hex32(ptr, timeout_us);
+  link_send(out, ptr - out);
+
+  // <status:1> <width:8> [<stamp:8>]
+  char dst[17];
+  const uint32_t size = state.timestamps ? 17 : 9;
+  if (link_read_wait(dst, size, timeout_us / 1000 + 100) != size ||
+      dst[0] != '0') {
+    return -1;
+  }
+  if (state.timestamps) {
+    state.last_timestamp = get_board_time(dst + 9);
+  }
+  return int32_t(get_hex32(dst + 1));
+}
+
+double gpio_measure_freq(int pin, double *duty, uint32_t timeout_us) {
+  CHECK_PIN(pin);
+  if (duty) {
+    *duty = 0.0;
+  }
+  if (!has_bulk_commands() || !link_handle) {
+    return 0.0;
+  }
+
+  // 'HF' <pin> <timeout:8>
+  char out[11];
+  char *ptr = out;
+  *ptr++ = 'H';
+  *ptr++ = 'F';
+  *ptr++ = pin_arg(pin);
+  ptr = put_hex32(ptr, timeout_us);
+  link_send(out, ptr - out);
+
+  // <status:1> <cycles:4> <period:8> <high:8> [<stamp:8>]
+  char dst[29];
+  const uint32_t size = state.timestamps ? 29 : 21;
+  if (link_read_wait(dst, size, timeout_us / 1000 + 100) != size ||
+      dst[0] != '0') {
+    return 0.0;
+  }
+  if (state.timestamps) {
+    state.last_timestamp = get_board_time(dst + 21);
+  }
+  const uint32_t cycles = (uint32_t(get_hex8(dst + 1)) << 8) | get_hex8(dst + 3);
+  const uint32_t period = get_hex32(dst + 5);
+  const uint32_t high   = get_hex32(dst + 13);
+  if (!cycles || !period) {
+    return 0.0;
+  }
+  if (duty) {
+    *duty = double(high) / double(period);
+  }
+  return double(cycles) * 1000000.0 / double(period);
+}
+
+bool gpio_timestamps(bool enable) {
+  if (!has_bulk_commands() || !link_handle) {
+    return false;
+  }
+  // '@' <enable:1>
+  link_send(enable ? "@1" : "@0", 2);
+  // anything received before the acknowledgement is in the old format
+  char ack = '\0';
+  if (link_read(&ack, 1) != 1) {
+    return false;
+  }
+  state.timestamps = enable;
+  return true;
+}
+
+uint64_t gpio_last_timestamp(void) {
+  return state.last_timestamp;
+}
+
+int32_t gpio_ping(void) {
+  if (!has_bulk_commands() || !link_handle) {
+    return -1;
+  }
+  // 'P' replies <time:8>
+  const uint64_t start = host_time_us();
+  link_send("P", 1);
+  char dst[8];
+  if (link_read(dst, sizeof(dst)) != sizeof(dst)) {
+    return -1;
+  }
+  const uint64_t end = host_time_us();
+
+  // keep the most recent results
+  const int i = clock_sync.next;
+  clock_sync.board[i] = get_board_time(dst);
+  clock_sync.host[i]  = start + (end - start) / 2;
+  clock_sync.rtt[i]   = uint32_t(end - start);
+  clock_sync.next     = (clock_sync.next + 1) % SYNC_SAMPLES;
+  if (clock_sync.count < SYNC_SAMPLES) {
+    ++clock_sync.count;
+  }
+  clock_sync_update();
+  return int32_t(end - start);
+}
+
+uint64_t gpio_board_time_to_host(uint64_t board_us) {
+  if (clock_sync.count == 0 && gpio_ping() < 0) {
+    return 0;
+  }
+  const double delta = double(int64_t(board_us - clock_sync.board_ref)) * clock_sync.rate;
+  return clock_sync.host_ref + int64_t(delta);
+}
+
+double gpio_clock_drift(void) {
+  return (clock_sync.count > 1) ? (clock_sync.rate - 1.0) * 1e6 : 0.0;
+}
+
+uint64_t gpio_host_time(void) {
+  return host_time_us();
+}
+
+bool gpio_encoder_open(int id, int pin_a, int pin_b) {
+  CHECK_PIN(pin_a);
+  CHECK_PIN(pin_b);
+  if (!has_bulk_commands() || !link_handle || id < 0 || id >= gpio_encoder_count) {
+    return false;
+  }
+  pin_dispose(pin_a, type_encoder);
+  pin_dispose(pin_b, type_encoder);
+  state.encoder_callback[id] = nullptr;
+
+  // 'EO' <id:1> <a> <b>
+  const char out[5] = { 'E', 'O', nibble_to_hex(uint8_t(id)), pin_arg(pin_a), pin_arg(pin_b) };
+  link_send(out, sizeof(out));
+
+  // <status:1>
+  char status = '\0';
+  link_read(&status, 1);
+  return status == '0';
+}
+
+void gpio_encoder_close(int id) {
+  if (!has_bulk_commands() || !link_handle || id < 0 || id >= gpio_encoder_count) {
+    return;
+  }
+  const char out[5] = { 'E', 'O', nibble_to_hex(uint8_t(id)), '-', '-' };
+  link_send(out, sizeof(out));
+  char status = '\0';
+  link_read(&status, 1);
+  state.encoder_callback[id] = nullptr;
+}
+
+int32_t gpio_encoder_read(int id) {
+  if (!has_bulk_commands() || !link_handle || id < 0 || id >= gpio_encoder_count) {
+    return 0;
+  }
+  // 'ER' <id:1>
+  const char out[3] = { 'E', 'R', nibble_to_hex(uint8_t(id)) };
+  link_send(out, sizeof(out));
+
+  // <count:8> [<stamp:8>]
+  char dst[16];
+  const uint32_t size = state.timestamps ? 16 : 8;
+  if (link_read(dst, size) != size) {
+    return 0;
+  }
+  if (state.timestamps) {
+    state.last_timestamp = get_board_time(dst + 8);
+  }
+  return int32_t(get_hex32(dst));
+}
+
+void gpio_encoder_zero(int id) {
+  if (!has_bulk_commands() || !link_handle || id < 0 || id >= gpio_encoder_count) {
+    return;
+  }
+  // 'EZ' <id:1>
+  const char out[3] = { 'E', 'Z', nibble_to_hex(uint8_t(id)) };
+  link_send(out, sizeof(out));
+}
+
+void gpio_encoder_notify(int id, uint32_t interval_ms, encoder_callback_t callback) {
+  if (!has_bulk_commands() || !link_handle || id < 0 || id >= gpio_encoder_count) {
+    return;
+  }
+  state.encoder_callback[id] = callback;
+  // 'EN' <id:1> <interval:4>
+  char out[7] = { 'E', 'N', nibble_to_hex(uint8_t(id)) };
+  put_hex16(out + 3, uint16_t(callback ? interval_ms : 0));
+  link_send(out, sizeof(out));
+}
+
+bool gpio_keypad_start(const int *rows, int num_rows, const int *cols, int num_cols,
+                       uint32_t debounce_ms, keypad_callback_t callback) {
+  if (!has_bulk_commands() || !link_handle ||
+      num_rows < 1 || num_rows > gpio_keypad_lines ||
+      num_cols < 1 || num_cols > gpio_keypad_lines) {
+    return false;
+  }
+  // 'KM' <rows:1> <cols:1> { <row> } { <col> } <debounce:2>
+  char out[6 + gpio_keypad_lines * 2];
+  char *ptr = out;
+  *ptr++ = 'K';
+  *ptr++ = 'M';
+  *ptr++ = nibble_to_hex(uint8_t(num_rows));
+  *ptr++ = nibble_to_hex(uint8_t(num_cols));
+  for (int i = 0; i < num_rows; ++i) {
+    CHECK_PIN(rows[i]);
+    *ptr++ = pin_arg(rows[i]);
+    // the firmware pulls rows up to read them
+    state.pin[rows[i]].type  = type_input;
+    state.pin[rows[i]].pull  = pull_up;
+    state.pin[rows[i]].drive = drive_unknown;
+  }
+  for (int i = 0; i < num_cols; ++i) {
+    CHECK_PIN(cols[i]);
+    *ptr++ = pin_arg(cols[i]);
+    // the firmware now owns the column direction
+    pin_dispose(cols[i], type_unknown);
+  }
+  ptr = put_hex8(ptr, uint8_t(debounce_ms > 255 ? 255 : debounce_ms));
+  link_send(out, ptr - out);
+
+  state.keypad_callback = callback;
+  state.keypad_cols     = num_cols;
+  return true;
+}
+
+void gpio_keypad_stop(void) {
+  if (has_bulk_commands() && link_handle) {
+    link_send("KM0", 3);
+  }
+  state.keypad_callback = nullptr;
+}
+
+// internal ADC capable pins in the order the board scans them
+static const int analog_scan_order[gpio_analog_pins] = { 0, 14, 15, 11, 9, 10, 26, 18 };
+
+int gpio_analog_read(int pin) {
+  CHECK_PIN(pin);
+  if (!has_bulk_commands() || !link_handle) {
+    return -1;
+  }
+  // 'AR' <pin>
+  const char out[3] = { 'A', 'R', pin_arg(pin) };
+  link_send(out, sizeof(out));
+  // <status:1> <value:3> [<stamp:8>]
+  char in[12] = { 0 };
+  const uint32_t size = state.timestamps ? 12 : 4;
+  if (link_read(in, size) != size || in[0] != '0') {
+    return -1;
+  }
+  if (state.timestamps) {
+    state.last_timestamp = get_board_time(in + 4);
+  }
+  bool scanned = false;
+  for (int i = 0; i < state.analog_count; ++i) {
+    scanned = scanned || state.analog_pins[i] == pin;
+  }
+  if (!scanned) {
+    // the board stops any scan to make a single conversion
+    state.analog_count    = 0;
+    state.analog_callback = nullptr;
+    pin_dispose(pin, type_unknown);
+  }
+  return (hex_to_nibble(in[1]) << 8) | (hex_to_nibble(in[2]) << 4) | hex_to_nibble(in[3]);
+}
+
+bool gpio_analog_scan(const int *pins, int count, uint32_t interval_ms, analog_callback_t callback) {
+  if (!has_bulk_commands() || !link_handle) {
+    return false;
+  }
+  uint32_t mask = 0;
+  for (int i = 0; i < count; ++i) {
+    CHECK_PIN(pins[i]);
+    mask |= 1u << pins[i];
+  }
+  state.analog_count = 0;
+  for (int i = 0; i < gpio_analog_pins; ++i) {
+    const int pin = analog_scan_order[i];
+    if (mask & (1u << pin)) {
+      state.analog_pins[state.analog_count++] = pin;
+      pin_dispose(pin, type_unknown);
+      mask &= ~(1u << pin);
+    }
+  }
+  if (mask) {
+    // not every pin has an ADC channel
+    state.analog_count = 0;
+    return false;
+  }
+  uint32_t scan_mask = 0;
+  for (int i = 0; i < state.analog_count; ++i) {
+    scan_mask |= 1u << state.analog_pins[i];
+  }
+  // 'AS' <pins:8> <interval:4>
+  char out[14] = { 'A', 'S' };
+  char *ptr = put_hex32(out + 2, scan_mask);
+  put_hex16(ptr, uint16_t(callback ? (interval_ms > 0xffff ? 0xffff : interval_ms) : 0));
+  link_send(out, sizeof(out));
+  state.analog_callback = callback;
+  return true;
+}
+
+void gpio_analog_stop(void) {
+  if (has_bulk_commands() && link_handle) {
+    link_send("AS000000000000", 14);
+  }
+  state.analog_count    = 0;
+  state.analog_callback = nullptr;
+}
+
+bool gpio_debounce(int pin, uint32_t debounce_ms, debounce_callback_t callback) {
+  CHECK_PIN(pin);
+  if (!has_bulk_commands() || !link_handle) {
+    return false;
+  }
+  if (!callback) {
+    debounce_ms = 0;
+  }
+  // 'KD' <pin> <debounce:2>
+  char out[5] = { 'K', 'D', pin_arg(pin) };
+  put_hex8(out + 3, uint8_t(debounce_ms > 255 ? 255 : debounce_ms));
+  link_send(out, sizeof(out));
+
+  if (debounce_ms) {
+    state.pin[pin].type = type_input;
+  }
+  state.debounce_callback[pin] = debounce_ms ? callback : nullptr;
+  return true;
+}
+
+bool gpio_bus_define(int id, const int *data, int width, int strobe, int rs, int rw,
+                     uint32_t delay_us, int flags) {
+  CHECK_PIN(strobe);
+  if (!link_handle || id < 0 || id >= gpio_bus_count || (width != 4 && width != 8)) {
+    return false;
+  }
+  for (int i = 0; i < width; ++i) {
+    CHECK_PIN(data[i]);
+  }
+  if (rs >= PIN_COUNT || rw >= PIN_COUNT) {
+    return false;
+  }
+  rs = rs < 0 ? -1 : rs;
+  rw = rw < 0 ? -1 : rw;
+  bus_def_t &bus = bus_def[id];
+  bus.width    = width;
+  bus.strobe   = strobe;
+  bus.rs       = rs;
+  bus.rw       = rw;
+  bus.delay_us = delay_us > 0xffff ? 0xffff : delay_us;
+  bus.flags    = flags;
+  for (int i = 0; i < width; ++i) {
+    bus.data[i] = data[i];
+  }
+
+  if (!has_bulk_commands()) {
+    // drive the idle levels ourselves
+    gpio_write(strobe, (flags & gpio_bus_strobe_low) ? 1 : 0);
+    gpio_output(strobe);
+    if (rs >= 0) {
+      gpio_write(rs, 0);
+      gpio_output(rs);
+    }
+    if (rw >= 0) {
+      gpio_write(rw, 0);
+      gpio_output(rw);
+    }
+    for (int i = 0; i < width; ++i) {
+      gpio_write(data[i], 0);
+      gpio_output(data[i]);
+    }
+    return true;
+  }
+
+  // 'BD' <id:1> <width:1> <flags:1> <strobe> <rs> <rw> <delay:4> { <data> }
+  char out[13 + 8];
+  char *ptr = out;
+  *ptr++ = 'B';
+  *ptr++ = 'D';
+  *ptr++ = nibble_to_hex(uint8_t(id));
+  *ptr++ = nibble_to_hex(uint8_t(width));
+  *ptr++ = nibble_to_hex(uint8_t(flags & 0xf));
+  *ptr++ = pin_arg(strobe);
+  *ptr++ = pin_arg(rs);
+  *ptr++ = pin_arg(rw);
+  ptr = put_hex16(ptr, uint16_t(bus.delay_us));
+  for (int i = 0; i < width; ++i) {
+    *ptr++ = pin_arg(data[i]);
+  }
+  link_send(out, ptr - out);
+
+  // the firmware leaves every bus pin an output at its idle level
+  state.pin[strobe].type  = type_output;
+  state.pin[strobe].drive = (flags & gpio_bus_strobe_low) ? drive_high : drive_low;
+  if (rs >= 0) {
+    state.pin[rs].type  = type_output;
+    state.pin[rs].drive = drive_low;
+  }
+  if (rw >= 0) {
+    state.pin[rw].type  = type_output;
+    state.pin[rw].drive = drive_low;
+  }
+  for (int i = 0; i < width; ++i) {
+    state.pin[data[i]].type  = type_output;
+    state.pin[data[i]].drive = drive_low;
+  }
+  return true;
+}
+
+// put a value on the data pins of a bus and strobe it from the host
+// the serial round trips easily cover the setup and hold times
+static void bus_strobe_host(const bus_def_t &bus, uint8_t value, int bits) {
+  for (int i = 0; i < bits; ++i) {
+    gpio_write(bus.data[i], (value >> i) & 1);
+  }
+  const int active = (bus.flags & gpio_bus_strobe_low) ? 0 : 1;
+  gpio_write(bus.strobe, active);
+  gpio_write(bus.strobe, !active);
+}
+
+bool gpio_bus_write(int id, int mode, const uint8_t *data, uint32_t size) {
+  if (!link_handle || id < 0 || id >= gpio_bus_count || !bus_def[id].width) {
+    return false;
+  }
+  const bus_def_t &bus = bus_def[id];
+
+  if (!has_bulk_commands()) {
+    if (bus.rs >= 0) {
+      gpio_write(bus.rs, (mode & gpio_bus_rs) ? 1 : 0);
+    }
+    for (uint32_t i = 0; i < size; ++i) {
+      if (bus.width == 4) {
+        bus_strobe_host(bus, data[i] >> 4, 4);
+        if (!(mode & gpio_bus_nibble)) {
+          bus_strobe_host(bus, data[i] & 0xf, 4);
+        }
+      }
+      else {
+        bus_strobe_host(bus, data[i], 8);
+      }
+      // short delays are covered by the serial round trips
+      if (bus.delay_us >= 1000) {
+        gpio_delay((bus.delay_us + 999) / 1000);
+      }
+    }
+    return true;
+  }
+
+  uint32_t done = 0;
+  while (done < size) {
+    const uint32_t len = (size - done) > BUS_CHUNK ? BUS_CHUNK : (size - done);
+    // 'BW' <id:1> <mode:1> <len:2> <data:len*2>
+    char out[6 + BUS_CHUNK * 2] = { 'B', 'W' };
+    char *ptr = out + 2;
+    *ptr++ = nibble_to_hex(uint8_t(id));
+    *ptr++ = nibble_to_hex(uint8_t(mode & 0xf));
+    ptr = put_hex8(ptr, uint8_t(len));
+    for (uint32_t i = 0; i < len; ++i) {
+      ptr = put_hex8(ptr, data[done + i]);
+    }
+    link_send(out, ptr - out);
+    // wait until the board has clocked the chunk out, which can take a while
+    // with long bus delays
+    const uint32_t wait_ms = 100 + uint32_t((uint64_t(len) * (bus.delay_us + 10)) / 1000);
+    char ack = '\0';
+    if (link_read_wait(&ack, 1, wait_ms) != 1) {
+      return false;
+    }
+    done += len;
+  }
+  if (bus.rs >= 0) {
+    state.pin[bus.rs].drive = (mode & gpio_bus_rs) ? drive_high : drive_low;
+  }
+  for (int i = 0; i < bus.width; ++i) {
+    state.pin[bus.data[i]].drive = drive_unknown;
+  }
+  return true;
+}
+
+// shift one byte with host driven pins, used with older firmware
+static uint8_t shift_byte_host(int data, int clock, int order, uint8_t out, bool input) {
+  uint8_t in = 0;
+  for (int i = 0; i < 8; ++i) {
+    const int bit = (order & gpio_msb_first) ? (7 - i) : i;
+    if (input) {
+      if (order & gpio_shift_sample) {
+        gpio_write(clock, 1);
+        in |= uint8_t(gpio_read(data) << bit);
+        gpio_write(clock, 0);
+        continue;
+      }
+      in |= uint8_t(gpio_read(data) << bit);
+    }
+    else {
+      gpio_write(data, (out >> bit) & 1);
+    }
+    gpio_write(clock, 1);
+    gpio_write(clock, 0);
+  }
+  return in;
+}
+
+// start a 'J' shift command
+// 'J' <op> <data> <clock> <latch> <order:1> <len:2>
+static char *shift_header(char *dst, char op, int data, int clock, int latch, int order, uint32_t len) {
+  *dst++ = 'J';
+  *dst++ = op;
+  *dst++ = pin_arg(data);
+  *dst++ = pin_arg(clock);
+  *dst++ = pin_arg(latch);
+  *dst++ = nibble_to_hex(uint8_t(order & 0xf));
+  return put_hex8(dst, uint8_t(len));
 }
 
-bool gpio_open(const char *port) {
+bool gpio_shift_out(int data, int clock, int latch, int order, const uint8_t *src, uint32_t size) {
+  CHECK_PIN(data);
+  CHECK_PIN(clock);
+  if (!link_handle) {
+    return false;
+  }
+
+  if (!has_bulk_commands()) {
+    gpio_output(data);
+    gpio_write(clock, 0);
+    gpio_output(clock);
+    if (latch >= 0) {
+      gpio_write(latch, 0);
+      gpio_output(latch);
+    }
+    for (uint32_t i = 0; i < size; ++i) {
+      shift_byte_host(data, clock, order, src[i], false);
+    }
+    if (latch >= 0) {
+      gpio_write(latch, 1);
+      gpio_write(latch, 0);
+    }
+    return true;
+  }
 
-  if (serial) {
-    serial_close(serial);
-    serial = NULL;
+  uint32_t done = 0;
+  do {
+    const uint32_t len  = (size - done) > SHIFT_CHUNK ? SHIFT_CHUNK : (size - done);
+    const bool     last = done + len == size;
+    char out[9 + SHIFT_CHUNK * 2];
+    // only latch once the whole chain has been shifted
+    char *ptr = shift_header(out, 'O', data, clock, last ? latch : -1, order, len);
+    for (uint32_t i = 0; i < len; ++i) {
+      ptr = put_hex8(ptr, src[done + i]);
+    }
+    link_send(out, ptr - out);
+    // wait until the board has shifted the chunk out
+    char ack = '\0';
+    if (link_read(&ack, 1) != 1) {
+      return false;
+    }
+    done += len;
+  } while (done < size);
+
+  // the firmware leaves the pins outputs, the data line at the last bit
+  state.pin[data].type   = type_output;
+  state.pin[data].drive  = drive_unknown;
+  state.pin[clock].type  = type_output;
+  state.pin[clock].drive = drive_low;
+  if (latch >= 0 && latch < PIN_COUNT) {
+    state.pin[latch].type  = type_output;
+    state.pin[latch].drive = drive_low;
   }
+  return true;
+}
 
-  // open serial connection
-  const int baud = 230400;
-  serial = serial_open(port, baud);
-  if (!serial) {
+bool gpio_shift_in(int data, int clock, int latch, int order, uint8_t *dst, uint32_t size) {
+  CHECK_PIN(data);
+  CHECK_PIN(clock);
+  if (!link_handle) {
     return false;
   }
 
-  // soft reset the RTk.GPIO board
-  serial_send(serial, "R", 1);
-  char recv[2] = { '\0', '\0' };
-  if (serial_read(serial, recv, sizeof(recv))) {
-    if (recv[0] == 'O' && recv[1] == 'K') {
-      state.enhanced_mode = true;
+  if (!has_bulk_commands()) {
+    gpio_input(data);
+    gpio_write(clock, 0);
+    gpio_output(clock);
+    if (latch >= 0) {
+      gpio_write(latch, 0);
+      gpio_output(latch);
+      gpio_write(latch, 1);
+    }
+    for (uint32_t i = 0; i < size; ++i) {
+      dst[i] = shift_byte_host(data, clock, order, 0, true);
     }
+    return true;
   }
 
-  // default to initially unknown state
-  for (int i = 0; i < PIN_COUNT; ++i) {
-    auto &pin = state.pin[i];
-    pin.drive = drive_unknown;
-    pin.type  = type_unknown;
-    pin.pull  = pull_unknown;
+  uint32_t done = 0;
+  while (done < size) {
+    const uint32_t len = (size - done) > SHIFT_CHUNK ? SHIFT_CHUNK : (size - done);
+    char out[9];
+    // only load the chain before its first byte
+    char *ptr = shift_header(out, 'I', data, clock, done ? -1 : latch, order, len);
+    link_send(out, ptr - out);
+    char in[SHIFT_CHUNK * 2];
+    if (link_read(in, len * 2) != len * 2) {
+      return false;
+    }
+    for (uint32_t i = 0; i < len; ++i) {
+      dst[done + i] = get_hex8(in + i * 2);
+    }
+    done += len;
   }
 
+  state.pin[data].type   = type_input;
+  state.pin[data].drive  = drive_unknown;
+  state.pin[clock].type  = type_output;
+  state.pin[clock].drive = drive_low;
+  if (latch >= 0 && latch < PIN_COUNT) {
+    state.pin[latch].type  = type_output;
+    state.pin[latch].drive = drive_high;
+  }
   return true;
 }
 
-bool gpio_is_open(void) {
-  return serial != NULL;
-}
-
-void gpio_close(void) {
-  if (serial) {
-    serial_close(serial);
-    serial = nullptr;
+bool gpio_macro_begin(int id) {
+  if (!has_bulk_commands() || !link_handle || record.active ||
+      id < 0 || id >= gpio_macro_count) {
+    return false;
   }
+  record.active     = true;
+  record.valid      = true;
+  record.id         = id;
+  record.size       = 0;
+  record.pins       = 0;
+  record.spi_config = false;
+  record.saved      = state;
+  // the first pin command must always name its pin
+  state.latched_pin = PIN_COUNT;
+  return true;
 }
 
-void gpio_input(int pin) {
-  CHECK_PIN(pin);
-
-  auto &type = state.pin[pin].type;
-  if (type != type_input || gpio_no_cache) {
-    gpio_action(pin, 'I');
-    type = type_input;
+bool gpio_macro_end(void) {
+  if (!record.active) {
+    return false;
+  }
+  record.active = false;
+  // note pins that the recorded commands changed without a pin action
+  for (int i = 0; i < PIN_COUNT; ++i) {
+    const pin_state_t &a = record.saved.pin[i];
+    const pin_state_t &b = state.pin[i];
+    if (a.type != b.type || a.pull != b.pull || a.drive != b.drive) {
+      record.pins |= 1u << i;
+    }
+  }
+  // nothing recorded has been performed yet
+  state = record.saved;
+  if (!record.valid) {
+    return false;
   }
+  if (!gpio_macro_define(record.id, record.data, record.size)) {
+    return false;
+  }
+  macro_effect[record.id].pins       = record.pins;
+  macro_effect[record.id].spi_config = record.spi_config;
+  return true;
 }
 
-void gpio_output(int pin) {
-  CHECK_PIN(pin);
-
-  auto &type = state.pin[pin].type;
-  if (type != type_output || gpio_no_cache) {
-    gpio_action(pin, 'O');
-    type = type_output;
+bool gpio_macro_define(int id, const uint8_t *body, uint32_t size) {
+  if (!has_bulk_commands() || !link_handle || record.active ||
+      id < 0 || id >= gpio_macro_count || size > gpio_macro_size) {
+    return false;
   }
-}
+  // 'MD' <id:1> <len:4> <data:len*2>
+  char out[7 + gpio_macro_size * 2];
+  char *ptr = out;
+  *ptr++ = 'M';
+  *ptr++ = 'D';
+  *ptr++ = nibble_to_hex(uint8_t(id));
+  ptr = put_hex16(ptr, uint16_t(size));
+  for (uint32_t i = 0; i < size; ++i) {
+    ptr = put_hex8(ptr, body[i]);
+  }
+  link_send(out, ptr - out);
 
-void gpio_write(int pin, int d) {
-  CHECK_PIN(pin);
+  // the contents are unknown so assume it may change anything
+  macro_effect[id].pins       = ~0u;
+  macro_effect[id].spi_config = true;
 
-  pin_drive_t target = d ? drive_high : drive_low;
-  auto &drive = state.pin[pin].drive;
-  if (drive != target || gpio_no_cache) {
-    gpio_action(pin, d ? '1' : '0');
-    drive = target;
-  }
+  // <status:1>
+  char status = '\0';
+  link_read(&status, 1);
+  return status == '0';
 }
 
-void gpio_pull(int pin, int p) {
-  CHECK_PIN(pin);
-
-  pin_pull_t target = (p == gpio_pull_up)   ? pull_up   :
-                      (p == gpio_pull_down) ? pull_down :
-                                              pull_none;
-  const char action = (p == 1) ? 'U' :
-                      (p == 0) ? 'D' :
-                                 'N';
-  auto &pull = state.pin[pin].pull;
-  if (pull != target || gpio_no_cache) {
-    gpio_action(pin, action);
-    pull = target;
+void gpio_macro_run(int id, const char *args) {
+  if (!has_bulk_commands() || !link_handle || id < 0 || id >= gpio_macro_count) {
+    return;
+  }
+  // macros do not nest
+  if (record.active) {
+    record.valid = false;
+    return;
   }
+  const char trigger = char(gpio_macro_trigger + id);
+  link_send(&trigger, 1);
+  if (args && *args) {
+    link_send(args, uint32_t(strlen(args)));
+  }
+  // forget anything the macro may have changed
+  const macro_effect_t &effect = macro_effect[id];
+  for (int i = 0; i < PIN_COUNT; ++i) {
+    if (effect.pins & (1u << i)) {
+      pin_dispose(i, type_unknown);
+    }
+  }
+  if (effect.spi_config) {
+    state.spi_frequency = 0;
+  }
+  state.latched_pin = PIN_COUNT;
 }
 
-int gpio_read(int pin) {
-  CHECK_PIN(pin);
-  gpio_action(pin, '?');
-  char data[4] = { 0 };
-  serial_read(serial, data, state.enhanced_mode ? 2 : 4);
-  return (data[1] == '1') ? 1 : 0;
+bool gpio_macro_save(void) {
+  if (!has_bulk_commands() || !link_handle || record.active) {
+    return false;
+  }
+  link_send("MS", 2);
+  // <status:1>
+  char status = '\0';
+  link_read(&status, 1);
+  return status == '0';
 }
 
-void gpio_board_version(char* dst, uint32_t dst_size) {
-  assert(dst && dst_size);
-  if (serial) {
-    const char* end = dst + (dst_size - 1);
-    // request the version string
-    // note: we send two bytes but the second is ignored but required by the firmware
-    serial_send(serial, "V_", state.enhanced_mode ? 1 : 2);
-
-    // while we have more space
-    for (; dst < end; ++dst) {
-      char recv = '\0';
-      serial_read(serial, &recv, 1);
-      // exit on new line or carage return
-      if (recv == '\r' || recv == '\n' || recv == '\0') {
-        break;
-      }
-      // append character
-      *dst = recv;
+void gpio_poll(void) {
+  if (!link_handle) {
+    return;
+  }
+  for (;;) {
+    if (rx.head == rx.tail && !link_transport->available) {
+      return;
+    }
+    const uint32_t want = (rx.head != rx.tail) ? 1 : link_transport->available(link_handle);
+    char c;
+    if (!want || !rx_getc(&c, want)) {
+      return;
+    }
+    // anything other than an event here is stale and discarded
+    if (c == EVENT_MARKER) {
+      event_recv();
+      mirror_update();
     }
   }
-  // append trailing zero
-  *dst = '\0';
 }
 
-void spi_sw_init(int cs, int sck, int mosi, int miso) {
-
-  CHECK_PIN(sck);
-  CHECK_PIN(mosi);
-  CHECK_PIN(miso);
-
-  if (cs >= 0 && cs <= PIN_COUNT) {
-    gpio_output(cs);
-    gpio_write(cs, 1);  // cs high (not asserted)
+bool gpio_mirror_publish(const char *name) {
+#if defined(_MSC_VER)
+  return false;
+#else
+  if (mirror) {
+    munmap(mirror, sizeof(gpio_mirror_t));
+    shm_unlink(mirror_name);
+    mirror = NULL;
   }
-
-  gpio_output(mosi);
-  gpio_write (mosi, 1);
-  gpio_output(sck);
-  gpio_write (sck,  1);
-  gpio_input (miso);
+  if (!name) {
+    return true;
+  }
+  if (strlen(name) >= sizeof(mirror_name)) {
+    return false;
+  }
+  const int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  void *addr = MAP_FAILED;
+  if (ftruncate(fd, sizeof(gpio_mirror_t)) == 0) {
+    addr = mmap(NULL, sizeof(gpio_mirror_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (addr == MAP_FAILED) {
+    shm_unlink(name);
+    return false;
+  }
+  snprintf(mirror_name, sizeof(mirror_name), "%s", name);
+  mirror = (gpio_mirror_t*)addr;
+  memset(mirror, 0, sizeof(gpio_mirror_t));
+  mirror->size = sizeof(gpio_mirror_t);
+  mirror->pid  = uint32_t(getpid());
+  mirror_update();
+  // readers only trust the contents once the magic is seen
+  std::atomic_thread_fence(std::memory_order_release);
+  mirror->magic = gpio_mirror_magic;
+  return true;
+#endif
 }
 
-uint8_t spi_sw_send(uint8_t data, int cs, int sck, int mosi, int miso) {
-
-  CHECK_PIN(sck);
-  CHECK_PIN(mosi);
-  CHECK_PIN(miso);
-
-  // pull CS low
-  if (cs >= 0 && cs <= PIN_COUNT)
-    gpio_write(cs, 0);
-
-  uint8_t recv = 0;
-  for (int i = 0; i < 8; ++i) {
-    // clock goes low
-    gpio_write(sck, 0);
-    // shift data out
-    gpio_write(mosi, (data & 0x80) ? 1 : 0);
-    data = (data << 1);
-    // clock goes high
-    gpio_write(sck, 1);
-    // shift new data in
-    recv = (recv << 1) | (gpio_read(miso) ? 1 : 0);
+const gpio_mirror_t* gpio_mirror_open(const char *name) {
+#if defined(_MSC_VER)
+  return NULL;
+#else
+  const int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return NULL;
   }
-
-  // pull CS high
-  if (cs >= 0 && cs <= PIN_COUNT)
-    gpio_write(cs, 1);
-
-  return recv;
+  struct stat info;
+  void *addr = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(gpio_mirror_t)) {
+    addr = mmap(NULL, sizeof(gpio_mirror_t), PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+  const gpio_mirror_t *mapped = (const gpio_mirror_t*)addr;
+  if (mapped->magic != gpio_mirror_magic || mapped->size != sizeof(gpio_mirror_t)) {
+    munmap(addr, sizeof(gpio_mirror_t));
+    return NULL;
+  }
+  return mapped;
+#endif
 }
 
-uint8_t spi_hw_send(uint8_t data, int cs) {
-
-  if (!state.enhanced_mode) {
-    spi_sw_init();
-    return spi_sw_send(data, cs);
+bool gpio_mirror_read(const gpio_mirror_t *src, gpio_mirror_t *dst) {
+  for (int tries = 0; tries < 10000; ++tries) {
+    const uint32_t sequence = src->sequence;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence & 1) {
+      // an update is underway
+      std::this_thread::yield();
+      continue;
+    }
+    memcpy(dst, (const void*)src, sizeof(gpio_mirror_t));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (src->sequence == sequence) {
+      return true;
+    }
   }
+  return false;
+}
 
-  // invalidate HW spi pins
-  pin_dispose(9);
-  pin_dispose(10);
-  pin_dispose(11);
-
-  // pull CS low
-  if (cs >= 0 && cs <= PIN_COUNT)
-    gpio_write(cs, 0);
-
-  // send byte to transmit
-  serial_send(serial, "~", 1);
-  const char out[2] = {
-    nibble_to_hex((data & 0xf0) >> 4),
-    nibble_to_hex((data & 0x0f))
-  };
-  serial_send(serial, out, sizeof(out));
-
-  // send byte to receive
-  char dst[2] = { 0, 0 };
-  serial_read(serial, dst, 2);
-
-  const uint8_t ret = (hex_to_nibble(dst[0]) << 4) |
-                       hex_to_nibble(dst[1]);
-
-  // pull CS high
-  if (cs >= 0 && cs <= PIN_COUNT)
-    gpio_write(cs, 1);
-
-  return ret;
+void gpio_mirror_close(const gpio_mirror_t *mirror) {
+#if !defined(_MSC_VER)
+  if (mirror) {
+    munmap((void*)mirror, sizeof(gpio_mirror_t));
+  }
+#endif
 }
 
 }  // extern "C"
@@ -534,6 +3490,24 @@ uint8_t spi_hw_send(uint8_t data, int cs) {
 // WIRING PI WRAPPER
 //-----------------------------------------------------------------------------
 
+// wiring pi SPI channel settings
+struct wpi_spi_t {
+  bool     setup;
+  uint32_t speed;
+  int      mode;
+};
+
+static wpi_spi_t wpi_spi[2];
+
+// wiring pi soft PWM range of each wiring pi pin
+static int wpi_soft_pwm_range[32];
+
+// convert a wiring pi SPI channel to its chip select gpio pin
+static int wpi_spi_cs(int channel) {
+  return (channel == 0) ? 8 :  // CE0
+                          7;   // CE1
+}
+
 // convert wiring pi pin numbers to gpio pin numbers
 static int wpi_pin(int pin) {
   switch (pin) {
@@ -592,6 +3566,84 @@ int wiringPiSetup(const char *port) {
   return 1;
 }
 
+int wiringPiSPISetupMode(int channel, int speed, int mode) {
+  if (!gpio_is_open() || channel < 0 || channel > 1 || speed <= 0) {
+    return -1;
+  }
+  wpi_spi[channel].setup = true;
+  wpi_spi[channel].speed = uint32_t(speed);
+  wpi_spi[channel].mode  = mode & 3;
+
+  const int cs = wpi_spi_cs(channel);
+  gpio_output(cs);
+  gpio_write(cs, 1);
+  return channel;
+}
+
+int wiringPiSPISetup(int channel, int speed) {
+  return wiringPiSPISetupMode(channel, speed, 0);
+}
+
+int wiringPiSPIGetFd(int channel) {
+  if (channel < 0 || channel > 1) {
+    return -1;
+  }
+  return wpi_spi[channel].setup ? channel : -1;
+}
+
+int wiringPiSPIDataRW(int channel, unsigned char *data, int len) {
+  if (channel < 0 || channel > 1 || !wpi_spi[channel].setup || len < 0) {
+    return -1;
+  }
+  // both channels share the bus so apply this channels settings first
+  spi_hw_config(wpi_spi[channel].speed, wpi_spi[channel].mode);
+  spi_hw_transfer(data, data, uint32_t(len), wpi_spi_cs(channel));
+  return len;
+}
+
+int wiringPiI2CSetup(int devId) {
+  if (!gpio_is_open() || devId < 0 || devId > 0x7f) {
+    return -1;
+  }
+  // there is no file to open so the device address is the handle
+  return devId;
+}
+
+int wiringPiI2CRead(int fd) {
+  uint8_t data = 0;
+  return (i2c_transfer(fd, nullptr, 0, &data, 1) == 0) ? data : -1;
+}
+
+int wiringPiI2CWrite(int fd, int data) {
+  const uint8_t out = uint8_t(data);
+  return i2c_transfer(fd, &out, 1, nullptr, 0);
+}
+
+int wiringPiI2CReadReg8(int fd, int reg) {
+  const uint8_t out = uint8_t(reg);
+  uint8_t data = 0;
+  return (i2c_transfer(fd, &out, 1, &data, 1) == 0) ? data : -1;
+}
+
+int wiringPiI2CReadReg16(int fd, int reg) {
+  const uint8_t out = uint8_t(reg);
+  uint8_t data[2] = { 0, 0 };
+  if (i2c_transfer(fd, &out, 1, data, 2) != 0) {
+    return -1;
+  }
+  return data[0] | (data[1] << 8);
+}
+
+int wiringPiI2CWriteReg8(int fd, int reg, int data) {
+  const uint8_t out[2] = { uint8_t(reg), uint8_t(data) };
+  return i2c_transfer(fd, out, sizeof(out), nullptr, 0);
+}
+
+int wiringPiI2CWriteReg16(int fd, int reg, int data) {
+  const uint8_t out[3] = { uint8_t(reg), uint8_t(data), uint8_t(data >> 8) };
+  return i2c_transfer(fd, out, sizeof(out), nullptr, 0);
+}
+
 void digitalWrite(int pin, int state) {
   pin = wpi_pin(pin);
   gpio_write(pin, state);
@@ -612,12 +3664,55 @@ void pinMode(int pin, int state) {
   }
 }
 
+void shiftOut(uint8_t dPin, uint8_t cPin, uint8_t order, uint8_t val) {
+  gpio_shift_out(wpi_pin(dPin), wpi_pin(cPin), -1, order ? gpio_msb_first : gpio_lsb_first, &val, 1);
+}
+
+uint8_t shiftIn(uint8_t dPin, uint8_t cPin, uint8_t order) {
+  // wiring pi samples each bit after raising the clock
+  uint8_t val = 0;
+  gpio_shift_in(wpi_pin(dPin), wpi_pin(cPin), -1,
+                (order ? gpio_msb_first : gpio_lsb_first) | gpio_shift_sample, &val, 1);
+  return val;
+}
+
+int softPwmCreate(int pin, int initialValue, int pwmRange) {
+  if (pin < 0 || pin >= 32 || pwmRange <= 0 || !has_bulk_commands()) {
+    return -1;
+  }
+  wpi_soft_pwm_range[pin] = pwmRange;
+  softPwmWrite(pin, initialValue);
+  return 0;
+}
+
+void softPwmWrite(int pin, int value) {
+  if (pin < 0 || pin >= 32 || !wpi_soft_pwm_range[pin]) {
+    return;
+  }
+  const int range = wpi_soft_pwm_range[pin];
+  value = value < 0 ? 0 : (value > range ? range : value);
+  // wiring pi soft PWM steps are 100us long
+  gpio_pwm(wpi_pin(pin), uint32_t(range) * 100, uint32_t(value) * 100);
+}
+
+void softPwmStop(int pin) {
+  if (pin < 0 || pin >= 32 || !wpi_soft_pwm_range[pin]) {
+    return;
+  }
+  wpi_soft_pwm_range[pin] = 0;
+  gpio_pwm(wpi_pin(pin), 0, 0);
+}
+
+int analogRead(int pin) {
+  return gpio_analog_read(wpi_pin(pin));
+}
+
 uint64_t millis() {
   static uint64_t ticks = 0;
   if (ticks == 0) {
-    ticks = GetTickCount64();
+    ticks = host_time_us() / 1000;
   }
-  return GetTickCount64() - ticks;
+  return host_time_us() / 1000 - ticks;
 }
 
 void delay(uint64_t ms) {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -23,16 +24,25 @@ enum {
 };
 
 /**
- * Open the serial port the GPIO board is attached to.
+ * Open the link to the GPIO board.
  *
  * arg port - The name of the com port the GPIO interface is attached to:
  *            on Windows for example "COM4".
  *            on Linux for example, "/dev/..."
+ *            or a URI selecting another transport:
+ *            "serial:COM4"          a serial port.
+ *            "tcp://host:port"      a board bridged over TCP.
+ *            "unix:/run/rtk.sock"   a board bridged over a Unix socket.
+ *            "rtkgpiod:"            a board shared through the rtkgpiod
+ *                                   daemon, optionally followed by its
+ *                                   socket path.
+ *            "loop:"                an in-process loopback with no board,
+ *                                   see `gpio_loopback_reply`.
  *
  * note: `port` can be NULL to attempt to attempt to use the first available
  *       COM port.
  *
- * returns - true if the serial port was opened successfully.
+ * returns - true if the link was opened successfully.
 **/
 bool gpio_open(const char *port);
 
@@ -48,6 +58,72 @@ void gpio_close(void);
 **/
 bool gpio_is_open(void);
 
+/**
+ * A way of carrying bytes to and from a GPIO board.
+ *
+ * note: `read` should wait briefly, around 100ms, for data to arrive and
+ *       return however many bytes it has, or 0 if none came.
+ *       `flush` and `available` are optional and may be NULL; without
+ *       `available` events are only processed while waiting for replies.
+ *       `shared` marks a board other processes also drive, which makes the
+ *       library resend pin state it would otherwise assume is unchanged.
+ */
+typedef struct gpio_transport_t {
+  const char *scheme;                                             // URI scheme, e.g. "tcp"
+  void*     (*open)(const char *address);                         // NULL on failure
+  void      (*close)(void *link);
+  uint32_t  (*send)(void *link, const void *src, uint32_t nbytes);  // bytes sent
+  uint32_t  (*read)(void *link, void *dst, uint32_t nbytes);        // bytes read
+  void      (*flush)(void *link);                                 // wait for sent data
+  uint32_t  (*available)(void *link);                             // bytes readable now
+  bool        shared;                                             // other clients use the board
+} gpio_transport_t;
+
+// socket the rtkgpiod daemon listens on by default
+#define RTKGPIOD_SOCKET "/tmp/rtkgpiod.sock"
+
+/**
+ * Add a transport that `gpio_open` can select by its URI scheme.
+ *
+ * arg transport - the transport, which must stay valid while registered.
+ *
+ * returns - true if the transport was added.
+ *
+ * note: a registered transport takes precedence over a built in one with the
+ *       same scheme, and is passed the rest of the URI with any leading "//"
+ *       removed.
+ */
+bool gpio_transport_register(const gpio_transport_t *transport);
+
+/**
+ * Find the transport `gpio_open` would use for a port name or URI.
+ *
+ * arg uri     - the port name or URI, as passed to `gpio_open`.
+ * arg address - receives the part of the URI passed to the transport `open`.
+ *
+ * returns - the transport, which is never NULL as unknown names are serial
+ *           ports.
+ */
+const gpio_transport_t* gpio_transport_find(const char *uri, const char **address);
+
+/**
+ * Queue bytes to be read back from the "loop:" transport.
+ *
+ * arg src  - the bytes a board would have replied with.
+ * arg size - the number of bytes.
+ *
+ * note: the loopback discards everything sent to it and replies immediately
+ *       with whatever has been queued, or nothing, so the host library can be
+ *       benchmarked without any I/O time.  bytes queued before `gpio_open`
+ *       answer its reset and version queries, e.g. "OKRTk.GPIO v3\n".
+ */
+void gpio_loopback_reply(const void *src, uint32_t size);
+
+/**
+ * Count the bytes sent to the "loop:" transport since it was opened.
+ */
+uint64_t gpio_loopback_sent(void);
+
 /**
  * Set a GPIO pin to act as an input.
  *
@@ -127,6 +203,855 @@ uint8_t spi_sw_send(uint8_t data, int cs=-1, int sck=spi_sck, int mosi=spi_mosi,
  */
 uint8_t spi_hw_send(uint8_t data, int cs=-1);
 
+/**
+ * Configure the hardware SPI clock.
+ *
+ * arg frequency - the SPI clock frequency in Hz.
+ * arg mode      - the SPI clock polarity and phase mode, 0 to 3.
+ *
+ * note: the board uses 1MHz mode 0 until this is called.
+ */
+void spi_hw_config(uint32_t frequency, int mode=0);
+
+/**
+ * Perform a hardware SPI transfer of a block of data as a single transaction.
+ *
+ * arg tx      - the data that will be transfered to the slave (optional).
+ * arg rx      - buffer for the data received from the slave (optional).
+ * arg size    - the number of bytes to transfer.
+ * arg cs      - the GPIO pin that will act as the chip select pin (optional).
+ * arg hold_cs - leave chip select asserted after the transfer.
+ *
+ * pins     - sck  : gp11
+ *            miso : gp9
+ *            mosi : gp10
+ *
+ * note: chip select is asserted and released by the board firmware so no
+ *       extra commands are sent to toggle it.  setting `hold_cs` allows a
+ *       transaction to span several calls, the final call should clear it.
+ *       when `tx` is NULL 0xff bytes are sent.  when `rx` is NULL the
+ *       received data is discarded and the board does not send it back,
+ *       which halves the serial traffic for write only transfers.
+ */
+void spi_hw_transfer(const uint8_t *tx, uint8_t *rx, uint32_t size, int cs=-1, bool hold_cs=false);
+
+/**
+ * Fill a window of an ST7735 class LCD with a single colour.
+ *
+ * arg cs     - the GPIO pin connected to the LCD chip select.
+ * arg dc     - the GPIO pin connected to the LCD data/command select.
+ * arg x0, y0 - the top left corner of the window in display ram (inclusive).
+ * arg x1, y1 - the bottom right corner of the window in display ram (inclusive).
+ * arg colour - the RGB565 colour to fill with.
+ *
+ * note: the board sets the window (CASET/RASET/RAMWR) and generates the pixel
+ *       data itself, so only the command is sent over the serial link.
+ */
+void spi_lcd_fill(int cs, int dc, int x0, int y0, int x1, int y1, uint16_t colour);
+
+/**
+ * Draw an image to a window of an ST7735 class LCD using RLE compression.
+ *
+ * arg cs     - the GPIO pin connected to the LCD chip select.
+ * arg dc     - the GPIO pin connected to the LCD data/command select.
+ * arg x0, y0 - the top left corner of the window in display ram (inclusive).
+ * arg x1, y1 - the bottom right corner of the window in display ram (inclusive).
+ * arg pixels - RGB565 pixels of the image in row major order.
+ * arg stride - the number of pixels between rows of `pixels`.
+ *
+ * note: the image is sent as runs of identical pixels which the board
+ *       expands into RAMWR data, so flat coloured areas are very cheap.
+ */
+void spi_lcd_blit_rle(int cs, int dc, int x0, int y0, int x1, int y1, const uint16_t *pixels, int stride);
+
+/**
+ * Perform a hardware I2C transaction as a single command.
+ *
+ * arg addr - the 7bit address of the slave device.
+ * arg wr   - the data to write to the slave (optional).
+ * arg wlen - the number of bytes to write, at most 255.
+ * arg rd   - buffer for the data read from the slave (optional).
+ * arg rlen - the number of bytes to read, at most 255.
+ *
+ * returns - 0 on success or -1 if the slave did not respond.
+ *
+ * pins    - sda : gp2
+ *           scl : gp3
+ *
+ * note: when both writing and reading, the write is followed by a repeated
+ *       start and then the read.  with nothing to write or read the slave
+ *       address is probed.
+ */
+int i2c_transfer(int addr, const uint8_t *wr, uint32_t wlen, uint8_t *rd, uint32_t rlen);
+
+/**
+ * Configure the hardware I2C clock.
+ *
+ * arg frequency - the I2C clock frequency in Hz.
+ *
+ * note: the board uses 100kHz until this is called.
+ */
+void i2c_config(uint32_t frequency);
+
+/**
+ * Open the USART2 serial bridge.
+ *
+ * arg baud - the baud rate of the attached serial device.
+ *
+ * returns - true if the bridge was opened.
+ *
+ * pins    - tx : gp14
+ *           rx : gp15
+ *
+ * note: data from the device is forwarded to the host as it arrives and
+ *       interleaved with other commands, no polling of the board is needed.
+ */
+bool uart_open(uint32_t baud);
+
+/**
+ * Close the USART2 serial bridge.
+ */
+void uart_close(void);
+
+/**
+ * Send data to the device on the USART2 serial bridge.
+ *
+ * arg src  - the data to send.
+ * arg size - the number of bytes to send.
+ *
+ * returns - the number of bytes accepted by the board.
+ */
+uint32_t uart_write(const void *src, uint32_t size);
+
+/**
+ * Read data received from the device on the USART2 serial bridge.
+ *
+ * arg dst  - destination buffer for the data.
+ * arg size - the size of the destination buffer.
+ *
+ * returns - the number of bytes read, which may be zero.
+ *
+ * note: this does not wait for data to arrive.
+ */
+uint32_t uart_read(void *dst, uint32_t size);
+
+/**
+ * Receives samples streamed from an SPI ADC.
+ *
+ * arg samples - 12bit samples in the order they were taken, when both
+ *               channels are enabled they alternate channel 0, channel 1.
+ * arg count   - the number of samples.
+ */
+typedef void (*adc_stream_callback_t)(const uint16_t *samples, uint32_t count);
+
+/**
+ * Start continuously sampling an MCP3202 ADC from a timer on the board.
+ *
+ * arg rate     - the number of samples per second for each channel.
+ * arg channels - bit mask of channels to sample, 1 for channel 0, 2 for
+ *                channel 1 or 3 for both.
+ * arg callback - function receiving the streamed samples.
+ * arg cs       - the GPIO pin connected to the ADC chip select.
+ *
+ * returns - true if streaming was started, false if `cs` is one of the SPI
+ *           pins.
+ *
+ * note: streaming stops if any of the SPI pins is used for another purpose.
+ *
+ * note: samples are delivered from inside `gpio_poll` and any other call
+ *       that waits for a reply from the board.  the board never samples
+ *       while a transaction holds another chip select, so while streaming
+ *       other SPI devices should be accessed with `spi_hw_transfer` passing
+ *       their chip select, rather than toggling it with `gpio_write`.
+ *
+ * note: the samples of one callback are evenly spaced by the sample period
+ *       from `gpio_last_timestamp`.  samples falling while the board is
+ *       running a command on the SPI bus are skipped, and a skip starts a
+ *       new callback, so enable timestamps to place callbacks in time.
+ */
+bool adc_stream_start(uint32_t rate, int channels, adc_stream_callback_t callback, int cs=8);
+
+/**
+ * Stop streaming ADC samples.
+ */
+void adc_stream_stop(void);
+
+enum {
+  dac_wave_pool = 128,   // samples of waveform table storage on the board
+};
+
+/**
+ * Upload waveform samples to the table storage on the board.
+ *
+ * arg offset  - the position in the table storage to write to.
+ * arg samples - 12bit DAC samples.
+ * arg count   - the number of samples to upload.
+ *
+ * returns - false if the samples do not fit in the table storage.
+ *
+ * note: table storage is shared by both channels, upload to an area that
+ *       is not playing and then select it to swap tables without a glitch.
+ */
+bool dac_wave_load(uint32_t offset, const uint16_t *samples, uint32_t count);
+
+/**
+ * Select the waveform table a DAC channel plays.
+ *
+ * arg channel - the DAC channel, 0 or 1.
+ * arg offset  - the position of the table in the table storage.
+ * arg length  - the number of samples in the table, 0 to disable the channel.
+ *
+ * note: if the channel is already playing the switch happens when the
+ *       current table next loops.
+ */
+void dac_wave_select(int channel, uint32_t offset, uint32_t length);
+
+/**
+ * Start clocking waveform tables out to an MCP4802 DAC from a timer on the board.
+ *
+ * arg rate - the number of samples per second output on each channel.
+ * arg cs   - the GPIO pin connected to the DAC chip select.
+ *
+ * returns - true if playback was started.
+ *
+ * note: tables loop until stopped and no serial traffic is needed while
+ *       they play.
+ */
+bool dac_wave_start(uint32_t rate, int cs=7);
+
+/**
+ * Stop waveform playback.
+ */
+void dac_wave_stop(void);
+
+enum {
+  ws2812_max_pixels = 85,   // most LEDs the board can buffer for a single show
+};
+
+/**
+ * Send pixel data to a chain of WS2812 (NeoPixel) LEDs.
+ *
+ * arg pixels - 3 bytes per LED in the order green, red, blue.
+ * arg count  - the number of LEDs, at most `ws2812_max_pixels`.
+ *
+ * returns - true if the pixels were shown.
+ *
+ * pins    - data : gp10
+ *
+ * note: the board buffers the pixel data and expands each bit into a 4 bit
+ *       SPI pattern clocked out of the hardware SPI MOSI pin at 3MHz, so
+ *       the timing comes from the SPI peripheral.  SCK also toggles while
+ *       the LEDs are written so no SPI device should be selected.  board
+ *       interrupts are held off while the data is sent.
+ */
+bool ws2812_show(const uint8_t *pixels, uint32_t count);
+
+enum {
+  onewire_max_devices = 64,  // most devices found by a single ROM search
+};
+
+/**
+ * Reset a 1-Wire bus.
+ *
+ * arg pin - the GPIO pin of the bus, which needs an external pull up resistor.
+ *
+ * returns - true if a device answered with a presence pulse.
+ *
+ * note: all 1-Wire time slots are generated by the board.
+ */
+bool onewire_reset(int pin);
+
+/**
+ * Write bytes to a 1-Wire bus.
+ *
+ * arg pin   - the GPIO pin of the bus.
+ * arg data  - the bytes to write.
+ * arg size  - the number of bytes to write.
+ * arg power - drive the bus high after the write to power parasitic devices,
+ *             until the next 1-Wire operation on the pin.
+ *
+ * returns - true if the board supports 1-Wire and wrote every byte.
+ */
+bool onewire_write(int pin, const uint8_t *data, uint32_t size, bool power=false);
+
+/**
+ * Read bytes from a 1-Wire bus.
+ *
+ * arg pin  - the GPIO pin of the bus.
+ * arg data - receives the bytes read.
+ * arg size - the number of bytes to read.
+ *
+ * returns - true if the bytes were read.
+ */
+bool onewire_read(int pin, uint8_t *data, uint32_t size);
+
+/**
+ * Find the devices on a 1-Wire bus.
+ *
+ * arg pin  - the GPIO pin of the bus.
+ * arg roms - receives the 64bit ROM codes of the devices, the family code in
+ *            the lowest byte.
+ * arg max  - the size of `roms`.
+ *
+ * returns - the number of devices found, ROM codes with a bad CRC are skipped.
+ *
+ * note: the whole search runs on the board, at most `onewire_max_devices`
+ *       devices are found.
+ */
+int onewire_search(int pin, uint64_t *roms, int max);
+
+/**
+ * Start a temperature conversion on every DS18B20 on a 1-Wire bus.
+ *
+ * arg pin      - the GPIO pin of the bus.
+ * arg parasite - drive the bus high during the conversion for devices
+ *                without their own power supply.
+ *
+ * returns - true if any device is present.
+ *
+ * note: a 12bit conversion takes 750ms, read the results after that.
+ */
+bool ds18b20_convert_all(int pin, bool parasite=false);
+
+/**
+ * Read the last converted temperature of several DS18B20 class sensors.
+ *
+ * arg pin     - the GPIO pin of the bus.
+ * arg roms    - the ROM codes of the sensors, as found by `onewire_search`.
+ * arg count   - the number of sensors.
+ * arg celsius - receives the temperatures, NaN for sensors that did not answer.
+ *
+ * returns - the number of sensors read successfully.
+ *
+ * note: the board addresses and reads every sensor in one batched command
+ *       per 16 sensors.  DS18S20 (family 0x10) readings are also converted.
+ */
+int ds18b20_read_all(int pin, const uint64_t *roms, int count, float *celsius);
+
+enum {
+  gpio_pwm_channels = 8,   // most pins the board can pulse at once
+};
+
+/**
+ * Generate a software PWM signal on a pin.
+ *
+ * arg pin       - the GPIO pin to drive, which is made an output.
+ * arg period_us - the length of each cycle in microseconds, 0 stops the signal.
+ * arg width_us  - how long the pin is high in each cycle.
+ *
+ * returns - true if the board supports software PWM.
+ *
+ * note: the board drives up to `gpio_pwm_channels` pins from a single
+ *       timer, so once configured no serial traffic is needed.  pins with
+ *       the same period rise together.  a width change takes effect at the
+ *       start of the next cycle and a stopped pin is left low.  writing or
+ *       changing the direction of the pin stops the signal.
+ */
+bool gpio_pwm(int pin, uint32_t period_us, uint32_t width_us);
+
+/**
+ * Send hobby servo pulses on a pin, every 20ms.
+ *
+ * arg pin      - the GPIO pin connected to the servo signal.
+ * arg pulse_us - the pulse width, usually 1000 to 2000, 0 stops the pulses.
+ *
+ * returns - true if the board supports software PWM.
+ */
+bool gpio_servo(int pin, uint32_t pulse_us);
+
+enum {
+  gpio_analog_pins = 8,  // pins with an internal ADC channel
+};
+
+/**
+ * Receives internal ADC scan values.
+ *
+ * arg pin   - the GPIO pin the value was read from.
+ * arg value - the latest 12bit conversion result.
+ */
+typedef void (*analog_callback_t)(int pin, uint16_t value);
+
+/**
+ * Read the voltage on a pin using the internal ADC of the board.
+ *
+ * arg pin - the GPIO pin to read, one of GP0, GP9, GP10, GP11, GP14, GP15,
+ *           GP18 or GP26.
+ *
+ * returns - the 12bit conversion result, 0 to 4095 for 0v to 3v3, or -1 if
+ *           the pin has no ADC channel.
+ *
+ * note: a pin that is being scanned returns its latest scanned value,
+ *       reading any other pin stops the scan.
+ */
+int gpio_analog_read(int pin);
+
+/**
+ * Continuously convert a set of pins with the internal ADC.
+ *
+ * arg pins        - the GPIO pins to convert, all must have an ADC channel.
+ * arg count       - the number of pins.
+ * arg interval_ms - how often the latest values are pushed to the callback.
+ * arg callback    - function receiving the values, or NULL to only read them
+ *                   with `gpio_analog_read`.
+ *
+ * returns - true if the scan was started.
+ *
+ * note: the board converts the pins back to back with DMA so reading a
+ *       scanned pin costs no conversion time.  values are delivered from
+ *       inside `gpio_poll` and any other call that waits for a reply.
+ */
+bool gpio_analog_scan(const int *pins, int count, uint32_t interval_ms, analog_callback_t callback);
+
+/**
+ * Stop the internal ADC scan.
+ */
+void gpio_analog_stop(void);
+
+/**
+ * Wait on the board for an input pin to reach a logic level.
+ *
+ * arg pin        - the GPIO pin to watch.
+ * arg level      - the level to wait for, 0 for low or 1 for high.
+ * arg timeout_us - the longest time to wait in microseconds.
+ *
+ * returns - the microseconds waited for the level, or -1 on timeout.
+ *
+ * note: the board watches the pin and replies once, so waiting for a BUSY or
+ *       READY line costs a single round trip instead of a `gpio_read` loop.
+ */
+int32_t gpio_wait_level(int pin, int level, uint32_t timeout_us);
+
+/**
+ * Wait on the board for a status register of an SPI device to match.
+ *
+ * arg cmd        - the command byte that reads the status register.
+ * arg mask       - the status bits to test.
+ * arg value      - the value of the masked bits to wait for.
+ * arg timeout_us - the longest time to wait in microseconds.
+ * arg cs         - the GPIO pin that will act as the chip select pin (optional).
+ *
+ * returns - the microseconds waited for the status, or -1 on timeout.
+ *
+ * note: the board repeatedly sends `cmd` and reads one status byte in its
+ *       own transaction, for example 0x05 with mask and value 0x01 and 0x00
+ *       waits for an SPI flash to finish a write.
+ */
+int32_t spi_wait_status(uint8_t cmd, uint8_t mask, uint8_t value, uint32_t timeout_us, int cs=-1);
+
+/**
+ * Queue a wait for an SPI status register without waiting for its reply.
+ *
+ * arg cmd        - the command byte that reads the status register.
+ * arg mask       - the status bits to test.
+ * arg value      - the value of the masked bits to wait for.
+ * arg timeout_us - the longest time to wait in microseconds.
+ * arg cs         - the GPIO pin that will act as the chip select pin (optional).
+ *
+ * returns - true if the wait was queued, up to 8 waits can be outstanding.
+ *
+ * note: the board runs commands in order, so commands sent after this one
+ *       run once the status matches.  this lets a host stream the next
+ *       block of data while a device is still busy.  only commands without
+ *       a reply, such as `spi_hw_transfer` with no `rx` buffer, may be sent
+ *       before the result is collected with `spi_wait_status_result`.
+ */
+bool spi_wait_status_queue(uint8_t cmd, uint8_t mask, uint8_t value, uint32_t timeout_us, int cs=-1);
+
+/**
+ * Collect the result of the oldest queued SPI status wait.
+ *
+ * arg status - receives the last status byte read (optional).
+ *
+ * returns - the microseconds waited for the status, or -1 on timeout.
+ */
+int32_t spi_wait_status_result(uint8_t *status=NULL);
+
+/**
+ * Compute the CRC32 of data read from an SPI device on the board.
+ *
+ * arg header      - bytes sent first to select the data, for example a read
+ *                   command and address (optional).
+ * arg header_size - the number of header bytes, at most 15.
+ * arg size        - the number of bytes to read after the header.
+ * arg crc         - receives the CRC32 of the bytes read.
+ * arg cs          - the GPIO pin that will act as the chip select pin (optional).
+ *
+ * returns - true if the CRC was computed.
+ *
+ * note: only the CRC crosses the serial link so large regions can be
+ *       verified quickly, compare it against `gpio_crc32` of the expected data.
+ */
+bool spi_crc32(const uint8_t *header, uint32_t header_size, uint32_t size, uint32_t *crc, int cs=-1);
+
+/**
+ * Update a CRC32 (IEEE 802.3, as used by zip) with a block of data.
+ *
+ * arg crc  - the CRC of the preceding data, 0 to start.
+ * arg data - the data to add.
+ * arg size - the number of bytes of data.
+ *
+ * returns - the updated CRC.
+ */
+uint32_t gpio_crc32(uint32_t crc, const void *data, uint32_t size);
+
+/**
+ * Measure the width of a pulse on an input pin, like Arduino's `pulseIn`.
+ *
+ * arg pin        - the GPIO pin to measure.
+ * arg level      - 1 to measure a high pulse, 0 for a low pulse.
+ * arg timeout_us - the longest time to wait for the whole pulse in microseconds.
+ *
+ * returns - the pulse width in microseconds, or -1 on timeout.
+ *
+ * note: a pulse already in progress is skipped.  on pins with a timer
+ *       capture channel (gp8, 9, 10, 16, 18, 20, 25, 26) the edges are
+ *       timestamped by hardware, other pins are polled by the board which
+ *       is accurate to a few microseconds.
+ */
+int32_t gpio_pulse_in(int pin, int level, uint32_t timeout_us);
+
+/**
+ * Measure the frequency and duty cycle of a signal on an input pin.
+ *
+ * arg pin        - the GPIO pin to measure.
+ * arg duty       - receives the fraction of each cycle spent high (optional).
+ * arg timeout_us - the longest time to wait for a whole cycle in microseconds.
+ *
+ * returns - the frequency in Hz, or 0 if no complete cycle was seen.
+ *
+ * note: whole cycles are measured on the board for about 50ms and averaged.
+ *       the timer capture pins listed for `gpio_pulse_in` handle signals up
+ *       to around 100kHz.
+ */
+double gpio_measure_freq(int pin, double *duty=NULL, uint32_t timeout_us=1000000);
+
+/**
+ * Enable microsecond board timestamps on reads, events and pulse measurements.
+ *
+ * arg enable - true to add timestamps, false to remove them.
+ *
+ * returns - true if the board acknowledged the change.
+ *
+ * note: after each `gpio_read`, `gpio_pulse_in`, `gpio_measure_freq` or
+ *       received event the board time it happened at can be fetched with
+ *       `gpio_last_timestamp`.
+ */
+bool gpio_timestamps(bool enable);
+
+/**
+ * Fetch the board time of the most recent timestamped read, event or
+ * pulse measurement.
+ *
+ * returns - the board time in microseconds.
+ *
+ * note: inside an `adc_stream_callback_t` this is the time the first sample
+ *       was taken.
+ */
+uint64_t gpio_last_timestamp(void);
+
+/**
+ * Ping the board, refining the estimate of the board clock.
+ *
+ * returns - the round trip time in microseconds, or -1 on failure.
+ *
+ * note: the fastest of the last 16 pings sets the clock offset and a fit of
+ *       the others its drift, so ping a few times before relying on
+ *       `gpio_board_time_to_host` and then now and again to track drift.
+ */
+int32_t gpio_ping(void);
+
+/**
+ * Convert a board time to host time.
+ *
+ * arg board_us - a board time in microseconds, such as from `gpio_last_timestamp`.
+ *
+ * returns - the matching host time in microseconds, see `gpio_host_time`.
+ */
+uint64_t gpio_board_time_to_host(uint64_t board_us);
+
+/**
+ * Query the estimated drift of the board clock relative to the host.
+ *
+ * returns - the drift in parts per million, positive when the board is slow.
+ */
+double gpio_clock_drift(void);
+
+/**
+ * Query the host time used by `gpio_board_time_to_host`.
+ *
+ * returns - microseconds on the host monotonic (steady) clock.
+ */
+uint64_t gpio_host_time(void);
+
+enum {
+  gpio_encoder_count = 4,  // number of encoders the board can decode
+};
+
+/**
+ * Receives encoder counts pushed by the board.
+ *
+ * arg id    - the encoder whose count changed.
+ * arg count - the new count.
+ */
+typedef void (*encoder_callback_t)(int id, int32_t count);
+
+/**
+ * Start decoding a quadrature encoder on the board.
+ *
+ * arg id    - the encoder to open, 0 to 3.
+ * arg pin_a - the GPIO pin connected to the encoder A output.
+ * arg pin_b - the GPIO pin connected to the encoder B output.
+ *
+ * returns - true if the encoder was opened.
+ *
+ * note: every edge of both inputs is counted and the count starts at zero.
+ *       the pin pairs gp9/gp10 and gp25/gp8 are decoded by a hardware timer,
+ *       one pair at a time.  any other pins use edge interrupts, which need
+ *       the pins of all open encoders to have different numbers within their
+ *       STM32 port (see firmware/README.md).  both pins are pulled up.
+ */
+bool gpio_encoder_open(int id, int pin_a, int pin_b);
+
+/**
+ * Stop decoding a quadrature encoder.
+ *
+ * arg id - the encoder to close.
+ */
+void gpio_encoder_close(int id);
+
+/**
+ * Read the 32bit count of an encoder.
+ *
+ * arg id - the encoder to read.
+ *
+ * returns - the count, increasing when A leads B.
+ */
+int32_t gpio_encoder_read(int id);
+
+/**
+ * Reset the count of an encoder to zero.
+ *
+ * arg id - the encoder to reset.
+ */
+void gpio_encoder_zero(int id);
+
+/**
+ * Have the board push encoder counts as they change.
+ *
+ * arg id          - the encoder to watch.
+ * arg interval_ms - the shortest time between pushes, limiting link traffic.
+ * arg callback    - function receiving the counts, NULL to stop pushing.
+ *
+ * note: counts are delivered from inside `gpio_poll` and any other call
+ *       that waits for a reply from the board.
+ */
+void gpio_encoder_notify(int id, uint32_t interval_ms, encoder_callback_t callback);
+
+enum {
+  gpio_keypad_lines = 4,  // most rows or columns in a scanned keypad
+};
+
+/**
+ * Receives debounced keypad changes.
+ *
+ * arg row  - the index of the key row in the list of row pins.
+ * arg col  - the index of the key column in the list of column pins.
+ * arg down - 1 when the key was pressed or 0 when released.
+ */
+typedef void (*keypad_callback_t)(int row, int col, int down);
+
+/**
+ * Receives debounced input changes.
+ *
+ * arg pin   - the GPIO pin that changed.
+ * arg level - the new logic level.
+ */
+typedef void (*debounce_callback_t)(int pin, int level);
+
+/**
+ * Start scanning a keypad matrix on the board.
+ *
+ * arg rows        - the GPIO pins connected to the keypad rows.
+ * arg num_rows    - the number of rows, 1 to 8.
+ * arg cols        - the GPIO pins connected to the keypad columns.
+ * arg num_cols    - the number of columns, 1 to 8.
+ * arg debounce_ms - how long a key must be stable for a change to count, up to 255.
+ * arg callback    - function receiving key presses and releases.
+ *
+ * note: every millisecond the board drives each column low in turn and
+ *       reads the rows, which it pulls up.  only changes are sent so an
+ *       idle keypad costs no serial traffic.  key changes are delivered from
+ *       inside `gpio_poll` and any other call that waits for a reply.
+ */
+bool gpio_keypad_start(const int *rows, int num_rows, const int *cols, int num_cols,
+                       uint32_t debounce_ms, keypad_callback_t callback);
+
+/**
+ * Stop scanning the keypad matrix.
+ */
+void gpio_keypad_stop(void);
+
+/**
+ * Debounce an input pin on the board, reporting changes as they happen.
+ *
+ * arg pin         - the GPIO pin to watch, which is made an input.
+ * arg debounce_ms - how long the level must be stable for a change to
+ *                   count, up to 255, 0 stops watching the pin.
+ * arg callback    - function receiving the level changes, NULL stops watching.
+ *
+ * returns - true if the board supports debouncing.
+ *
+ * note: the pull state of the pin is left as set by `gpio_pull`.
+ */
+bool gpio_debounce(int pin, uint32_t debounce_ms, debounce_callback_t callback);
+
+enum {
+  gpio_bus_count      = 2,    // number of parallel buses the board can hold
+  gpio_bus_strobe_low = 0x1,  // bus flag, strobe is an active low 8080 WR line
+  gpio_bus_rs         = 0x1,  // write mode, drive the register select pin high
+  gpio_bus_nibble     = 0x2,  // write mode, send only the high nibble of each byte
+};
+
+/**
+ * Define a parallel bus for HD44780 or 8080 style peripherals.
+ *
+ * arg id       - the bus to define, 0 or 1.
+ * arg data     - the GPIO pins of the data lines, lowest bit first.  a 4 bit
+ *                HD44780 bus lists D4 to D7.
+ * arg width    - the number of data pins, 4 or 8.
+ * arg strobe   - the enable (E) or write (WR) strobe pin.
+ * arg rs       - the register select pin, or -1 if not used.
+ * arg rw       - the read/write select pin which is held low, or -1 if not used.
+ * arg delay_us - how long the peripheral needs after each byte, up to 65535.
+ * arg flags    - `gpio_bus_strobe_low` for an active low strobe, 0 otherwise.
+ *
+ * returns - true if the bus was defined.
+ *
+ * note: all the bus pins are made outputs and driven to their idle levels.
+ */
+bool gpio_bus_define(int id, const int *data, int width, int strobe, int rs, int rw,
+                     uint32_t delay_us, int flags);
+
+/**
+ * Write bytes to a parallel bus.
+ *
+ * arg id   - the bus to write to.
+ * arg mode - `gpio_bus_rs` to select the data register, and `gpio_bus_nibble`
+ *            to send only the high nibble of each byte on a 4 bit bus.
+ * arg data - the bytes to write.
+ * arg size - the number of bytes to write.
+ *
+ * returns - true if the bytes were written.
+ *
+ * note: the board sets up the data lines before the strobe and holds them
+ *       after it, then waits the bus delay before the next byte.  with older
+ *       firmware the bus is driven pin by pin from the host, which is slow.
+ */
+bool gpio_bus_write(int id, int mode, const uint8_t *data, uint32_t size);
+
+enum {
+  gpio_lsb_first    = 0x0,  // shift the least significant bit first
+  gpio_msb_first    = 0x1,  // shift the most significant bit first
+  gpio_shift_sample = 0x2,  // sample input bits after the rising clock edge
+};
+
+/**
+ * Shift bytes out to a chain of 74HC595 class shift registers.
+ *
+ * arg data  - the GPIO pin driving the serial data input.
+ * arg clock - the GPIO pin driving the shift clock.
+ * arg latch - the GPIO pin driving the storage register clock, or -1 if not used.
+ * arg order - `gpio_msb_first` or `gpio_lsb_first`.
+ * arg src   - the bytes to shift out, the first byte ends up furthest down
+ *             the chain.
+ * arg size  - the number of bytes to shift out.
+ *
+ * returns - true if the bytes were shifted out.
+ *
+ * note: data is taken on the rising clock edge, then the latch is pulsed
+ *       high once all the bytes are in so the outputs change together.
+ */
+bool gpio_shift_out(int data, int clock, int latch, int order, const uint8_t *src, uint32_t size);
+
+/**
+ * Shift bytes in from a chain of 74HC165 class shift registers.
+ *
+ * arg data  - the GPIO pin reading the serial data output.
+ * arg clock - the GPIO pin driving the shift clock.
+ * arg latch - the GPIO pin driving the active low parallel load, or -1 if not used.
+ * arg order - `gpio_msb_first` or `gpio_lsb_first`, with `gpio_shift_sample`
+ *             to sample each bit after the rising clock edge rather than before.
+ * arg dst   - receives the bytes, the first byte from the end of the chain.
+ * arg size  - the number of bytes to shift in.
+ *
+ * returns - true if the bytes were shifted in.
+ */
+bool gpio_shift_in(int data, int clock, int latch, int order, uint8_t *dst, uint32_t size);
+
+enum {
+  gpio_macro_count   = 8,     // number of macros the board can store
+  gpio_macro_size    = 192,   // bytes of macro storage on the board
+  gpio_macro_trigger = 0x80,  // 0x80 + id is the byte that runs a macro
+  gpio_macro_arg     = 0xF0,  // 0xF0 + n in a macro body is replaced by argument n
+};
+
+/**
+ * Start recording a macro.
+ *
+ * arg id - the macro to record, 0 to 15.
+ *
+ * returns - true if recording was started.
+ *
+ * note: until `gpio_macro_end` is called commands are captured rather than
+ *       sent to the board.  only commands that do not wait for a reply can be
+ *       recorded, such as pin actions, `spi_hw_transfer` without receiving
+ *       and bus configuration.
+ */
+bool gpio_macro_begin(int id);
+
+/**
+ * Stop recording a macro and store it on the board.
+ *
+ * returns - false if a command that waits for a reply was recorded or the
+ *           macro does not fit in the board storage.
+ */
+bool gpio_macro_end(void);
+
+/**
+ * Store a macro on the board from a raw command byte sequence.
+ *
+ * arg id   - the macro to define, 0 to 15.
+ * arg body - the firmware commands to store, which may contain
+ *            `gpio_macro_arg + n` bytes to be replaced by argument n.
+ * arg size - the number of bytes in `body`, 0 deletes the macro.
+ *
+ * returns - true if the macro was stored.
+ *
+ * note: macros share `gpio_macro_size` bytes of storage on the board.
+ */
+bool gpio_macro_define(int id, const uint8_t *body, uint32_t size);
+
+/**
+ * Run a macro stored on the board.
+ *
+ * arg id   - the macro to run.
+ * arg args - one char for each argument the macro body uses (optional).
+ *
+ * note: this sends a single trigger byte followed by `args`.  any pins the
+ *       macro acts on are treated as being in an unknown state afterwards.
+ */
+void gpio_macro_run(int id, const char *args=NULL);
+
+/**
+ * Save all macros to the board flash so they are kept over a power cycle.
+ *
+ * returns - true if the macros were saved.
+ *
+ * note: the board restores saved macros whenever it is reset, discarding
+ *       any that were defined but not saved.
+ */
+bool gpio_macro_save(void);
+
 /**
  * Query the RTk.GPIO board firmware version
  *
@@ -135,6 +1060,114 @@ uint8_t spi_hw_send(uint8_t data, int cs=-1);
  */
 void gpio_board_version(char* dst, uint32_t dst_size);
 
+/**
+ * Process any events the board has sent, such as streamed samples.
+ *
+ * note: this does not wait for data, call it regularly while waiting for
+ *       events to arrive.
+ */
+void gpio_poll(void);
+
+// shared memory segment the pin state mirror is published as by default
+#define GPIO_MIRROR_NAME "/rtkgpio"
+
+enum {
+  gpio_mirror_magic = 0x524b4d31,  // "RKM1"
+  gpio_mirror_pins  = 28,
+
+  // gpio_mirror_pin_t type
+  gpio_mirror_unknown = 0,
+  gpio_mirror_input   = 1,
+  gpio_mirror_output  = 2,
+  gpio_mirror_spi     = 3,
+  gpio_mirror_i2c     = 4,
+  gpio_mirror_uart    = 5,
+  gpio_mirror_encoder = 6,
+
+  // gpio_mirror_pin_t pull, or unknown
+  gpio_mirror_pull_up   = 1,
+  gpio_mirror_pull_down = 2,
+  gpio_mirror_pull_none = 3,
+
+  // gpio_mirror_pin_t drive, or unknown
+  gpio_mirror_low  = 1,
+  gpio_mirror_high = 2,
+};
+
+typedef struct gpio_mirror_pin_t {
+  uint8_t  type;        // how the pin is being used
+  uint8_t  pull;        // pull resistor last set
+  uint8_t  drive;       // output level last written
+  uint8_t  level;       // input level last read, 0xff if never read
+  uint32_t reserved;
+  uint64_t read_us;     // host time of the last read
+  uint64_t read_stamp;  // board time of the last read, 0 without timestamps
+} gpio_mirror_pin_t;
+
+/**
+ * Pin state published by the process that owns the board.
+ *
+ * note: host times are microseconds of the monotonic clock, which every
+ *       process on the machine shares.  the state is what the owner last
+ *       set or read, no extra board traffic is made to publish it.
+ */
+typedef struct gpio_mirror_t {
+  uint32_t          magic;           // gpio_mirror_magic once initialised
+  uint32_t          size;            // sizeof(gpio_mirror_t) of the publisher
+  volatile uint32_t sequence;        // odd while an update is in progress
+  uint32_t          pid;             // publishing process
+  uint64_t          update_us;       // host time of the last update
+  uint64_t          board_time;      // latest board time seen
+  uint64_t          bytes_sent;      // traffic since the board was opened
+  uint64_t          bytes_received;
+  uint64_t          events;
+  uint64_t          pin_reads;
+  uint64_t          pin_writes;
+  gpio_mirror_pin_t pin[gpio_mirror_pins];
+} gpio_mirror_t;
+
+/**
+ * Publish the pin state of this process in shared memory.
+ *
+ * arg name - the shared memory name, usually `GPIO_MIRROR_NAME`, or NULL to
+ *            stop publishing and remove the segment.
+ *
+ * returns - true if the mirror was published, or removed.
+ *
+ * note: the mirror is updated as commands are sent, pins are read and
+ *       events arrive.  only available where POSIX shared memory is.
+ */
+bool gpio_mirror_publish(const char *name);
+
+/**
+ * Map a published pin state mirror read only.
+ *
+ * arg name - the shared memory name given to `gpio_mirror_publish`.
+ *
+ * returns - the mapped mirror, or NULL if none is published.
+ *
+ * note: read it with `gpio_mirror_read` for a consistent copy.
+ */
+const gpio_mirror_t* gpio_mirror_open(const char *name);
+
+/**
+ * Take a consistent copy of a mapped mirror.
+ *
+ * arg mirror - the mapped mirror.
+ * arg dst    - receives the copy.
+ *
+ * returns - false if no consistent copy could be made, such as when the
+ *           publisher stopped in the middle of an update.
+ *
+ * note: this makes no system calls, retrying while an update is underway.
+ */
+bool gpio_mirror_read(const gpio_mirror_t *mirror, gpio_mirror_t *dst);
+
+/**
+ * Unmap a mirror mapped by `gpio_mirror_open`.
+ */
+void gpio_mirror_close(const gpio_mirror_t *mirror);
+
 /**
  * Delay for a number of milliseconds.
  *
@@ -0,0 +1,39 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Start a software PWM signal on a wiring pi pin.
+ *
+ * arg pin          - the WiringPi pin to drive.
+ * arg initialValue - the starting pulse width in steps.
+ * arg pwmRange     - the number of steps in each cycle.
+ *
+ * returns - 0 on success or -1 on failure.
+ *
+ * note: as with WiringPi each step is 100us, so a range of 100 gives a 100Hz
+ *       signal.  the pulses are generated by a timer on the board rather
+ *       than by a host thread.
+ */
+int softPwmCreate(int pin, int initialValue, int pwmRange);
+
+/**
+ * Set the pulse width of a software PWM signal.
+ *
+ * arg pin   - the WiringPi pin passed to `softPwmCreate`.
+ * arg value - the pulse width in steps, from 0 to the range.
+ */
+void softPwmWrite(int pin, int value);
+
+/**
+ * Stop a software PWM signal, leaving the pin low.
+ *
+ * arg pin - the WiringPi pin passed to `softPwmCreate`.
+ */
+void softPwmStop(int pin);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
@@ -0,0 +1,501 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "gpio.h"
+
+// rtkgpiod owns the link to a board and shares it between client processes,
+// which connect with gpio_open("rtkgpiod:").
+//
+// clients frame their traffic as <op:1> <len:2>, lengths little endian:
+//   'S' len data  - send `len` bytes to the board
+//   'R' len       - read up to `len` bytes, waiting up to 100ms for them
+//   'A' len       - read up to `len` bytes already received, without waiting
+// and each 'R' or 'A' is answered with <len:2> data.
+//
+// the board runs commands in order and nothing marks where one reply ends,
+// so a client is given a lease while it uses the board: only its commands
+// are forwarded and every reply goes to it.  the lease passes on once the
+// client has nothing queued, is not waiting for a reply and has been quiet
+// for a short grace period.  commands other clients send meanwhile are
+// queued and forwarded together when their turn comes.  event frames are
+// taken out of the reply stream and given to every client.
+//
+// timestamps and the SPI and I2C clocks are board wide, so the last of each
+// a client chose is put back on the board whenever it is given the lease.
+
+enum {
+  max_clients = 16,
+};
+
+// idle time after which a lease passes to the next client
+#define GRACE_US        2000
+// how long a read request waits for its first byte
+#define READ_TIMEOUT_US 100000
+// pending events beyond this are dropped for a client that is not reading
+#define EVENT_LIMIT     65536
+
+#define EVENT_MARKER '!'
+
+// a board wide setting, which the library always sends as a command of its own
+struct setting_t {
+  const char *prefix;  // command letters
+  uint32_t    size;    // length of the whole command
+  const char *reset;   // the command matching the board state after a reset
+  uint32_t    ack;     // reply bytes the board sends for it
+};
+
+enum {
+  setting_timestamps,
+  setting_spi,
+  setting_i2c,
+  setting_count,
+};
+
+static const setting_t settings[setting_count] = {
+  { "@",  2,  "@0",         1 },  // '@' <enable:1>
+  { "F",  10, "F000F42400", 0 },  // 'F' <frequency:8> <mode:1>
+  { "TF", 10, "TF000186A0", 0 },  // 'TF' <frequency:8>
+};
+
+struct client_t {
+  int                  fd;           // -1 when unused
+  std::vector<uint8_t> in;           // partial frames from the client
+  std::vector<uint8_t> queue;        // commands waiting for the lease
+  std::vector<uint8_t> reply;        // replies and events for the client
+  bool                 opened;       // the opening reset has been seen
+  uint8_t              request;      // pending 'R' or 'A', or 0
+  uint32_t             request_len;
+  uint64_t             request_us;   // when the read was requested
+  uint64_t             forward_us;   // when commands were last forwarded
+  uint64_t             active_us;    // when the client last used the board
+  bool                 at_pending;   // an '@' ended the last forwarded data
+  std::vector<uint8_t> settings[setting_count];  // in effect after its forwarded commands
+  std::vector<uint8_t> pending[setting_count];   // chosen by its queued commands
+};
+
+struct board_t {
+  const gpio_transport_t *transport;
+  void                   *link;
+  int                     pipe[2];     // reader thread to main loop
+  std::atomic<bool>       running;
+  bool                    timestamps;  // events carry a stamp
+  int                     stamp_next;  // -1, or timestamps after the next reply
+  std::vector<uint8_t>    event;       // partial event frame
+  std::vector<uint8_t>    applied[setting_count];  // setting commands in effect
+  uint32_t                swallow;     // replies to settings put back by the daemon
+};
+
+static client_t clients[max_clients];
+static board_t  board;
+static int      owner      = -1;  // client holding the lease
+static int      last_owner = -1;  // client replies go to between leases
+
+static uint64_t now_us() {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void usage(void) {
+  printf(
+    "usage: rtkgpiod [options]\n"
+    "\n"
+    "options:\n"
+    "  -p <port>     serial port or transport URI of the RTk.GPIO board\n"
+    "  -s <path>     socket to listen on (default %s)\n",
+    RTKGPIOD_SOCKET);
+}
+
+// blocking reads from the board are moved onto a pipe the main loop polls
+static void board_reader() {
+  uint8_t data[512];
+  while (board.running) {
+    const uint32_t n = board.transport->read(board.link, data, sizeof(data));
+    if (n && write(board.pipe[1], data, n) != ssize_t(n)) {
+      break;
+    }
+  }
+}
+
+static int hex_value(uint8_t c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return 0;
+}
+
+static void client_close(int id) {
+  client_t &c = clients[id];
+  close(c.fd);
+  c.fd = -1;
+  c.in.clear();
+  c.queue.clear();
+  c.reply.clear();
+  if (owner == id) {
+    owner = -1;
+  }
+  if (last_owner == id) {
+    last_owner = -1;
+  }
+}
+
+static void client_accept(int listen_fd) {
+  const int fd = accept(listen_fd, NULL, NULL);
+  if (fd < 0) {
+    return;
+  }
+  for (int i = 0; i < max_clients; ++i) {
+    client_t &c = clients[i];
+    if (c.fd < 0) {
+      c.fd         = fd;
+      c.opened     = false;
+      c.request    = 0;
+      c.at_pending = false;
+      c.active_us  = now_us();
+      c.forward_us = 0;
+      for (int j = 0; j < setting_count; ++j) {
+        c.settings[j].clear();
+        c.pending[j].clear();
+      }
+      return;
+    }
+  }
+  // no room for another client
+  close(fd);
+}
+
+// pass a complete event frame to every client
+static void event_fan_out() {
+  for (client_t &c : clients) {
+    if (c.fd >= 0 && c.reply.size() < EVENT_LIMIT) {
+      c.reply.insert(c.reply.end(), board.event.begin(), board.event.end());
+    }
+  }
+  board.event.clear();
+}
+
+// sort bytes from the board into replies for the lease holder and events
+static void board_recv(const uint8_t *data, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    const uint8_t c = data[i];
+    if (!board.event.empty()) {
+      board.event.push_back(c);
+      // '!' type len:2 data:len*2 [stamp:8]
+      if (board.event.size() >= 4) {
+        const size_t len  = hex_value(board.event[2]) * 16 + hex_value(board.event[3]);
+        const size_t full = 4 + len * 2 + (board.timestamps ? 8 : 0);
+        if (board.event.size() >= full) {
+          event_fan_out();
+        }
+      }
+      continue;
+    }
+    if (c == EVENT_MARKER) {
+      board.event.push_back(c);
+      continue;
+    }
+    // the reply acknowledging '@' is the first in the new format
+    if (board.stamp_next >= 0) {
+      board.timestamps = board.stamp_next != 0;
+      board.stamp_next = -1;
+    }
+    if (board.swallow) {
+      --board.swallow;
+      continue;
+    }
+    const int to = (owner >= 0) ? owner : last_owner;
+    if (to >= 0) {
+      clients[to].reply.push_back(c);
+    }
+  }
+}
+
+// watch forwarded commands for timestamps being switched on or off
+static void track_timestamps(client_t &c) {
+  for (const uint8_t b : c.queue) {
+    if (c.at_pending) {
+      board.stamp_next = (b == '1') ? 1 : 0;
+    }
+    c.at_pending = (b == '@');
+  }
+}
+
+// remember the board wide settings a client has queued
+static void track_settings(client_t &c, const uint8_t *data, uint32_t size) {
+  for (int i = 0; i < setting_count; ++i) {
+    const setting_t &s = settings[i];
+    if (size == s.size && memcmp(data, s.prefix, strlen(s.prefix)) == 0) {
+      c.pending[i].assign(data, data + size);
+    }
+  }
+}
+
+// put the settings a client's last forwarded commands left back on the
+// board as it is given the lease, dropping the replies they cause
+static void restore_settings(const client_t &c) {
+  for (int i = 0; i < setting_count; ++i) {
+    const setting_t &s = settings[i];
+    std::vector<uint8_t> want = c.settings[i];
+    if (want.empty()) {
+      want.assign(s.reset, s.reset + s.size);
+    }
+    if (want == board.applied[i]) {
+      continue;
+    }
+    if (i == setting_timestamps) {
+      board.stamp_next = (want[1] == '1') ? 1 : 0;
+    }
+    board.transport->send(board.link, want.data(), uint32_t(want.size()));
+    board.swallow   += s.ack;
+    board.applied[i] = want;
+  }
+}
+
+// handle the frames a client has sent
+static void client_frames(int id) {
+  client_t &c = clients[id];
+  size_t pos = 0;
+  while (c.in.size() - pos >= 3) {
+    const uint8_t *frame = c.in.data() + pos;
+    const uint32_t len   = frame[1] | (frame[2] << 8);
+    if (frame[0] == 'S') {
+      if (c.in.size() - pos < 3 + len) {
+        break;
+      }
+      const uint8_t *data = frame + 3;
+      uint32_t size = len;
+      // gpio_open resets the board, which must not happen under other
+      // clients, so the opening reset is acknowledged here instead
+      if (!c.opened && size) {
+        c.opened = true;
+        if (data[0] == 'R') {
+          c.reply.push_back('O');
+          c.reply.push_back('K');
+          ++data;
+          --size;
+        }
+      }
+      track_settings(c, data, size);
+      c.queue.insert(c.queue.end(), data, data + size);
+      pos += 3 + len;
+    }
+    else {
+      c.request     = frame[0];
+      c.request_len = len;
+      c.request_us  = now_us();
+      pos += 3;
+    }
+  }
+  c.in.erase(c.in.begin(), c.in.begin() + pos);
+}
+
+static bool client_recv(int id) {
+  client_t &c = clients[id];
+  uint8_t data[4096];
+  const ssize_t n = recv(c.fd, data, sizeof(data), 0);
+  if (n <= 0) {
+    return false;
+  }
+  c.in.insert(c.in.end(), data, data + n);
+  client_frames(id);
+  return true;
+}
+
+// hand the lease on and forward the holder's queued commands
+static void schedule() {
+  const uint64_t now = now_us();
+  if (owner >= 0) {
+    const client_t &c = clients[owner];
+    if (c.queue.empty() && !c.request && now - c.active_us >= GRACE_US) {
+      owner = -1;
+    }
+  }
+  if (owner < 0) {
+    for (int i = 1; i <= max_clients; ++i) {
+      const int id = (last_owner + i + max_clients) % max_clients;
+      if (clients[id].fd >= 0 && !clients[id].queue.empty()) {
+        owner = last_owner = id;
+        restore_settings(clients[id]);
+        break;
+      }
+    }
+  }
+  if (owner >= 0) {
+    client_t &c = clients[owner];
+    if (!c.queue.empty()) {
+      track_timestamps(c);
+      board.transport->send(board.link, c.queue.data(), uint32_t(c.queue.size()));
+      c.queue.clear();
+      // the board now has whatever settings the forwarded commands chose
+      for (int i = 0; i < setting_count; ++i) {
+        if (!c.pending[i].empty()) {
+          c.settings[i].swap(c.pending[i]);
+          c.pending[i].clear();
+          board.applied[i] = c.settings[i];
+        }
+      }
+      c.forward_us = now;
+      c.active_us  = now;
+    }
+  }
+}
+
+// answer read requests that have data or have timed out
+static void serve_requests() {
+  const uint64_t now = now_us();
+  for (int i = 0; i < max_clients; ++i) {
+    client_t &c = clients[i];
+    if (c.fd < 0 || !c.request) {
+      continue;
+    }
+    // a reply can not be late while the commands are still queued
+    const uint64_t since   = c.request_us > c.forward_us ? c.request_us : c.forward_us;
+    const bool     expired = c.queue.empty() && now - since >= READ_TIMEOUT_US;
+    if (c.request == 'R' && c.reply.empty() && !expired) {
+      continue;
+    }
+    const uint32_t n = c.request_len < c.reply.size() ? c.request_len : uint32_t(c.reply.size());
+    std::vector<uint8_t> frame(2 + n);
+    frame[0] = uint8_t(n);
+    frame[1] = uint8_t(n >> 8);
+    memcpy(frame.data() + 2, c.reply.data(), n);
+    c.reply.erase(c.reply.begin(), c.reply.begin() + n);
+    if (c.request == 'R') {
+      c.active_us = now;
+    }
+    c.request = 0;
+    if (send(c.fd, frame.data(), frame.size(), MSG_NOSIGNAL) != ssize_t(frame.size())) {
+      client_close(i);
+    }
+  }
+}
+
+static int listen_on(const char *path) {
+  sockaddr_un addr = {};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (bind(fd, (const sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, max_clients) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int main(int argc, char** args) {
+
+  const char *port = nullptr;
+  const char *path = RTKGPIOD_SOCKET;
+
+  for (int arg = 1; arg < argc; ++arg) {
+    if (args[arg][0] != '-' || arg + 1 >= argc) {
+      usage();
+      return 1;
+    }
+    switch (args[arg][1]) {
+    case 'p': port = args[++arg]; break;
+    case 's': path = args[++arg]; break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  // open the board link with the same transports as gpio_open
+  const char *address = NULL;
+  board.transport = gpio_transport_find(port, &address);
+  board.link      = board.transport->open(address);
+  if (!board.link) {
+    printf("unable to open the RTk.GPIO board\n");
+    return 1;
+  }
+
+  // reset the board once, discarding the reply and any start up message
+  board.transport->send(board.link, "R", 1);
+  const uint64_t settle = now_us() + 200000;
+  uint8_t discard[64];
+  while (board.transport->read(board.link, discard, sizeof(discard)) && now_us() < settle) {
+  }
+  board.timestamps = false;
+  board.stamp_next = -1;
+  for (int i = 0; i < setting_count; ++i) {
+    board.applied[i].assign(settings[i].reset, settings[i].reset + settings[i].size);
+  }
+
+  const int listen_fd = listen_on(path);
+  if (listen_fd < 0) {
+    printf("unable to listen on '%s'\n", path);
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  if (pipe(board.pipe) != 0) {
+    return 1;
+  }
+  board.running = true;
+  std::thread reader(board_reader);
+
+  for (int i = 0; i < max_clients; ++i) {
+    clients[i].fd = -1;
+  }
+
+  for (;;) {
+    pollfd fds[2 + max_clients];
+    int    ids[2 + max_clients];
+    int    count = 0;
+    fds[count] = { listen_fd,     POLLIN, 0 }; ids[count++] = -1;
+    fds[count] = { board.pipe[0], POLLIN, 0 }; ids[count++] = -1;
+    bool waiting = owner >= 0;
+    for (int i = 0; i < max_clients; ++i) {
+      if (clients[i].fd >= 0) {
+        fds[count] = { clients[i].fd, POLLIN, 0 };
+        ids[count++] = i;
+        waiting |= clients[i].request != 0;
+      }
+    }
+    // wake for lease and read timeouts while anything is in progress
+    if (poll(fds, nfds_t(count), waiting ? 1 : -1) < 0 && errno != EINTR) {
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      client_accept(listen_fd);
+    }
+    if (fds[1].revents & POLLIN) {
+      uint8_t data[512];
+      const ssize_t n = read(board.pipe[0], data, sizeof(data));
+      if (n > 0) {
+        board_recv(data, size_t(n));
+      }
+    }
+    for (int i = 2; i < count; ++i) {
+      if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !client_recv(ids[i])) {
+        client_close(ids[i]);
+      }
+    }
+    schedule();
+    serve_requests();
+  }
+
+  board.running = false;
+  reader.join();
+  board.transport->close(board.link);
+  close(listen_fd);
+  unlink(path);
+  return 0;
+}
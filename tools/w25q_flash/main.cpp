@@ -0,0 +1,218 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gpio.h"
+#include "w25q.h"
+
+//        w25q
+//
+//         .--_--.
+//  /cs   -|     |-   3v3
+//  DO    -|     |-   /HOLD
+//  /WP   -|     |-   CLK
+//  gnd   -|     |-   DI
+//         '-----'
+//
+//  /WP and /HOLD tied to 3v3
+
+enum {
+  default_cs        = 8,
+  default_frequency = 8000000,
+};
+
+// image data is streamed through this much host memory at a time
+#define CHUNK_SIZE w25q_block_size
+
+static void usage(void) {
+  printf(
+    "usage: w25q_flash [options] <command>\n"
+    "\n"
+    "options:\n"
+    "  -p <port>               serial port of the RTk.GPIO board\n"
+    "  -c <pin>                chip select gpio pin (default %d)\n"
+    "  -f <hz>                 spi clock frequency (default %d)\n"
+    "\n"
+    "commands:\n"
+    "  id                      print the flash JEDEC id and size\n"
+    "  read <addr> <size> <file>\n"
+    "                          save a range of the flash to a file\n"
+    "  write <addr> <file>     erase, program and verify a file\n"
+    "  verify <addr> <file>    compare the flash with a file\n"
+    "  erase <addr> <size>     erase the sectors covering a range\n"
+    "  erase-chip              erase the whole flash\n",
+    default_cs, default_frequency);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  const auto now = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(now - start).count();
+}
+
+static long file_size(FILE *fd) {
+  fseek(fd, 0, SEEK_END);
+  const long size = ftell(fd);
+  fseek(fd, 0, SEEK_SET);
+  return size;
+}
+
+static int cmd_read(w25q_t *flash, uint32_t addr, uint32_t size, const char *path) {
+  FILE *fd = fopen(path, "wb");
+  if (!fd) {
+    printf("unable to create '%s'\n", path);
+    return 1;
+  }
+  static uint8_t chunk[CHUNK_SIZE];
+  for (uint32_t done = 0; done < size; ) {
+    const uint32_t len = (size - done) > uint32_t(CHUNK_SIZE) ? uint32_t(CHUNK_SIZE) : (size - done);
+    w25q_read(flash, addr + done, chunk, len);
+    fwrite(chunk, 1, len, fd);
+    done += len;
+    printf("\rread %u/%u", done, size);
+    fflush(stdout);
+  }
+  printf("\n");
+  fclose(fd);
+  return 0;
+}
+
+// check a range of the flash against the CRC of the data expected there
+static int verify_crc(w25q_t *flash, uint32_t addr, uint32_t size, uint32_t expect) {
+  uint32_t crc = 0;
+  if (!w25q_crc32(flash, addr, size, &crc)) {
+    printf("verify failed: no crc from the board\n");
+    return 1;
+  }
+  if (crc != expect) {
+    printf("verify failed: crc %08x, expected %08x\n", crc, expect);
+    return 1;
+  }
+  printf("verified crc %08x\n", crc);
+  return 0;
+}
+
+static int cmd_write(w25q_t *flash, uint32_t addr, const char *path, bool program) {
+  FILE *fd = fopen(path, "rb");
+  if (!fd) {
+    printf("unable to open '%s'\n", path);
+    return 1;
+  }
+  const uint32_t size = uint32_t(file_size(fd));
+  if (addr + size > flash->size) {
+    printf("'%s' does not fit in the flash\n", path);
+    fclose(fd);
+    return 1;
+  }
+  if (program && (addr % w25q_sector_size) != 0) {
+    printf("write address must be a multiple of %d\n", w25q_sector_size);
+    fclose(fd);
+    return 1;
+  }
+
+  // the image is streamed in, never held whole
+  static uint8_t chunk[CHUNK_SIZE];
+  uint32_t crc = 0;
+  for (uint32_t done = 0; done < size; ) {
+    const uint32_t len = uint32_t(fread(chunk, 1, CHUNK_SIZE, fd));
+    if (len == 0) {
+      break;
+    }
+    crc = gpio_crc32(crc, chunk, len);
+    if (program) {
+      if (!w25q_erase(flash, addr + done, len) ||
+          !w25q_program(flash, addr + done, chunk, len)) {
+        printf("\nprogram failed at %06x\n", addr + done);
+        fclose(fd);
+        return 1;
+      }
+      printf("\rprogram %u/%u", done + len, size);
+      fflush(stdout);
+    }
+    done += len;
+  }
+  fclose(fd);
+  if (program) {
+    if (!w25q_sync(flash)) {
+      printf("\nprogram failed\n");
+      return 1;
+    }
+    printf("\n");
+  }
+  return verify_crc(flash, addr, size, crc);
+}
+
+int main(int argc, char** args) {
+
+  const char *port = nullptr;
+  int cs = default_cs;
+  uint32_t frequency = default_frequency;
+
+  int arg = 1;
+  for (; arg < argc && args[arg][0] == '-'; ++arg) {
+    if (arg + 1 >= argc) {
+      usage();
+      return 1;
+    }
+    switch (args[arg][1]) {
+    case 'p': port      = args[++arg]; break;
+    case 'c': cs        = atoi(args[++arg]); break;
+    case 'f': frequency = uint32_t(strtoul(args[++arg], nullptr, 0)); break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+  if (arg >= argc) {
+    usage();
+    return 1;
+  }
+  const char *cmd = args[arg++];
+  const int nargs = argc - arg;
+
+  // open RTk.GPIO connection
+  if (!gpio_open(port)) {
+    printf("unable to open the RTk.GPIO board\n");
+    return 1;
+  }
+  spi_hw_config(frequency, 0);
+
+  static w25q_t flash;
+  if (!w25q_init(&flash, cs)) {
+    printf("no flash found, JEDEC id %02x %02x %02x\n",
+           flash.jedec[0], flash.jedec[1], flash.jedec[2]);
+    return 1;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  int ret = 0;
+
+  if (strcmp(cmd, "id") == 0) {
+    printf("JEDEC id %02x %02x %02x, %u bytes\n",
+           flash.jedec[0], flash.jedec[1], flash.jedec[2], flash.size);
+  }
+  else if (strcmp(cmd, "read") == 0 && nargs == 3) {
+    ret = cmd_read(&flash, uint32_t(strtoul(args[arg], nullptr, 0)),
+                   uint32_t(strtoul(args[arg + 1], nullptr, 0)), args[arg + 2]);
+  }
+  else if (strcmp(cmd, "write") == 0 && nargs == 2) {
+    ret = cmd_write(&flash, uint32_t(strtoul(args[arg], nullptr, 0)), args[arg + 1], true);
+  }
+  else if (strcmp(cmd, "verify") == 0 && nargs == 2) {
+    ret = cmd_write(&flash, uint32_t(strtoul(args[arg], nullptr, 0)), args[arg + 1], false);
+  }
+  else if (strcmp(cmd, "erase") == 0 && nargs == 2) {
+    ret = w25q_erase(&flash, uint32_t(strtoul(args[arg], nullptr, 0)),
+                     uint32_t(strtoul(args[arg + 1], nullptr, 0))) ? 0 : 1;
+  }
+  else if (strcmp(cmd, "erase-chip") == 0) {
+    ret = w25q_erase_chip(&flash) ? 0 : 1;
+  }
+  else {
+    usage();
+    ret = 1;
+  }
+
+  printf("%s in %.2fs\n", ret ? "failed" : "done", seconds_since(start));
+  gpio_close();
+  return ret;
+}